@@ -1,6 +1,8 @@
 #ifndef GPSNAV_COORD_H
 #define GPSNAV_COORD_H
 
+#include <stddef.h>
+
 struct gps_coord {
 	double la;
 	double lo;
@@ -30,7 +32,19 @@ struct gps_ellipsoid {
 struct gps_datum {
 	const char *name;
 	const struct gps_ellipsoid *ellipsoid;
-	uint16_t dx, dy, dz;
+	int16_t dx, dy, dz;
+};
+
+/* Precomputed conversion between a pair of datums */
+#define GPS_DATUM_XFORM_FROM_KKJ	0x01
+#define GPS_DATUM_XFORM_ECEF		0x02
+#define GPS_DATUM_XFORM_TO_KKJ		0x04
+
+struct gps_datum_transform {
+	int flags;
+	double a0, es0;		/* source ellipsoid */
+	double a1, b1, es1, ep1;	/* target ellipsoid */
+	double dx, dy, dz;
 };
 
 struct gps_speed {
@@ -46,6 +60,30 @@ extern void gpsnav_get_coord_for_metric(struct gps_map *map,
 					const struct gps_mcoord *mcoord,
 					struct gps_coord *coord);
 
+/* Batch conversions. The coordinates can be laid out either as arrays
+ * of structs or as separate arrays, as each input and output pointer
+ * advances by its stride (in bytes) per point. */
+extern void gpsnav_get_metric_for_coords(struct gps_map *map, int count,
+					 const double *la, const double *lo,
+					 size_t in_stride, double *n, double *e,
+					 size_t out_stride);
+extern void gpsnav_get_coords_for_metric(struct gps_map *map, int count,
+					 const double *n, const double *e,
+					 size_t in_stride, double *la, double *lo,
+					 size_t out_stride);
+
+/* Interpolated conversions for interactive use. Inside the map extent
+ * the result is within GPS_PROJ_GRID_MAX_ERROR meters of the exact
+ * conversion; outside of it the exact conversion is used. */
+#define GPS_PROJ_GRID_MAX_ERROR	0.1
+
+extern void gpsnav_get_metric_for_coord_interp(struct gps_map *map,
+					       const struct gps_coord *coord,
+					       struct gps_mcoord *out);
+extern void gpsnav_get_coord_for_metric_interp(struct gps_map *map,
+					       const struct gps_mcoord *mcoord,
+					       struct gps_coord *coord);
+
 extern int gpsnav_get_xy_for_coord(struct gps_map *map,
 				   const struct gps_coord *coord,
 				   double *x_out, double *y_out);
@@ -60,11 +98,25 @@ extern void gpsnav_calc_metric_isect(const struct gps_marea *a1,
 extern double gpsnav_calculate_area(struct gps_map *map,
 				    const struct gps_area *area);
 
+/* Returns a PJ shared through the gpsnav instance for the given
+ * proj4 parameters, creating it on first use. It must not be freed. */
+extern void *gpsnav_get_proj(struct gpsnav *gpsnav, int argc, char **argv);
+extern void gpsnav_purge_proj_cache(struct gpsnav *gpsnav);
+
 extern const struct gps_datum *gpsnav_find_datum(struct gpsnav *gpsnav, const char *name);
 extern void gpsnav_convert_datum(struct gps_coord *coord,
 				 const struct gps_datum *from,
 				 const struct gps_datum *to);
 
+/* A NULL datum means WGS 84. The batch conversion works in place, with
+ * the pointers advancing by stride bytes per point. */
+extern void gpsnav_init_datum_transform(struct gps_datum_transform *xf,
+					const struct gps_datum *from,
+					const struct gps_datum *to);
+extern void gpsnav_transform_datum(const struct gps_datum_transform *xf,
+				   int count, double *la, double *lo,
+				   size_t stride);
+
 extern const struct gps_datum gps_datum_table[];
 
 
@@ -24,7 +24,13 @@ struct gps_data_t;
 struct gps_fix_t;
 struct gps_map;
 struct gps_map_provider;
+struct gps_map_partition;
 struct gps_pixcache_entry;
+struct gps_rtree;
+struct gps_strset;
+struct gps_proj_grid;
+struct gps_proj_cache_entry;
+struct gps_tmerc;
 
 struct gpsnav {
 	struct gps_data_t *gps_conn;
@@ -35,6 +41,14 @@ struct gpsnav {
 	LIST_HEAD(map_list, gps_map) map_list;
 	LIST_HEAD(map_provider_list, gps_map_provider) map_prov_list;
 
+	/* Spatial index over map->area. Metric areas are only comparable
+	 * between maps of the same projection, so they are indexed
+	 * per projection partition. */
+	struct gps_rtree *area_index;
+	LIST_HEAD(map_partition_list, gps_map_partition) map_part_list;
+	/* Projections interned by gpsnav_get_proj() */
+	LIST_HEAD(proj_cache_list, gps_proj_cache_entry) proj_cache;
+
 	struct gps_pixcache_entry *pc_head, *pc_tail;
 	unsigned int pc_max_size, pc_cur_size;
 };
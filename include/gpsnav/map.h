@@ -26,12 +26,33 @@ struct gps_map {
 	void *proj;
 	const struct gps_datum *datum; /* NULL means WGS-84 */
 	struct gps_map_provider *prov;
+	struct gps_map_partition *part;
+	struct gps_proj_grid *grid;	/* see projgrid.c */
+	struct gps_tmerc *tmerc;	/* see tmerc.c */
+	char *key;		/* from get_map_key() */
 
 	void *data;
 
 	LIST_ENTRY(gps_map) entries;
 };
 
+/* Maps whose native scale falls within [2^band, 2^(band + 1)) m/pixel */
+struct gps_scale_band {
+	int band;
+	struct gps_rtree *marea_index;
+};
+
+/* Maps sharing a projection (type and central meridian), indexed by
+ * metric area within each scale band. Bands are sorted by band. */
+struct gps_map_partition {
+	const char *descr;
+	double lam0;
+	struct gps_scale_band *bands;
+	int band_count;
+
+	LIST_ENTRY(gps_map_partition) entries;
+};
+
 struct gps_map_provider {
 	const char *name;
 	int (* get_pixels)(struct gpsnav *nav, struct gps_map *map,
@@ -43,9 +64,14 @@ struct gps_map_provider {
 			     struct gps_key_value **kv, int *kv_count,
 			     const char *base_path);
 	void (* free_map)(struct gps_map *map);
+	/* Canonical file path of the map to be added, used to detect
+	 * duplicates before add_map() loads anything. Stored in map->key. */
+	char *(* get_map_key)(struct gps_key_value *kv, int kv_count,
+			      const char *base_path);
 	int (* init)(struct gpsnav *gpsnav, struct gps_map_provider *prov);
 	void (* finish)(struct gpsnav *gpsnav, struct gps_map_provider *prov);
 	void *data;
+	struct gps_strset *map_keys;
 
 	LIST_ENTRY(gps_map_provider) entries;
 };
@@ -69,6 +95,53 @@ extern struct gps_map **gpsnav_find_maps_for_area(struct gpsnav *gpsnav,
 extern struct gps_map **gpsnav_find_maps_for_marea(struct gpsnav *gpsnav, struct gps_map *ref_map,
 						   const struct gps_marea *area);
 
+/* Map visitors: cb is called for every matching map, and a non-zero
+ * return value from cb stops the iteration and is returned. */
+extern int gpsnav_for_each_map(struct gpsnav *gpsnav,
+			       int (* cb)(struct gps_map *map, void *arg),
+			       void *arg);
+extern int gpsnav_for_each_map_for_coord(struct gpsnav *gpsnav,
+					 const struct gps_coord *coord,
+					 int (* cb)(struct gps_map *map, void *arg),
+					 void *arg);
+extern int gpsnav_for_each_map_in_area(struct gpsnav *gpsnav,
+				       const struct gps_area *area,
+				       int (* cb)(struct gps_map *map, void *arg),
+				       void *arg);
+extern int gpsnav_for_each_map_in_marea(struct gpsnav *gpsnav,
+					struct gps_map *ref_map,
+					const struct gps_marea *marea,
+					int (* cb)(struct gps_map *map, void *arg),
+					void *arg);
+
+/* Store at most max_maps matching maps to the caller's buffer. Like
+ * snprintf(), the return value is the total number of matches. */
+extern int gpsnav_get_maps_for_coord(struct gpsnav *gpsnav,
+				     const struct gps_coord *coord,
+				     struct gps_map **maps, int max_maps);
+extern int gpsnav_get_maps_for_area(struct gpsnav *gpsnav,
+				    const struct gps_area *area,
+				    struct gps_map **maps, int max_maps);
+extern int gpsnav_get_maps_for_marea(struct gpsnav *gpsnav,
+				     struct gps_map *ref_map,
+				     const struct gps_marea *marea,
+				     struct gps_map **maps, int max_maps);
+
+extern void gpsnav_purge_map_partitions(struct gpsnav *gpsnav);
+
+extern int gpsnav_get_scale_band(double scale);
+/* Store at most max_bands of the scale bands that have maps in
+ * ref_map's projection, in ascending order. Returns the total count. */
+extern int gpsnav_get_marea_scale_bands(struct gpsnav *gpsnav,
+					struct gps_map *ref_map,
+					int *bands, int max_bands);
+extern int gpsnav_for_each_map_in_marea_band(struct gpsnav *gpsnav,
+					     struct gps_map *ref_map,
+					     const struct gps_marea *marea,
+					     int band,
+					     int (* cb)(struct gps_map *map, void *arg),
+					     void *arg);
+
 extern struct gps_map *gps_map_new(void);
 extern void gps_map_free(struct gps_map *map);
 
@@ -0,0 +1,245 @@
+/*
+ * Composing map drawing on the client side
+ *
+ * Instead of one gdk_draw_pixbuf() and fill per map rectangle, the
+ * pixels of a whole area are converted straight into an image in the
+ * visual's own format and uploaded with a single gdk_draw_image().
+ * The image is created with GDK_IMAGE_FASTEST, so it lives in shared
+ * memory whenever the X server supports MIT-SHM. Visuals the
+ * conversion does not handle fall back to drawing directly.
+ *
+ * The render thread, which must not touch X, composes into plain RGB
+ * buffers instead, and the main thread uploads those the same way.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "gropes.h"
+
+#define HOST_BYTE_ORDER	(G_BYTE_ORDER == G_LITTLE_ENDIAN ? \
+			 GDK_LSB_FIRST : GDK_MSB_FIRST)
+
+#define RGB_PIXEL(v, s)							\
+	((guint32) ((s)[0] >> (8 - (v)->red_prec)) << (v)->red_shift |	\
+	 (guint32) ((s)[1] >> (8 - (v)->green_prec)) << (v)->green_shift | \
+	 (guint32) ((s)[2] >> (8 - (v)->blue_prec)) << (v)->blue_shift)
+
+static int visual_supported(const GdkVisual *v)
+{
+	if (v == NULL || v->type != GDK_VISUAL_TRUE_COLOR)
+		return 0;
+	return v->red_prec <= 8 && v->green_prec <= 8 && v->blue_prec <= 8;
+}
+
+static GdkImage *get_compose_image(struct gropes_state *gs,
+				   GtkWidget *widget, GdkDrawable *d,
+				   int width, int height)
+{
+	GdkVisual *visual;
+	GdkImage *image = gs->comp_image;
+
+	if (image != NULL) {
+		if (image->width >= width && image->height >= height) {
+			/* The server may still be reading the last upload
+			 * from shared memory */
+			if (gs->comp_pending)
+				gdk_flush();
+			gs->comp_pending = 0;
+			return image;
+		}
+		width = MAX(width, image->width);
+		height = MAX(height, image->height);
+		free_compose_image(gs);
+	}
+
+	visual = gdk_drawable_get_visual(widget->window);
+	if (!visual_supported(visual) ||
+	    visual->depth != gdk_drawable_get_depth(d))
+		return NULL;
+	image = gdk_image_new(GDK_IMAGE_FASTEST, visual, width, height);
+	if (image == NULL)
+		return NULL;
+	if ((image->bpp != 2 && image->bpp != 4) ||
+	    image->byte_order != HOST_BYTE_ORDER) {
+		g_object_unref(image);
+		return NULL;
+	}
+	gs->comp_image = image;
+
+	return image;
+}
+
+void free_compose_image(struct gropes_state *gs)
+{
+	if (gs->comp_image == NULL)
+		return;
+	if (gs->comp_pending)
+		gdk_flush();
+	g_object_unref(gs->comp_image);
+	gs->comp_image = NULL;
+	gs->comp_pending = 0;
+}
+
+void target_init(struct gropes_state *gs, struct draw_target *t,
+		 GtkWidget *widget, GdkDrawable *d, const GdkRectangle *area)
+{
+	t->gs = gs;
+	t->widget = widget;
+	t->d = d;
+	t->area = *area;
+	t->rgb = NULL;
+	t->image = get_compose_image(gs, widget, d, area->width, area->height);
+}
+
+void target_init_rgb(struct gropes_state *gs, struct draw_target *t,
+		     const GdkRectangle *area, guchar *rgb, int stride,
+		     const guchar *bg)
+{
+	t->gs = gs;
+	t->widget = NULL;
+	t->d = NULL;
+	t->image = NULL;
+	t->area = *area;
+	t->rgb = rgb;
+	t->rgb_stride = stride;
+	memcpy(t->bg, bg, sizeof(t->bg));
+}
+
+void target_finish(struct draw_target *t)
+{
+	if (t->image == NULL)
+		return;
+	gdk_draw_image(t->d, t->widget->style->fg_gc[GTK_STATE_NORMAL],
+		       t->image, 0, 0, t->area.x, t->area.y, t->area.width,
+		       t->area.height);
+	t->gs->comp_pending = 1;
+	t->image = NULL;
+}
+
+static guchar *image_pixel(struct draw_target *t, int x, int y)
+{
+	return (guchar *) t->image->mem + (y - t->area.y) * t->image->bpl +
+		(x - t->area.x) * t->image->bpp;
+}
+
+static guchar *rgb_pixel(struct draw_target *t, int x, int y)
+{
+	return t->rgb + (y - t->area.y) * t->rgb_stride + (x - t->area.x) * 3;
+}
+
+static void rgb_draw(struct draw_target *t, const guchar *src_row,
+		     int stride, int n_channels, const GdkRectangle *dest)
+{
+	int x, y;
+
+	for (y = 0; y < dest->height; y++, src_row += stride) {
+		guchar *p = rgb_pixel(t, dest->x, dest->y + y);
+		const guchar *s = src_row;
+
+		if (n_channels == 3) {
+			memcpy(p, s, dest->width * 3);
+			continue;
+		}
+		for (x = 0; x < dest->width; x++, p += 3, s += n_channels)
+			if (s[3] >= 0x80)
+				memcpy(p, s, 3);
+	}
+}
+
+void target_fill(struct draw_target *t, const GdkRectangle *area)
+{
+	guint32 pixel;
+	int x, y;
+
+	if (t->rgb != NULL) {
+		for (y = area->y; y < area->y + area->height; y++) {
+			guchar *p = rgb_pixel(t, area->x, y);
+
+			for (x = 0; x < area->width; x++, p += 3)
+				memcpy(p, t->bg, 3);
+		}
+		return;
+	}
+	if (t->image == NULL) {
+		grey_fill(t->widget, t->d, area);
+		return;
+	}
+	pixel = t->widget->style->bg[GTK_STATE_NORMAL].pixel;
+	for (y = area->y; y < area->y + area->height; y++) {
+		guchar *row = image_pixel(t, area->x, y);
+
+		if (t->image->bpp == 2) {
+			guint16 *p = (guint16 *) row;
+
+			for (x = 0; x < area->width; x++)
+				p[x] = pixel;
+		} else {
+			guint32 *p = (guint32 *) row;
+
+			for (x = 0; x < area->width; x++)
+				p[x] = pixel;
+		}
+	}
+}
+
+static void image_draw(struct draw_target *t, const guchar *src_row,
+		       int stride, int n_channels, const GdkRectangle *dest)
+{
+	const GdkVisual *v = t->image->visual;
+	int x, y;
+
+	for (y = 0; y < dest->height; y++, src_row += stride) {
+		guchar *row = image_pixel(t, dest->x, dest->y + y);
+		const guchar *s = src_row;
+
+		if (t->image->bpp == 2) {
+			guint16 *p = (guint16 *) row;
+
+			for (x = 0; x < dest->width; x++, s += n_channels)
+				if (n_channels == 3 || s[3] >= 0x80)
+					p[x] = RGB_PIXEL(v, s);
+		} else {
+			guint32 *p = (guint32 *) row;
+
+			for (x = 0; x < dest->width; x++, s += n_channels)
+				if (n_channels == 3 || s[3] >= 0x80)
+					p[x] = RGB_PIXEL(v, s);
+		}
+	}
+}
+
+/* Draws the pixbuf from src_x, src_y to dest. Pixels that are more
+ * than half transparent are left alone, the rest are drawn opaque. */
+void target_draw_pixbuf(struct draw_target *t, GdkPixbuf *pb,
+			int src_x, int src_y, const GdkRectangle *dest)
+{
+	const guchar *src_row;
+	int n_channels, stride;
+
+	n_channels = gdk_pixbuf_get_n_channels(pb);
+	stride = gdk_pixbuf_get_rowstride(pb);
+	src_row = gdk_pixbuf_get_pixels(pb) + src_y * stride +
+		src_x * n_channels;
+	if (t->rgb != NULL)
+		rgb_draw(t, src_row, stride, n_channels, dest);
+	else if (t->image != NULL)
+		image_draw(t, src_row, stride, n_channels, dest);
+	else
+		gdk_draw_pixbuf(t->d, t->widget->style->fg_gc[GTK_STATE_NORMAL],
+				pb, src_x, src_y, dest->x, dest->y,
+				dest->width, dest->height,
+				GDK_RGB_DITHER_NONE, 0, 0);
+}
+
+/* Draws packed RGB pixels to dest */
+void target_draw_rgb(struct draw_target *t, const guchar *data, int stride,
+		     const GdkRectangle *dest)
+{
+	if (t->rgb != NULL)
+		rgb_draw(t, data, stride, 3, dest);
+	else if (t->image != NULL)
+		image_draw(t, data, stride, 3, dest);
+	else
+		gdk_draw_rgb_image(t->d, t->widget->style->fg_gc[GTK_STATE_NORMAL],
+				   dest->x, dest->y, dest->width, dest->height,
+				   GDK_RGB_DITHER_NONE, (guchar *) data, stride);
+}
@@ -179,7 +179,7 @@ int expedia_dl(struct gpsnav *nav, struct gps_coord *start,
 
 	projc[0] = "ellps=WGS84";
 	projc[1] = "proj=merc";
-	pj = pj_init(2, projc);
+	pj = gpsnav_get_proj(nav, 2, projc);
 	if (pj == NULL) {
 		fprintf(stderr, "Unable to init projection\n");
 		return -1;
@@ -230,7 +230,6 @@ int expedia_dl(struct gpsnav *nav, struct gps_coord *start,
 		cur.n += y_len;
 	} while (cur.n < end_xy.y);
 fail:
-	pj_free(pj);
 	curl_easy_cleanup(curl);
 	return r;
 }
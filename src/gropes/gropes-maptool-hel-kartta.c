@@ -260,7 +260,7 @@ int kartta_hel_dl(struct gpsnav *nav, struct gps_coord *start,
 	/* KKJ zone 2 */
 	projc[2] = "x_0=2500000";
 	projc[3] = "lon_0=24";
-	pj = pj_init(4, projc);
+	pj = gpsnav_get_proj(nav, 4, projc);
 
 	lp.phi = deg2rad(start_hayf.la);
 	lp.lam = deg2rad(start_hayf.lo);
@@ -325,7 +325,6 @@ int kartta_hel_dl(struct gpsnav *nav, struct gps_coord *start,
 		cur.n += y_len;
 	} while (cur.n < end_xy.y);
 fail:
-	pj_free(pj);
 	curl_easy_cleanup(curl);
 	return r;
 }
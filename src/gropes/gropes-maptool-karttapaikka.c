@@ -107,11 +107,10 @@ static int wgs84_to_xy(struct gpsnav *nav,
 	projc[1] = "proj=tmerc";
 	projc[2] = x_0;
 	projc[3] = lon_0;
-	pj = pj_init(4, projc);
+	pj = gpsnav_get_proj(nav, 4, projc);
 	lp.phi = deg2rad(hayf.la);
 	lp.lam = deg2rad(hayf.lo);
 	*xy = pj_fwd(lp, pj);
-	pj_free(pj);
 
 	/* Only allow values within Finland  */
 	if ((wgs84->la < MIN_LA) || (wgs84->la > MAX_LA) ||
@@ -147,12 +146,11 @@ static int xy_to_wgs84(struct gpsnav *nav,
 	projc[1] = "proj=tmerc";
 	projc[2] = x_0;
 	projc[3] = lon_0;
-	pj = pj_init(4, projc);
+	pj = gpsnav_get_proj(nav, 4, projc);
 	lp = pj_inv(*xy, pj);
 	position->lo = rad2deg(lp.lam);
 	position->la = rad2deg(lp.phi);
 	gpsnav_convert_datum(position, kkj, NULL);
-	pj_free(pj);
 
 	return 0;
 }
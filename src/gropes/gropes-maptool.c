@@ -102,6 +102,13 @@ extern int expedia_dl(struct gpsnav *nav, struct gps_coord *start,
 		      struct gps_coord *end, const char *scale);
 extern int karttapaikka_dl(struct gpsnav *nav, struct gps_coord *start,
 		      struct gps_coord *end, const char *scale);
+struct mericd_scan_cache;
+extern int mericd_scan_directory_cached(struct gpsnav *nav, const char *dirname,
+					const char *cache_fname,
+					struct mericd_scan_cache **new_cache);
+extern int mericd_scan_cache_save(const struct mericd_scan_cache *c,
+				  const char *fname);
+extern void mericd_scan_cache_free(struct mericd_scan_cache *c);
 
 static const char *mapdb_file = "mapdb.xml";
 
@@ -114,7 +121,9 @@ int main(int argc, char *argv[])
 	const char *oikotie_map = NULL;
 	const char *expedia_scale = NULL;
 	const char *karttapaikka_map = NULL;
-	int overwrite = 0;
+	int overwrite = 0, mapdb_loaded = 0;
+	struct mericd_scan_cache *mericd_cache = NULL;
+	char cache_fname[512];
 	struct gps_coord start, end;
 	struct gpsnav *nav;
 
@@ -179,10 +188,17 @@ int main(int argc, char *argv[])
 	}
 
 	if (!overwrite && access(mapdb_file, R_OK) == 0)
-		gpsnav_mapdb_read(nav, mapdb_file);
+		mapdb_loaded = gpsnav_mapdb_read(nav, mapdb_file) == 0;
 
+	/* The scan cache is only valid together with the map database
+	 * the charts were added to, so it is only used if that was read
+	 * and only saved once the new one is written */
+	snprintf(cache_fname, sizeof(cache_fname), "%s.mericd-cache",
+		 mapdb_file);
 	if (flags & (1 << CMD_ADD_MERICD_MAPS)) {
-		r = mericd_scan_directory(nav, mericd_dir);
+		r = mericd_scan_directory_cached(nav, mericd_dir,
+						 mapdb_loaded ? cache_fname : NULL,
+						 &mericd_cache);
 		if (r < 0)
 			goto err;
 	}
@@ -207,11 +223,16 @@ int main(int argc, char *argv[])
 	}
 
 	printf("Writing map database to '%s'...\n", mapdb_file);
-	gpsnav_mapdb_write(nav, mapdb_file);
+	if (gpsnav_mapdb_write(nav, mapdb_file) < 0)
+		goto err;
+	if (mericd_cache != NULL)
+		mericd_scan_cache_save(mericd_cache, cache_fname);
 
+	mericd_scan_cache_free(mericd_cache);
 	gpsnav_finish(nav);
 	return 0;
 err:
+	mericd_scan_cache_free(mericd_cache);
 	gpsnav_finish(nav);
 	return 2;
 }
@@ -80,54 +80,6 @@ char *get_map_fname(struct gpsnav *nav, struct gps_map *map)
 	return fname;
 }
 
-static GdkPixbuf *pixbuf_rotate(GdkPixbuf *pixbuf, double angle)
-{
-	int x, y, x_rot, y_rot, x_tran, y_tran, center_x, center_y;
-	int channels, channels_rot, rowstride, rowstride_rot;
-	int width, height;
-	double cosv, sinv;
-	guchar *pixels, *pixels_rot, *p, *p_rot;
-	GdkPixbuf *pixbuf_rot;
-
-	width = gdk_pixbuf_get_width(pixbuf);
-	height = gdk_pixbuf_get_height(pixbuf);
-	pixbuf_rot = gdk_pixbuf_new(GDK_COLORSPACE_RGB, TRUE, 8, width, height);
-
-	pixels = gdk_pixbuf_get_pixels(pixbuf);
-	pixels_rot = gdk_pixbuf_get_pixels(pixbuf_rot);
-	channels = gdk_pixbuf_get_n_channels(pixbuf);
-	channels_rot = gdk_pixbuf_get_n_channels(pixbuf_rot);
-	rowstride = gdk_pixbuf_get_rowstride(pixbuf);
-	rowstride_rot = gdk_pixbuf_get_rowstride(pixbuf_rot);
-	cosv = cos(2 * M_PI - angle);
-	sinv = sin(2 * M_PI - angle);
-
-	center_x = width / 2;
-	center_y = height / 2;
-
-	memset(pixels_rot, 0x00, width * height * channels);
-	for (y_rot = 0; y_rot < height; y_rot++) {
-		for (x_rot = 0; x_rot < width; x_rot++) {
-			x_tran = x_rot - center_x;
-			y_tran = y_rot - center_y;
-
-			x = x_tran * cosv - y_tran * sinv;
-			y = x_tran * sinv + y_tran * cosv;
-
-			x += center_x;
-			y += center_y;
-
-			if (x >= 0 && y >= 0 && x < width && y < height) {
-				p = pixels + y * rowstride + x * channels;
-				p_rot = pixels_rot + y_rot * rowstride_rot + x_rot * channels_rot;
-				memcpy(p_rot, p, channels);
-			}
-		}
-	}
-
-	return pixbuf_rot;
-}
-
 static void draw_vehicle(struct gpsnav *nav, struct map_state *state)
 {
 	GdkGC *gc;
@@ -150,43 +102,6 @@ static void draw_vehicle(struct gpsnav *nav, struct map_state *state)
 	g_object_unref(gc);
 }
 
-static void draw_track(struct map_state *ms, struct item_on_screen *item)
-{
-	GdkGC *gc;
-	GdkColor color;
-	struct item_track *point;
-	int x, y, nx, ny;
-
-	gc = gdk_gc_new(GDK_DRAWABLE(ms->darea->window));
-	if (gc == NULL)
-		return;
-	color.red = 0xffff;
-	color.green = 0x0;
-	color.blue = 0;
-	color.pixel = 0x00ff00;
-
-	gdk_gc_set_foreground(gc, &color);
-	gdk_gc_set_line_attributes(gc, 5, GDK_LINE_SOLID, GDK_CAP_PROJECTING,
-				   GDK_JOIN_MITER);
-	if (item->track != NULL && item->pos_valid) {
-		if (!get_xy_on_screen(ms, &item->mpos, &x, &y) &&
-		    !get_xy_on_screen(ms, &item->track->mpos, &nx, &ny))
-			gdk_draw_line(ms->darea->window, gc, x, y, nx, ny);
-	}
-
-	for (point = item->track; point != NULL; point = point->next) {
-		if (point->next == NULL)
-			break;
-
-		if (!get_xy_on_screen(ms, &point->mpos, &x, &y) &&
-		    !get_xy_on_screen(ms, &point->next->mpos, &nx, &ny)) {
-			gdk_draw_line(ms->darea->window, gc, x, y, nx, ny);
-		}
-	}
-
-	g_object_unref(gc);
-};
-
 void redraw_map_area(struct gropes_state *state, struct map_state *ms,
 		     GtkWidget *widget, const GdkRectangle *area)
 {
@@ -203,7 +118,7 @@ void redraw_map_area(struct gropes_state *state, struct map_state *ms,
 	black.green = 0;
 	black.blue = 0;
 	black.pixel = 0;
-	draw_maps(state, widget, ms->mos_list, area);
+	draw_map_view(state, ms, widget, area);
 	if (ms->me.draw_track)
 		draw_track(ms, &ms->me);
 	if (ms->me.pos_valid && ms->me.on_screen &&
@@ -298,6 +213,12 @@ static gboolean on_win_key_pressed(GtkWidget *widget,
 
 void gropes_shutdown(void)
 {
+	render_stop(&gropes_state);
+	purge_map_cache(&gropes_state);
+	purge_warp_cache(&gropes_state);
+	purge_tile_cache(&gropes_state);
+	free_compose_image(&gropes_state);
+	track_log_close(&gropes_state.big_map.me.track);
 	gpsnav_finish(gropes_state.nav);
 	gtk_main_quit();
 }
@@ -389,6 +310,21 @@ static int scan_mapdb(struct gpsnav *nav, const char *dirname, int nest)
 }
 
 
+static int get_first_map(struct gps_map *map, void *arg)
+{
+	*(struct gps_map **) arg = map;
+	return 1;
+}
+
+static int get_largest_scale_map(struct gps_map *map, void *arg)
+{
+	struct gps_map **best = arg;
+
+	if (*best == NULL || map->scale_x > (*best)->scale_x)
+		*best = map;
+	return 0;
+}
+
 int main(int argc, char *argv[])
 {
 	struct gpsnav *nav;
@@ -396,7 +332,6 @@ int main(int argc, char *argv[])
 	struct gps_coord center_pos;
 	struct gps_mcoord center_mpos;
 	double scale;
-	struct gps_map **maps;
 	int i, r;
 
 	gtk_init(&argc, &argv);
@@ -417,6 +352,18 @@ int main(int argc, char *argv[])
 	/* Pixel cache of 10 MB by default */
 	nav->pc_max_size = 1 * 1024 * 1024;
 	gropes_state.mc_max_size = 10 * 1024 * 1024;
+	gropes_state.wt_max_size = 4 * 1024 * 1024;
+	gropes_state.pt_max_pixels = 2 * 1024 * 1024;
+	/* The recorded track beyond the chunk in memory is only kept if
+	 * asked for */
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--track-log") == 0 && i + 1 < argc) {
+			gropes_state.big_map.me.track.spill_fname = argv[++i];
+			continue;
+		}
+		fprintf(stderr, "Usage: %s [--track-log FILE]\n", argv[0]);
+		return 1;
+	}
 
 
 	r = gpsnav_mapdb_read(nav, "mapdb.xml");
@@ -428,18 +375,20 @@ int main(int argc, char *argv[])
 	}
 
 	pthread_mutex_init(&gropes_state.big_map.mutex, NULL);
+	pthread_mutex_init(&gropes_state.pixels_lock, NULL);
 
 	scale = 0;
 
-	maps = gpsnav_find_maps(nav, NULL, NULL);
-	if (maps == NULL) {
+	ref_map = NULL;
+	gpsnav_for_each_map(nav, get_first_map, &ref_map);
+	if (ref_map == NULL) {
 		printf("No maps found.\n");
 		return -1;
 	}
-	center_pos.la = (maps[0]->area.start.la +
-			maps[0]->area.end.la) / 2;
-	center_pos.lo = (maps[0]->area.start.lo +
-			maps[0]->area.end.lo) / 2;
+	center_pos.la = (ref_map->area.start.la +
+			ref_map->area.end.la) / 2;
+	center_pos.lo = (ref_map->area.start.lo +
+			ref_map->area.end.lo) / 2;
 
 #if 0
 	/* Munkkiniemen silta */
@@ -457,28 +406,25 @@ int main(int argc, char *argv[])
 	center_pos.lo = 24.062860;
 	scale = 9.602449;
 #endif
-	maps = gpsnav_find_maps_for_coord(nav, &center_pos);
-	if (maps == NULL) {
+	/* Find the map with the largest scale */
+	ref_map = NULL;
+	gpsnav_for_each_map_for_coord(nav, &center_pos, get_largest_scale_map,
+				      &ref_map);
+	if (ref_map == NULL) {
 		printf("No map found for coordinates\n");
 		return -1;
 	}
-
-	/* Find the map with the largest scale */
-	ref_map = maps[0];
-	for (i = 1; maps[i] != NULL; i++) {
-		if (maps[i]->scale_x > ref_map->scale_x)
-			ref_map = maps[i];
-	}
 	if (scale == 0)
 		scale = (ref_map->scale_x + ref_map->scale_y) / 2;
 
 	gpsnav_get_metric_for_coord(ref_map, &center_pos, &center_mpos);
 
-	free(maps);
-
 	gropes_state.big_map.me.area.height = gropes_state.big_map.me.area.width = 20;
 	gropes_state.big_map.ref_map = ref_map;
 	change_map_center(&gropes_state, &gropes_state.big_map, &center_mpos, scale);
+	if (render_start(&gropes_state, &gropes_state.big_map) < 0)
+		fprintf(stderr, "Unable to start the render thread, drawing "
+			"maps as the layout changes\n");
 
 #ifdef USE_HILDON
 	create_hildon_ui(&gropes_state);
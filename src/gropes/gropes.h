@@ -1,6 +1,8 @@
 #ifndef GROPES_H
 #define GROPES_H
 
+#include <stdio.h>
+#include <stdint.h>
 #include <gtk/gtk.h>
 
 #include <gpsnav/map.h>
@@ -11,18 +13,70 @@
 #define GROPES_MODE_TERRESTRIAL	0
 #define GROPES_MODE_NAUTICAL	1
 
+/* Slower than this (in knots) the course is too noisy to turn the
+ * map by */
+#define TRACK_UP_MIN_SPEED	1.0
+
 struct map_state;
 
+/* Thresholds for recording fixes, in metres and seconds */
+#define TRACK_MIN_DISTANCE	5.0
+#define TRACK_MAX_INTERVAL	30
+
+#define TRACK_LOG_BYTES		4096
+
+/* Recorded fixes. Positions are in 1e-7 degrees and times in seconds
+ * since the epoch. The first fix is in the header, the rest are
+ * varint coded differences to the fix before. */
+struct track_log_chunk {
+	int32_t la, lo;
+	uint32_t time;
+	int count, len;
+	uint8_t data[TRACK_LOG_BYTES];
+};
+
 struct item_track {
+	/* Full chunks are appended to the spill file, if there is one,
+	 * and freed */
+	struct track_log_chunk *chunk;
+	const char *spill_fname;
+	FILE *spill;
+	/* The last recorded fix */
+	int32_t la, lo;
+	uint32_t time;
 	struct gps_mcoord mpos;
-	struct item_track *next;
+	unsigned int count;	/* fixes recorded */
+};
+
+#define TRACK_LEVELS		8
+#define TRACK_CHUNK_POINTS	256
+/* Chunks kept per level */
+#define TRACK_LEVEL_CHUNKS	32
+
+/* Points of one track level, oldest first, with the number of the fix
+ * each came from. Each chunk starts with the last point of the one
+ * before, so that chunks can be culled on their own. */
+struct track_chunk {
+	struct gps_marea bounds;
+	int count;
+	struct track_chunk *next;
+	struct gps_mcoord pt[TRACK_CHUNK_POINTS];
+	unsigned int seq[TRACK_CHUNK_POINTS];
+};
+
+/* At most TRACK_LEVEL_CHUNKS chunks, oldest dropped first */
+struct track_level {
+	struct track_chunk *head, *tail;
+	int n_chunks;
 };
 
 struct item_on_screen {
 	struct gps_coord pos;
 	struct gps_mcoord mpos;
 	struct gps_speed speed;
-	struct item_track *track;
+	struct item_track track;
+	/* The track thinned for drawing at coarser scales */
+	struct track_level track_lod[TRACK_LEVELS];
 	GdkRectangle area;
 	int pos_valid:1, on_screen:1, draw_track:1, follow:1;
 	void (* update_info)(struct map_state *, struct item_on_screen *);
@@ -30,12 +84,25 @@ struct item_on_screen {
 
 struct map_on_screen {
 	struct gps_map *map;
+	/* map_area of the map is drawn scaled to draw_area, which may
+	 * reach outside the layout once it has been panned */
 	GdkRectangle map_area;
 	GdkRectangle draw_area;
+	GdkRectangle clip_area;	/* the part of the layout drawn from it */
+	int warp:1;	/* map is in another projection, map_area unused */
 
 	struct map_on_screen *next;
 };
 
+/* A layout with the view it was made for */
+struct layout_view {
+	struct map_on_screen *mos_list;
+	struct gps_map *ref_map;
+	struct gps_marea marea;
+	double scale;
+	GdkRectangle area;	/* the part of the layout being drawn */
+};
+
 struct map_state {
 	struct gps_coord center_pos;
 	struct gps_mcoord center_mpos;
@@ -44,6 +111,29 @@ struct map_state {
 	double scale;
 	struct map_on_screen *mos_list;
 	int width, height;
+	/* Parameters mos_list was laid out with. The layout covers the
+	 * view and a margin around it, and is drawn to the backing
+	 * store. */
+	struct gps_map *layout_ref_map;
+	double layout_scale;
+	int layout_width, layout_height;
+	struct gps_marea layout_marea;
+	GdkPixmap *backing;
+	int backing_valid:1;
+	/* What the content of the backing store was drawn for, if
+	 * backing_scale is set */
+	struct gps_map *backing_ref_map;
+	struct gps_marea backing_marea;
+	double backing_scale;
+	int view_x, view_y;	/* view origin in the layout */
+	int margin_x, margin_y;	/* view_x, view_y when centered */
+	/* Track-up view: clockwise turn in radians, the part of the
+	 * backing store it is rotated from, and the rotated view */
+	double rotation;
+	GdkPixbuf *north_pb, *rot_pb;
+	int rot_valid:1;
+	/* Last pointer position while dragging the map */
+	int dragging:1, drag_x, drag_y;
 	GtkWidget *darea;
 	struct ui_info_area info_area;
 
@@ -58,10 +148,42 @@ struct gropes_state {
 	struct gpsnav *nav;
 	struct map_state big_map;
 	int opt_follow_gps:1, opt_draw_map_rectangles:1;
+	int opt_track_up:1, opt_smooth_rotation:1;
 	int mode;
 
 	struct gropes_mapcache_entry *mc_head, *mc_tail;
 	unsigned int mc_max_size, mc_cur_size;
+
+	struct warp_tile *wt_head, *wt_tail;
+	unsigned int wt_max_size, wt_cur_size;
+
+	struct map_tile *pt_head, *pt_tail;
+	unsigned int pt_max_pixels, pt_cur_pixels;
+
+	GdkImage *comp_image;
+	int comp_pending:1;	/* comp_image upload may be in progress */
+
+	/* If set, scaled and warped maps are drawn by the render thread,
+	 * which then is the only user of their caches. Unscaled maps are
+	 * still copied from the tiles by the main thread. */
+	struct renderer *renderer;
+	/* Held while decoding map pixels and using what the pixel cache
+	 * of nav returned, as both threads do */
+	pthread_mutex_t pixels_lock;
+};
+
+/* Where maps are drawn: straight to d, or if image is set, composed
+ * into it for area of d and uploaded by target_finish(). If rgb is set,
+ * area is drawn into that client-side buffer alone. */
+struct draw_target {
+	struct gropes_state *gs;
+	GtkWidget *widget;
+	GdkDrawable *d;
+	GdkImage *image;
+	GdkRectangle area;
+	guchar *rgb;
+	int rgb_stride;
+	guchar bg[3];
 };
 
 char *fmt_coord(const struct gps_coord *coord, int fmt);
@@ -70,10 +192,64 @@ char *get_map_fname(struct gpsnav *nav, struct gps_map *map);
 void redraw_map_area(struct gropes_state *state, struct map_state *ms,
 		     GtkWidget *widget, const GdkRectangle *area);
 
+int generate_map_layout(struct gpsnav *nav, struct gps_map *ref_map,
+			const GdkRectangle *zero_area,
+			const struct gps_marea *zero_marea, double scale,
+			const GdkRectangle *area, struct map_on_screen **head);
+void free_mos_list(struct map_on_screen *e);
+
 void change_map_center(struct gropes_state *gs, struct map_state *map,
 		       const struct gps_mcoord *cent, double scale);
-void draw_maps(struct gropes_state *state, GtkWidget *widget,
-	       struct map_on_screen *mos_list, const GdkRectangle *area);
+void draw_map_view(struct gropes_state *gs, struct map_state *ms,
+		   GtkWidget *widget, const GdkRectangle *area);
+void set_map_rotation(struct gropes_state *gs, struct map_state *ms,
+		      double track);
+void purge_map_cache(struct gropes_state *gs);
+void render_maps(struct gropes_state *gs, const struct layout_view *lv,
+		 struct draw_target *t);
+void draw_unscaled_maps(struct gropes_state *gs, struct map_state *ms,
+			GtkWidget *widget, GdkDrawable *d,
+			const GdkRectangle *area);
+void draw_map_rectangles(struct gropes_state *gs, struct map_state *ms,
+			 GdkDrawable *d, const GdkRectangle *area);
+void grey_fill(GtkWidget *widget, GdkDrawable *d, const GdkRectangle *area);
+
+void draw_single_map_tiled(struct gropes_state *gs, GtkWidget *widget,
+			   GdkDrawable *d, struct map_on_screen *mos,
+			   const GdkRectangle *isect);
+void purge_tile_cache(struct gropes_state *gs);
+
+void target_init(struct gropes_state *gs, struct draw_target *t,
+		 GtkWidget *widget, GdkDrawable *d, const GdkRectangle *area);
+void target_init_rgb(struct gropes_state *gs, struct draw_target *t,
+		     const GdkRectangle *area, guchar *rgb, int stride,
+		     const guchar *bg);
+void target_finish(struct draw_target *t);
+void target_fill(struct draw_target *t, const GdkRectangle *area);
+void target_draw_pixbuf(struct draw_target *t, GdkPixbuf *pb,
+			int src_x, int src_y, const GdkRectangle *dest);
+void target_draw_rgb(struct draw_target *t, const guchar *data, int stride,
+		     const GdkRectangle *dest);
+void free_compose_image(struct gropes_state *gs);
+
+void draw_single_map_warped(struct gropes_state *gs,
+			    const struct layout_view *lv,
+			    struct draw_target *t, struct map_on_screen *mos,
+			    const GdkRectangle *isect);
+void purge_warp_cache(struct gropes_state *gs);
+
+int track_log_add(struct item_track *t, const struct gps_coord *pos,
+		  const struct gps_mcoord *mpos, uint32_t time);
+void track_log_close(struct item_track *t);
+void track_add_point(struct item_on_screen *item,
+		     const struct gps_mcoord *mpos, unsigned int seq);
+void track_clear_lod(struct item_on_screen *item);
+void draw_track(struct map_state *ms, struct item_on_screen *item);
+
+int render_start(struct gropes_state *gs, struct map_state *ms);
+void render_stop(struct gropes_state *gs);
+void render_queue(struct gropes_state *gs, struct map_state *ms,
+		  const GdkRectangle *area, int restart);
 
 void move_item(struct gropes_state *gs, struct map_state *ms,
 	       struct item_on_screen *item, const struct gps_coord *pos,
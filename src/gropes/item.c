@@ -1,6 +1,7 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include "gropes.h"
 #include "ui.h"
 
@@ -11,7 +12,7 @@ void calc_item_pos(struct gropes_state *gs, struct map_state *ms,
 	GdkRectangle *area;
 	int r;
 
-	gpsnav_get_metric_for_coord(ms->ref_map, pos, &item->mpos);
+	gpsnav_get_metric_for_coord_interp(ms->ref_map, pos, &item->mpos);
 	area = &item->area;
 	r = get_xy_on_screen(ms, &item->mpos, &area->x, &area->y);
 	if (r < 0) {
@@ -23,17 +24,25 @@ void calc_item_pos(struct gropes_state *gs, struct map_state *ms,
 	item->on_screen = 1;
 }
 
+/* A fix is recorded once it is TRACK_MIN_DISTANCE metres from the last
+ * one recorded, or if it has moved at all, once TRACK_MAX_INTERVAL
+ * seconds have passed */
 static void item_save_track(struct item_on_screen *item)
 {
-	struct item_track *point;
+	struct item_track *t = &item->track;
+	time_t now = time(NULL);
 
-	point = malloc(sizeof(struct item_track));
-	if (point == NULL)
-		return;
+	if (t->count > 0) {
+		double d = hypot(item->mpos.n - t->mpos.n,
+				 item->mpos.e - t->mpos.e);
 
-	memcpy(&point->mpos, &item->mpos, sizeof(struct gps_mcoord));
-	point->next = item->track;
-	item->track = point;
+		if (d < TRACK_MIN_DISTANCE &&
+		    (d == 0 || now - t->time < TRACK_MAX_INTERVAL))
+			return;
+	}
+	if (track_log_add(t, &item->pos, &item->mpos, now) < 0)
+		return;
+	track_add_point(item, &item->mpos, t->count - 1);
 }
 
 void item_draw_track(struct item_on_screen *item, int draw)
@@ -43,17 +52,8 @@ void item_draw_track(struct item_on_screen *item, int draw)
 
 void item_clear_track(struct item_on_screen *item)
 {
-	struct item_track *point, *next;
-
-	next = item->track;
-
-	while (next) {
-		point = next;
-		next = point->next;
-		free(point);
-	}
-
-	item->track = NULL;
+	track_log_close(&item->track);
+	track_clear_lod(item);
 }
 
 void move_item(struct gropes_state *gs, struct map_state *ms,
@@ -94,6 +94,8 @@ void move_item(struct gropes_state *gs, struct map_state *ms,
 		calc_item_pos(gs, ms, item);
 		item_save_track(item);
 		pthread_mutex_unlock(&ms->mutex);
+		if (gs->opt_track_up && speed->speed >= TRACK_UP_MIN_SPEED)
+			set_map_rotation(gs, ms, speed->track);
 		/* Change map center if item is not on screen */
 		if (gs->opt_follow_gps)
 			change_map_center(gs, ms, &item->mpos, ms->scale);
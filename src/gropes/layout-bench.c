@@ -0,0 +1,315 @@
+/*
+ * Map layout benchmark on synthetic, dense multi-scale tile grids,
+ * and a check that a badly fragmented layout still covers everything
+ * the maps in the view projection cover.
+ *
+ * Usage: gropes-layout-bench [tiles per side] [levels] [layouts]
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <gpsnav/gpsnav.h>
+#include <gpsnav/map.h>
+#include <gpsnav/coord.h>
+
+#include <lib_proj.h>
+
+#include "gropes.h"
+#include "bench.h"
+
+#define TILE_SIZE	256
+#define SCREEN_WIDTH	800
+#define SCREEN_HEIGHT	480
+/* Small maps scattered over one coarse map */
+#define FRAG_MAPS	600
+#define FRAG_SIZE	64
+
+static void synth_free_map(struct gps_map *map)
+{
+}
+
+static struct gps_map_provider synth_prov = {
+	.name = "synthetic",
+	.free_map = synth_free_map,
+};
+
+static int add_tile_grid(struct gpsnav *nav, PJ *pj,
+			 const struct gps_area *area, int tiles)
+{
+	double tile_la, tile_lo;
+	int x, y, r;
+
+	tile_la = (area->end.la - area->start.la) / tiles;
+	tile_lo = (area->end.lo - area->start.lo) / tiles;
+	for (y = 0; y < tiles; y++) {
+		for (x = 0; x < tiles; x++) {
+			struct gps_map *map;
+
+			map = gps_map_new();
+			if (map == NULL)
+				return -1;
+			/* Overlap the neighbours slightly, like real
+			 * map sheets do */
+			map->area.start.la = area->start.la + (y - 0.01) * tile_la;
+			map->area.start.lo = area->start.lo + (x - 0.01) * tile_lo;
+			map->area.end.la = area->start.la + (y + 1.01) * tile_la;
+			map->area.end.lo = area->start.lo + (x + 1.01) * tile_lo;
+			map->width = map->height = TILE_SIZE;
+			map->proj = pj;
+			map->prov = &synth_prov;
+			r = gpsnav_add_map(nav, map, NULL, 0, NULL);
+			if (r < 0) {
+				free(map);
+				return r;
+			}
+		}
+	}
+	return 0;
+}
+
+static int add_synth_map(struct gpsnav *nav, PJ *pj, double la, double lo,
+			 double size_la, double size_lo, int size)
+{
+	struct gps_map *map;
+	int r;
+
+	map = gps_map_new();
+	if (map == NULL)
+		return -1;
+	map->area.start.la = la;
+	map->area.start.lo = lo;
+	map->area.end.la = la + size_la;
+	map->area.end.lo = lo + size_lo;
+	map->width = map->height = size;
+	map->proj = pj;
+	map->prov = &synth_prov;
+	r = gpsnav_add_map(nav, map, NULL, 0, NULL);
+	if (r < 0)
+		free(map);
+	return r;
+}
+
+struct cover_arg {
+	const struct gps_marea *need;
+	int covered;
+};
+
+static int check_cover(struct gps_map *map, void *arg)
+{
+	struct cover_arg *carg = arg;
+
+	if (map->marea.start.n <= carg->need->start.n &&
+	    map->marea.start.e <= carg->need->start.e &&
+	    map->marea.end.n >= carg->need->end.n &&
+	    map->marea.end.e >= carg->need->end.e)
+		carg->covered = 1;
+	return carg->covered;
+}
+
+/* Lays out the view at the scale of the small maps, which splits it
+ * into hundreds of rectangles, and checks that they do not overlap
+ * and that every pixel whose surroundings a map in the view
+ * projection covers gets a map in that projection. Returns the number
+ * of pixels that fail. */
+static long check_fragmented_layout(void)
+{
+	struct gpsnav *nav;
+	struct gps_map *ref_map;
+	struct gps_coord center;
+	struct gps_mcoord c;
+	struct gps_marea marea;
+	struct map_on_screen *mos_list = NULL, *mos, **owner;
+	GdkRectangle screen;
+	char *projc[3];
+	PJ *pj;
+	double scale;
+	long bad = 0;
+	int i, x, y, rects;
+
+	if (gpsnav_init(&nav) < 0)
+		return -1;
+	projc[0] = "ellps=WGS84";
+	projc[1] = "proj=merc";
+	projc[2] = "no_defs";
+	pj = gpsnav_get_proj(nav, 3, projc);
+	if (pj == NULL)
+		return -1;
+
+	/* About 14 m/pixel for the small maps, and so much more for the
+	 * one under them that any small map beats it */
+	if (add_synth_map(nav, pj, 60.0, 24.0, 0.5, 1.0, 32) < 0)
+		return -1;
+	srand(2);
+	for (i = 0; i < FRAG_MAPS; i++) {
+		double la = 60.22 + (rand() % 1000) / 1000.0 * 0.06;
+		double lo = 24.42 + (rand() % 1000) / 1000.0 * 0.16;
+
+		if (add_synth_map(nav, pj, la, lo, 0.004, 0.008,
+				  FRAG_SIZE) < 0)
+			return -1;
+	}
+	ref_map = nav->map_list.lh_first;
+	scale = ref_map->scale_y;
+
+	center.la = 60.25;
+	center.lo = 24.5;
+	gpsnav_get_metric_for_coord(ref_map, &center, &c);
+	marea.start.n = c.n - SCREEN_HEIGHT / 2 * scale;
+	marea.start.e = c.e - SCREEN_WIDTH / 2 * scale;
+	marea.end.n = marea.start.n + SCREEN_HEIGHT * scale;
+	marea.end.e = marea.start.e + SCREEN_WIDTH * scale;
+	screen.x = screen.y = 0;
+	screen.width = SCREEN_WIDTH;
+	screen.height = SCREEN_HEIGHT;
+	if (generate_map_layout(nav, ref_map, &screen, &marea, scale,
+				&screen, &mos_list) < 0)
+		return -1;
+
+	owner = calloc(SCREEN_WIDTH * SCREEN_HEIGHT, sizeof(*owner));
+	if (owner == NULL)
+		return -1;
+	rects = 0;
+	for (mos = mos_list; mos != NULL; mos = mos->next) {
+		const GdkRectangle *a = &mos->clip_area;
+
+		rects++;
+		for (y = a->y; y < a->y + a->height; y++)
+			for (x = a->x; x < a->x + a->width; x++) {
+				if (owner[y * SCREEN_WIDTH + x] != NULL)
+					bad++;
+				owner[y * SCREEN_WIDTH + x] = mos;
+			}
+	}
+	for (y = 0; y < SCREEN_HEIGHT; y++) {
+		for (x = 0; x < SCREEN_WIDTH; x++) {
+			struct gps_marea need;
+			struct cover_arg carg;
+
+			mos = owner[y * SCREEN_WIDTH + x];
+			if (mos != NULL && mos->map != NULL && !mos->warp)
+				continue;
+			/* The pixel and one more around it, as the
+			 * placement is rounded to whole pixels */
+			need.end.n = marea.end.n - (y - 1) * scale;
+			need.start.n = marea.end.n - (y + 2) * scale;
+			need.start.e = marea.start.e + (x - 1) * scale;
+			need.end.e = marea.start.e + (x + 2) * scale;
+			carg.need = &need;
+			carg.covered = 0;
+			gpsnav_for_each_map_in_marea(nav, ref_map, &need,
+						     check_cover, &carg);
+			if (carg.covered || mos == NULL)
+				bad++;
+		}
+	}
+	printf("Fragmented layout of %d maps: %d rectangles, %ld bad pixels\n",
+	       FRAG_MAPS + 1, rects, bad);
+
+	free(owner);
+	free_mos_list(mos_list);
+	gpsnav_finish(nav);
+
+	return bad;
+}
+
+int main(int argc, char *argv[])
+{
+	struct gpsnav *nav;
+	struct gps_map *ref_map;
+	struct gps_area area;
+	struct gps_marea region;
+	GdkRectangle screen;
+	char *projc[3];
+	PJ *pj;
+	int tiles, levels, layouts;
+	int i, r, rects, max_rects;
+	long total_rects, bad;
+	double start, elapsed;
+
+	tiles = argc > 1 ? atoi(argv[1]) : 16;
+	levels = argc > 2 ? atoi(argv[2]) : 3;
+	layouts = argc > 3 ? atoi(argv[3]) : 1000;
+
+	if (gpsnav_init(&nav) < 0)
+		return 1;
+	projc[0] = "ellps=WGS84";
+	projc[1] = "proj=merc";
+	projc[2] = "no_defs";
+	pj = gpsnav_get_proj(nav, 3, projc);
+	if (pj == NULL) {
+		fprintf(stderr, "Unable to initialize projection\n");
+		return 1;
+	}
+
+	area.start.la = 60.0;
+	area.start.lo = 24.0;
+	area.end.la = 60.5;
+	area.end.lo = 25.0;
+	start = now();
+	for (i = 0; i < levels; i++) {
+		r = add_tile_grid(nav, pj, &area, tiles << i);
+		if (r < 0) {
+			fprintf(stderr, "Adding maps failed: %d\n", r);
+			return 1;
+		}
+	}
+	/* The last map added is from the finest level */
+	ref_map = nav->map_list.lh_first;
+	printf("%d levels, %d maps added in %.3f s\n", levels,
+	       tiles * tiles * ((1 << (2 * levels)) - 1) / 3, now() - start);
+
+	gpsnav_get_metric_for_coord(ref_map, &area.start, &region.start);
+	gpsnav_get_metric_for_coord(ref_map, &area.end, &region.end);
+
+	screen.x = screen.y = 0;
+	screen.width = SCREEN_WIDTH;
+	screen.height = SCREEN_HEIGHT;
+	srand(1);
+	total_rects = 0;
+	max_rects = 0;
+	elapsed = 0;
+	for (i = 0; i < layouts; i++) {
+		struct map_on_screen *mos_list = NULL, *mos;
+		struct gps_marea marea;
+		double scale;
+
+		/* Native scales of the levels, zoomed in or out a bit */
+		scale = ref_map->scale_y * (1 << (rand() % levels));
+		scale *= 0.5 + (rand() % 1000) / 1000.0;
+		marea.start.n = region.start.n + (rand() % 1000) / 1000.0 *
+			(region.end.n - region.start.n);
+		marea.start.e = region.start.e + (rand() % 1000) / 1000.0 *
+			(region.end.e - region.start.e);
+		marea.end.n = marea.start.n + SCREEN_HEIGHT * scale;
+		marea.end.e = marea.start.e + SCREEN_WIDTH * scale;
+
+		start = now();
+		r = generate_map_layout(nav, ref_map, &screen, &marea, scale,
+					&screen, &mos_list);
+		elapsed += now() - start;
+		if (r < 0) {
+			fprintf(stderr, "generate_map_layout failed: %d\n", r);
+			return 1;
+		}
+		rects = 0;
+		for (mos = mos_list; mos != NULL; mos = mos->next)
+			rects++;
+		total_rects += rects;
+		if (rects > max_rects)
+			max_rects = rects;
+		free_mos_list(mos_list);
+	}
+	printf("%d layouts of %dx%d: %.1f us/layout, %.1f rectangles avg, %d max\n",
+	       layouts, SCREEN_WIDTH, SCREEN_HEIGHT, elapsed * 1e6 / layouts,
+	       (double) total_rects / layouts, max_rects);
+
+	gpsnav_finish(nav);
+
+	bad = check_fragmented_layout();
+	if (bad < 0) {
+		fprintf(stderr, "Fragmented layout failed\n");
+		return 1;
+	}
+	return bench_limit("bad pixels in the fragmented layout", bad, 0);
+}
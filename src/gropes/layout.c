@@ -0,0 +1,520 @@
+#include <stdlib.h>
+#include <string.h>
+#include "gropes.h"
+
+struct best_map_arg {
+	const struct gps_marea *area;
+	double scale;
+	struct gps_map *best_map;
+	double best_points;
+};
+
+static int score_map(struct gps_map *map, void *arg)
+{
+	struct best_map_arg *barg = arg;
+	const struct gps_marea *area = barg->area;
+	double scale = barg->scale;
+	struct gps_marea isect;
+	double points, scale_factor;
+
+	gpsnav_calc_metric_isect(&map->marea, area, &isect);
+	/* Check if map has at least 1 pixel of screen area in
+	 * both directions */
+	if (isect.end.n < isect.start.n + 1.0 * scale ||
+	    isect.end.e < isect.start.e + 1.0 * scale)
+		return 0;
+	points = (isect.end.n - isect.start.n) * (isect.end.e - isect.start.e);
+
+	if (map->scale_y > scale)
+		scale_factor = scale / map->scale_y;
+	else {
+		scale_factor = map->scale_y / scale;
+		/* Do not allow zooming out too much */
+		if (scale_factor < 0.0025)
+		    scale_factor = 0;
+	}
+	/* A good scale is vewy, vewy important for us */
+	scale_factor /= 2;
+
+	points *= scale_factor;
+	if (points > barg->best_points) {
+		barg->best_map = map;
+		barg->best_points = points;
+	}
+	return 0;
+}
+
+/* Upper bound of score_map() points for any map in the given scale
+ * band, from the scale factor of the band edge closest to scale */
+static double band_max_points(int band, const struct gps_marea *area,
+			      double scale)
+{
+	double lo, hi, scale_factor;
+
+	lo = ldexp(1.0, band);
+	hi = ldexp(1.0, band + 1);
+	if (lo > scale)
+		scale_factor = scale / lo;
+	else if (hi < scale)
+		scale_factor = hi / scale;
+	else
+		scale_factor = 1.0;
+
+	return (area->end.n - area->start.n) * (area->end.e - area->start.e) *
+		scale_factor / 2;
+}
+
+/* Bands are visited outwards from the view scale, in order of
+ * decreasing upper bound, until no remaining band can beat the best
+ * map found so far. */
+static struct gps_map *find_best_map(struct gpsnav *nav, struct gps_map *ref_map,
+				     const struct gps_marea *area, double scale)
+{
+	struct best_map_arg barg;
+	int bands[64];
+	int band_count, up, down;
+
+	barg.area = area;
+	barg.scale = scale;
+	barg.best_map = NULL;
+	barg.best_points = 0;
+
+	band_count = gpsnav_get_marea_scale_bands(nav, ref_map, bands,
+						  sizeof(bands) / sizeof(bands[0]));
+	if (band_count > sizeof(bands) / sizeof(bands[0])) {
+		gpsnav_for_each_map_in_marea(nav, ref_map, area, score_map, &barg);
+		return barg.best_map;
+	}
+
+	for (up = 0; up < band_count; up++)
+		if (bands[up] >= gpsnav_get_scale_band(scale))
+			break;
+	down = up - 1;
+	while (down >= 0 || up < band_count) {
+		double down_max = -1, up_max = -1;
+		int band;
+
+		if (down >= 0)
+			down_max = band_max_points(bands[down], area, scale);
+		if (up < band_count)
+			up_max = band_max_points(bands[up], area, scale);
+		if (up_max >= down_max) {
+			if (up_max <= barg.best_points)
+				break;
+			band = bands[up++];
+		} else {
+			if (down_max <= barg.best_points)
+				break;
+			band = bands[down--];
+		}
+		gpsnav_for_each_map_in_marea_band(nav, ref_map, area, band,
+						  score_map, &barg);
+	}
+	return barg.best_map;
+}
+
+/* Maps in other projections are warped to the view, see warp.c.
+ * Zooming out further than this would read too many map pixels. */
+#define WARP_MAX_ZOOM_OUT	4.0
+
+struct warp_map_arg {
+	struct gps_map *ref_map;
+	const struct gps_area *area;
+	double ref_span;
+	double scale;
+	struct gps_map *best_map;
+	double best_points;
+};
+
+static int score_warp_map(struct gps_map *map, void *arg)
+{
+	struct warp_map_arg *warg = arg;
+	const struct gps_area *area = warg->area;
+	struct gps_area isect;
+	double la[2], lo[2], n[2], e[2];
+	double map_scale, points, scale_factor;
+
+	/* Maps in the view projection were already tried */
+	if (map->part == warg->ref_map->part)
+		return 0;
+	gpsnav_calc_isect(&map->area, area, &isect);
+	if (isect.end.la <= isect.start.la || isect.end.lo <= isect.start.lo)
+		return 0;
+
+	/* Scale of the map in view meters, from the northing span of the
+	 * area in both projections */
+	la[0] = area->start.la;
+	la[1] = area->end.la;
+	lo[0] = lo[1] = (area->start.lo + area->end.lo) / 2;
+	gpsnav_get_metric_for_coords(map, 2, la, lo, sizeof(double), n, e,
+				     sizeof(double));
+	map_scale = map->scale_y * warg->ref_span / fabs(n[1] - n[0]);
+	if (!(map_scale >= warg->scale / WARP_MAX_ZOOM_OUT) ||
+	    !isfinite(map_scale))
+		return 0;
+
+	points = (isect.end.la - isect.start.la) * (isect.end.lo - isect.start.lo);
+	if (map_scale > warg->scale)
+		scale_factor = warg->scale / map_scale;
+	else
+		scale_factor = map_scale / warg->scale;
+	points *= scale_factor;
+	if (points > warg->best_points) {
+		warg->best_map = map;
+		warg->best_points = points;
+	}
+	return 0;
+}
+
+/* Finds the best map in another projection for a rectangle that no
+ * map in the view projection covers. Even a view without any maps in
+ * its own projection is laid out, as it may be filled entirely this
+ * way. */
+static struct gps_map *find_warp_map(struct gpsnav *nav, struct gps_map *ref_map,
+				     const struct gps_marea *marea, double scale)
+{
+	struct warp_map_arg warg;
+	struct gps_area area;
+	double n[8], e[8], la[8], lo[8];
+	int i;
+
+	/* Corners and edge midpoints */
+	for (i = 0; i < 8; i++) {
+		static const int fn[8] = { 0, 0, 0, 1, 2, 2, 2, 1 };
+		static const int fe[8] = { 0, 1, 2, 2, 2, 1, 0, 0 };
+
+		n[i] = marea->start.n + (marea->end.n - marea->start.n) * fn[i] / 2;
+		e[i] = marea->start.e + (marea->end.e - marea->start.e) * fe[i] / 2;
+	}
+	gpsnav_get_coords_for_metric(ref_map, 8, n, e, sizeof(double), la, lo,
+				     sizeof(double));
+	area.start.la = area.end.la = la[0];
+	area.start.lo = area.end.lo = lo[0];
+	for (i = 1; i < 8; i++) {
+		if (la[i] < area.start.la)
+			area.start.la = la[i];
+		if (la[i] > area.end.la)
+			area.end.la = la[i];
+		if (lo[i] < area.start.lo)
+			area.start.lo = lo[i];
+		if (lo[i] > area.end.lo)
+			area.end.lo = lo[i];
+	}
+	if (!isfinite(area.start.la) || !isfinite(area.end.la) ||
+	    !isfinite(area.start.lo) || !isfinite(area.end.lo))
+		return NULL;
+
+	la[0] = area.start.la;
+	la[1] = area.end.la;
+	lo[0] = lo[1] = (area.start.lo + area.end.lo) / 2;
+	gpsnav_get_metric_for_coords(ref_map, 2, la, lo, sizeof(double), n, e,
+				     sizeof(double));
+
+	warg.ref_map = ref_map;
+	warg.area = &area;
+	warg.ref_span = fabs(n[1] - n[0]);
+	warg.scale = scale;
+	warg.best_map = NULL;
+	warg.best_points = 0;
+	gpsnav_for_each_map_in_area(nav, &area, score_warp_map, &warg);
+
+	return warg.best_map;
+}
+
+static void calc_xy_for_metric(struct gps_map *map, const GdkRectangle *screen_area,
+			       double scale, const struct gps_marea *smarea,
+			       struct gps_marea *isect, GdkRectangle *map_area,
+			       GdkRectangle *map_draw_area)
+{
+	double ms_x, ms_y, me_x, me_y; /* map start and end */
+	double ss_x, ss_y, se_x, se_y; /* screen start and end */
+
+	ms_y = map->height - (isect->end.n - map->marea.start.n) / map->scale_y;
+	me_y = map->height - (isect->start.n - map->marea.start.n) / map->scale_y;
+	ms_x = (isect->start.e - map->marea.start.e) / map->scale_x;
+	me_x = (isect->end.e - map->marea.start.e) / map->scale_x;
+        /* Convert to width and height */
+	me_x -= ms_x;
+	me_y -= ms_y;
+
+	ss_y = screen_area->height - (isect->end.n - smarea->start.n) / scale;
+	se_y = screen_area->height - (isect->start.n - smarea->start.n) / scale;
+	ss_x = (isect->start.e - smarea->start.e) / scale;
+	se_x = (isect->end.e - smarea->start.e) / scale;
+	/* Convert to width and height */
+	se_x -= ss_x;
+	se_y -= ss_y;
+	/* Make relative to the supplied screen area */
+	ss_y += screen_area->y;
+	ss_x += screen_area->x;
+
+//	printf("map    %f, %f --> %f, %f\n", ms_x, ms_y, me_x, me_y);
+//	printf("screen %f, %f --> %f, %f\n", ss_x, ss_y, se_x, se_y);
+
+	ss_x = rint(ss_x);
+	ss_y = rint(ss_y);
+	ms_x = rint(ms_x);
+	ms_y = rint(ms_y);
+	/* Let's check if we can do without scaling by rounding
+	 * appropriately */
+	if (fabs(me_x - se_x) < 1.0) {
+		double avg = (me_x + se_x) / 2;
+
+		if (ss_x + ceil(avg) <= screen_area->x +screen_area->width &&
+		    ms_x + ceil(avg) <= map->width)
+			avg = ceil(avg);
+		else
+			avg = floor(avg);
+		me_x = avg;
+		se_x = avg;
+	} else {
+		me_x = rint(me_x);
+		se_x = rint(se_x);
+	}
+	if (fabs(me_y - se_y) < 1.0) {
+		double avg = (me_y + se_y) / 2;
+
+		if (ss_y + ceil(avg) <= screen_area->y + screen_area->height &&
+		    ms_y + ceil(avg) <= map->height)
+			avg = ceil(avg);
+		else
+			avg = floor(avg);
+		me_y = avg;
+		se_y = avg;
+	} else {
+		me_y = rint(me_y);
+		se_y = rint(se_y);
+	}
+
+	/* A strip thinner than a map pixel still gets one, stretched */
+	if (me_x < 1) {
+		me_x = 1;
+		if (ms_x > map->width - 1)
+			ms_x = map->width - 1;
+	}
+	if (me_y < 1) {
+		me_y = 1;
+		if (ms_y > map->height - 1)
+			ms_y = map->height - 1;
+	}
+
+//	printf("map    %f, %f --> %f, %f\n", ms_x, ms_y, me_x, me_y);
+//	printf("screen %f, %f --> %f, %f\n", ss_x, ss_y, se_x, se_y);
+
+	map_area->x = ms_x;
+	map_area->y = ms_y;
+	map_area->width = me_x;
+	map_area->height = me_y;
+
+	map_draw_area->x = ss_x;
+	map_draw_area->y = ss_y;
+	map_draw_area->width = se_x;
+	map_draw_area->height = se_y;
+}
+
+static int add_mos_entry(struct map_on_screen **head, struct gps_map *map,
+			 const GdkRectangle *map_area, const GdkRectangle *draw_area)
+{
+	struct map_on_screen *e;
+
+	e = malloc(sizeof(*e));
+	if (e == NULL)
+		return -1;
+	e->map = map;
+	e->warp = 0;
+	if (map_area != NULL)
+		e->map_area = *map_area;
+	e->draw_area = *draw_area;
+	e->clip_area = *draw_area;
+	*head = e;
+	e->next = NULL;
+
+	return 0;
+}
+
+void free_mos_list(struct map_on_screen *e)
+{
+	struct map_on_screen *next;
+
+	while (e != NULL) {
+		next = e->next;
+		free(e);
+		e = next;
+	}
+}
+
+#define FILL_UP		(1 << 0)
+#define FILL_DOWN	(1 << 1)
+#define FILL_LEFT	(1 << 2)
+#define FILL_RIGHT	(1 << 3)
+
+/*  +-----------+
+ *  |           |
+ *  |  +-----+  |
+ *  |  |  1  |  |
+ *  |  +-----+  |
+ *  |     2     |
+ *  +-----------+
+ */
+static int compare_areas(const GdkRectangle *a1,
+			 const GdkRectangle *a2)
+{
+	int res = 0;
+
+	if (a1->x > a2->x)
+		res |= FILL_LEFT;
+	if (a1->y > a2->y)
+		res |= FILL_UP;
+	if (a1->x + a1->width < a2->x + a2->width)
+		res |= FILL_RIGHT;
+	if (a1->y + a1->height < a2->y + a2->height)
+		res |= FILL_DOWN;
+	return res;
+}
+
+/* Rectangles still to be covered, grown as needed */
+struct rect_stack {
+	GdkRectangle *rects;
+	int count, size;
+};
+
+static int push_rect(struct rect_stack *s, const GdkRectangle *rect)
+{
+	if (s->count == s->size) {
+		GdkRectangle *rects;
+		int size = s->size ? 2 * s->size : 16;
+
+		rects = realloc(s->rects, size * sizeof(*rects));
+		if (rects == NULL)
+			return -1;
+		s->rects = rects;
+		s->size = size;
+	}
+	s->rects[s->count++] = *rect;
+	return 0;
+}
+
+static int valid_placement(struct gps_map *map, const GdkRectangle *area,
+			   const GdkRectangle *map_area,
+			   const GdkRectangle *draw_area)
+{
+	if (map_area->width <= 0 || map_area->height <= 0 ||
+	    map_area->x < 0 || map_area->y < 0 ||
+	    map_area->x + map_area->width > map->width ||
+	    map_area->y + map_area->height > map->height)
+		return 0;
+	if (draw_area->width <= 0 || draw_area->height <= 0 ||
+	    draw_area->x < area->x || draw_area->y < area->y ||
+	    draw_area->x + draw_area->width > area->x + area->width ||
+	    draw_area->y + draw_area->height > area->y + area->height)
+		return 0;
+	return 1;
+}
+
+/* Covers area (relative to zero_area, whose metric area is zero_marea)
+ * with maps. Every rectangle gets the best map for it, and the strips
+ * the map does not cover are queued for the next rounds. The entries
+ * are appended to *head.
+ *
+ * Each rectangle taken off the stack becomes exactly one entry of at
+ * least one pixel, and the entries do not overlap, so the work is
+ * bounded by the size of area even for the most fragmented maps. */
+int generate_map_layout(struct gpsnav *nav, struct gps_map *ref_map,
+			const GdkRectangle *zero_area,
+			const struct gps_marea *zero_marea, double scale,
+			const GdkRectangle *area, struct map_on_screen **head)
+{
+	struct rect_stack pending;
+	GdkRectangle rect;
+	int r = 0;
+
+	memset(&pending, 0, sizeof(pending));
+	/* Stay within zero_area */
+	rect.x = area->x > 0 ? area->x : 0;
+	rect.y = area->y > 0 ? area->y : 0;
+	rect.width = area->x + area->width;
+	if (rect.width > zero_area->width)
+		rect.width = zero_area->width;
+	rect.width -= rect.x;
+	rect.height = area->y + area->height;
+	if (rect.height > zero_area->height)
+		rect.height = zero_area->height;
+	rect.height -= rect.y;
+	if (rect.width > 0 && rect.height > 0)
+		r = push_rect(&pending, &rect);
+
+	while (r == 0 && pending.count > 0) {
+		GdkRectangle map_area, map_draw_area, strips[4];
+		struct gps_marea isect, marea;
+		struct gps_map *map;
+		int i, comp_res, strip_count;
+
+		rect = pending.rects[--pending.count];
+
+		marea.end.n = zero_marea->end.n - rect.y * scale;
+		marea.start.e = zero_marea->start.e + rect.x * scale;
+		marea.start.n = marea.end.n - rect.height * scale;
+		marea.end.e = marea.start.e + rect.width * scale;
+
+		map = find_best_map(nav, ref_map, &marea, scale);
+		if (map != NULL) {
+			gpsnav_calc_metric_isect(&marea, &map->marea, &isect);
+			calc_xy_for_metric(map, &rect, scale, &marea, &isect,
+					   &map_area, &map_draw_area);
+			if (!valid_placement(map, &rect, &map_area,
+					     &map_draw_area))
+				map = NULL;
+		}
+		if (map == NULL) {
+			map = find_warp_map(nav, ref_map, &marea, scale);
+			r = add_mos_entry(head, map, NULL, &rect);
+			if (r)
+				break;
+			(*head)->warp = map != NULL;
+			head = &(*head)->next;
+			continue;
+		}
+
+		comp_res = compare_areas(&map_draw_area, &rect);
+		if (comp_res == 0) {
+			/* Map fills the whole rectangle */
+			map_draw_area = rect;
+		}
+		r = add_mos_entry(head, map, &map_area, &map_draw_area);
+		if (r)
+			break;
+		head = &(*head)->next;
+
+		strip_count = 0;
+		if (comp_res & FILL_UP) {
+			strips[strip_count] = rect;
+			strips[strip_count].height = map_draw_area.y - rect.y;
+			strip_count++;
+		}
+		if (comp_res & FILL_DOWN) {
+			strips[strip_count] = rect;
+			strips[strip_count].y = map_draw_area.y + map_draw_area.height;
+			strips[strip_count].height = rect.y + rect.height -
+				strips[strip_count].y;
+			strip_count++;
+		}
+		if (comp_res & FILL_LEFT) {
+			strips[strip_count] = map_draw_area;
+			strips[strip_count].x = rect.x;
+			strips[strip_count].width = map_draw_area.x - rect.x;
+			strip_count++;
+		}
+		if (comp_res & FILL_RIGHT) {
+			strips[strip_count] = map_draw_area;
+			strips[strip_count].x = map_draw_area.x + map_draw_area.width;
+			strips[strip_count].width = rect.x + rect.width -
+				strips[strip_count].x;
+			strip_count++;
+		}
+		for (i = 0; i < strip_count && r == 0; i++)
+			r = push_rect(&pending, &strips[i]);
+	}
+	free(pending.rects);
+
+	return r;
+}
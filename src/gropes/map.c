@@ -1,209 +1,28 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
-#include <assert.h>
 #include "gropes.h"
+#include "rotate.h"
 
-static struct gps_map *find_best_map(struct gps_map *ref_map, struct gps_map **maps,
-				     const struct gps_marea *area, double scale)
-{
-	struct gps_map *best_map = NULL;
-	double best_points = 0;
-	int i;
-
-	for (i = 0; maps[i] != NULL; i++) {
-		struct gps_marea isect;
-		double points, scale_factor;
-		struct gps_map *map;
-
-		map = maps[i];
-		gpsnav_calc_metric_isect(&map->marea, area, &isect);
-		/* Check if map has at least 1 pixel of screen area in
-		 * both directions */
-		if (isect.end.n < isect.start.n + 1.0 * scale ||
-		    isect.end.e < isect.start.e + 1.0 * scale)
-			continue;
-		/* Check if map has at least 1 pixel of map area in
-		 * both directions */
-		if (isect.end.n < isect.start.n + 1.0 * map->scale_y ||
-		    isect.end.e < isect.start.e + 1.0 * map->scale_x)
-			continue;
-
-		points = (isect.end.n - isect.start.n) * (isect.end.e - isect.start.e);
-
-		if (map->scale_y > scale)
-			scale_factor = scale / map->scale_y;
-		else {
-			scale_factor = map->scale_y / scale;
-			/* Do not allow zooming out too much */
-			if (scale_factor < 0.0025)
-			    scale_factor = 0;
-		}
-		/* A good scale is vewy, vewy important for us */
-		scale_factor /= 2;
-
-		points *= scale_factor;
-		if (points > best_points) {
-			best_map = map;
-			best_points = points;
-		}
-	}
-	return best_map;
-}
+/* Pixels laid out and drawn beyond each edge of the view */
+#define BACKING_MARGIN	128
+/* Smaller course changes do not turn a track-up view */
+#define MIN_ROTATION_STEP	(2 * M_PI / 180)
 
-static void calc_xy_for_metric(struct gps_map *map, const GdkRectangle *screen_area,
-			       double scale, const struct gps_marea *smarea,
-			       struct gps_marea *isect, GdkRectangle *map_area,
-			       GdkRectangle *map_draw_area)
-{
-	double ms_x, ms_y, me_x, me_y; /* map start and end */
-	double ss_x, ss_y, se_x, se_y; /* screen start and end */
-
-	ms_y = map->height - (isect->end.n - map->marea.start.n) / map->scale_y;
-	me_y = map->height - (isect->start.n - map->marea.start.n) / map->scale_y;
-	ms_x = (isect->start.e - map->marea.start.e) / map->scale_x;
-	me_x = (isect->end.e - map->marea.start.e) / map->scale_x;
-        /* Convert to width and height */
-	me_x -= ms_x;
-	me_y -= ms_y;
-
-	ss_y = screen_area->height - (isect->end.n - smarea->start.n) / scale;
-	se_y = screen_area->height - (isect->start.n - smarea->start.n) / scale;
-	ss_x = (isect->start.e - smarea->start.e) / scale;
-	se_x = (isect->end.e - smarea->start.e) / scale;
-	/* Convert to width and height */
-	se_x -= ss_x;
-	se_y -= ss_y;
-	/* Make relative to the supplied screen area */
-	ss_y += screen_area->y;
-	ss_x += screen_area->x;
-
-//	printf("map    %f, %f --> %f, %f\n", ms_x, ms_y, me_x, me_y);
-//	printf("screen %f, %f --> %f, %f\n", ss_x, ss_y, se_x, se_y);
-
-	ss_x = rint(ss_x);
-	ss_y = rint(ss_y);
-	ms_x = rint(ms_x);
-	ms_y = rint(ms_y);
-	/* Let's check if we can do without scaling by rounding
-	 * appropriately */
-	if (fabs(me_x - se_x) < 1.0) {
-		double avg = (me_x + se_x) / 2;
-
-		if (ss_x + ceil(avg) <= screen_area->x +screen_area->width &&
-		    ms_x + ceil(avg) <= map->width)
-			avg = ceil(avg);
-		else
-			avg = floor(avg);
-		me_x = avg;
-		se_x = avg;
-	} else {
-		me_x = rint(me_x);
-		se_x = rint(se_x);
-	}
-	if (fabs(me_y - se_y) < 1.0) {
-		double avg = (me_y + se_y) / 2;
-
-		if (ss_y + ceil(avg) <= screen_area->y + screen_area->height &&
-		    ms_y + ceil(avg) <= map->height)
-			avg = ceil(avg);
-		else
-			avg = floor(avg);
-		me_y = avg;
-		se_y = avg;
-	} else {
-		me_y = rint(me_y);
-		se_y = rint(se_y);
-	}
-
-//	printf("map    %f, %f --> %f, %f\n", ms_x, ms_y, me_x, me_y);
-//	printf("screen %f, %f --> %f, %f\n", ss_x, ss_y, se_x, se_y);
-
-	map_area->x = ms_x;
-	map_area->y = ms_y;
-	map_area->width = me_x;
-	map_area->height = me_y;
-
-	map_draw_area->x = ss_x;
-	map_draw_area->y = ss_y;
-	map_draw_area->width = se_x;
-	map_draw_area->height = se_y;
-}
-
-
-
-static void grey_fill(GtkWidget *widget, const GdkRectangle *area)
+void grey_fill(GtkWidget *widget, GdkDrawable *d, const GdkRectangle *area)
 {
 	GdkGC *gc;
 
-	gc = gdk_gc_new(GDK_DRAWABLE(widget->window));
+	gc = gdk_gc_new(d);
 	gdk_gc_copy(gc, widget->style->fg_gc[GTK_STATE_NORMAL]);
 	gdk_gc_set_foreground(gc, &widget->style->bg[GTK_STATE_NORMAL]);
-	gdk_draw_rectangle(GDK_DRAWABLE(widget->window), gc, TRUE, area->x, area->y,
+	gdk_draw_rectangle(d, gc, TRUE, area->x, area->y,
 			   area->width, area->height);
 	g_object_unref(gc);
 
 }
 
 
-static int add_mos_entry(struct map_on_screen **head, struct gps_map *map,
-			 const GdkRectangle *map_area, const GdkRectangle *draw_area)
-{
-	struct map_on_screen *e;
-
-	e = malloc(sizeof(*e));
-	if (e == NULL)
-		return -1;
-	e->map = map;
-	if (map_area != NULL)
-		e->map_area = *map_area;
-	e->draw_area = *draw_area;
-	*head = e;
-	e->next = NULL;
-
-	return 0;
-}
-
-static void free_mos_list(struct map_on_screen *e)
-{
-	struct map_on_screen *next;
-
-	while (e != NULL) {
-		next = e->next;
-		free(e);
-		e = next;
-	}
-}
-
-#define FILL_UP		(1 << 0)
-#define FILL_DOWN	(1 << 1)
-#define FILL_LEFT	(1 << 2)
-#define FILL_RIGHT	(1 << 3)
-
-/*  +-----------+
- *  |           |
- *  |  +-----+  |
- *  |  |  1  |  |
- *  |  +-----+  |
- *  |     2     |
- *  +-----------+
- */
-static int compare_areas(const GdkRectangle *a1,
-			 const GdkRectangle *a2)
-{
-	int res = 0;
-
-	if (a1->x > a2->x)
-		res |= FILL_LEFT;
-	if (a1->y > a2->y)
-		res |= FILL_UP;
-	if (a1->x + a1->width < a2->x + a2->width)
-		res |= FILL_RIGHT;
-	if (a1->y + a1->height < a2->y + a2->height)
-		res |= FILL_DOWN;
-	return res;
-}
-
 static struct map_on_screen **get_next_head(struct map_on_screen **head)
 {
 	struct map_on_screen *e;
@@ -217,201 +36,90 @@ static struct map_on_screen **get_next_head(struct map_on_screen **head)
 }
 
 
-static void print_area(const char *name, const struct gps_marea *ma,
-		       const GdkRectangle *a)
+static void destroy_pix_buf(guchar *pixels, gpointer data)
 {
-	char ss[64], se[64];
+	struct gps_pixel_buf *pb = data;
 
-	fmt_mcoord(&ma->start, ss);
-	fmt_mcoord(&ma->end, se);
-//	printf("%s %s --> %s  %4d, %4d --> %4d, %4d\n",
-//	       name, ss, se, a->x, a->y, a->x + a->width, a->y + a->height);
+	if (pb->can_free)
+		free(pb->data);
 }
 
-static int generate_map_layout(struct gpsnav *nav, struct gps_map *ref_map,
-			       struct gps_map **maps,
-			       const GdkRectangle *zero_area,
-			       const struct gps_marea *zero_marea, double scale,
-			       const GdkRectangle *screen_area,
-			       struct map_on_screen **head, int depth)
-{
+/* Scaled map pixbufs, most recently used first */
+struct gropes_mapcache_entry {
 	struct gps_map *map;
-	struct gps_marea isect, marea;
-	GdkRectangle map_area, map_draw_area;
-	int r, comp_res;
-
-	marea.end.n = zero_marea->end.n - screen_area->y * scale;
-	marea.start.e = zero_marea->start.e + screen_area->x * scale;
-	marea.start.n = marea.end.n - screen_area->height * scale;
-	marea.end.e = marea.start.e + screen_area->width * scale;
-	print_area("zero ", zero_marea, zero_area);
-	print_area("gen  ", &marea, screen_area);
-	assert(screen_area->width > 0);
-	assert(screen_area->height > 0);
-	assert(screen_area->x >= 0);
-	assert(screen_area->y >= 0);
-	assert(screen_area->x + screen_area->width <= zero_area->width);
-	assert(screen_area->y + screen_area->height <= zero_area->height);
-	assert(depth < 16);
-
-	map = find_best_map(ref_map, maps, &marea, scale);
-	if (map == NULL) {
-		printf("no map found\n");
-		/* Put an empty entry */
-		return add_mos_entry(head, NULL, NULL, screen_area);
-	}
-
-	gpsnav_calc_metric_isect(&marea, &map->marea, &isect);
-
-	calc_xy_for_metric(map, screen_area, scale, &marea, &isect, &map_area,
-			   &map_draw_area);
+	GdkRectangle map_area;
+	int width, height;
+	GdkPixbuf *pb;
+	unsigned int size;
 
-//	print_area("map  ", &map->marea, &map_area);
-//	print_area("isect", &isect, &map_draw_area);
-//	{
-//		char *fname = get_map_fname(nav, map);
-
-//		printf("%s\n", fname);
-//		free(fname);
-//	}
-
-	assert(map_area.x >= 0 && map_area.y >= 0);
-	assert(map_area.x + map_area.width <= map->width);
-	assert(map_area.y + map_area.height <= map->height);
-	assert(map_area.width > 0 && map_area.height > 0);
-
-	assert(map_draw_area.x >= screen_area->x && map_draw_area.y >= screen_area->y);
-	assert(map_draw_area.width > 0 && map_draw_area.height > 0);
-	assert(map_draw_area.x + map_draw_area.width <= screen_area->x + screen_area->width);
-	assert(map_draw_area.y + map_draw_area.height <= screen_area->y + screen_area->height);
-
-	comp_res = compare_areas(&map_draw_area, screen_area);
-	if (comp_res == 0) {
-		/* Map fills the whole area. Yay! */
-		return add_mos_entry(head, map, &map_area, screen_area);
-	}
-#if 0
-	printf("comp_res: %c%c%c%c\n",
-	       comp_res & FILL_UP ? 'U' : ' ',
-	       comp_res & FILL_DOWN ? 'D' : ' ',
-	       comp_res & FILL_LEFT ? 'L' : ' ',
-	       comp_res & FILL_RIGHT ? 'R' : ' ');
-#endif
+	struct gropes_mapcache_entry *next, *prev;
+};
 
-	r = add_mos_entry(head, map, &map_area, &map_draw_area);
-	if (r)
-		return r;
-
-	head = &(*head)->next;
-	depth++;
-	if (comp_res & FILL_UP) {
-		GdkRectangle new_area;
-
-		new_area = *screen_area;
-		new_area.height = map_draw_area.y - screen_area->y;
-//		printf("Drawing upper\n");
-		r = generate_map_layout(nav, ref_map, maps, zero_area,
-					zero_marea, scale, &new_area,
-					head, depth);
-		if (r)
-			return r;
-		head = get_next_head(head);
-	}
-	if (comp_res & FILL_DOWN) {
-		GdkRectangle new_area;
-
-		new_area.x = screen_area->x;
-		new_area.width = screen_area->width;
-		new_area.y = map_draw_area.y + map_draw_area.height;
-		new_area.height = screen_area->y + screen_area->height - new_area.y;
-//		printf("Drawing lower\n");
-		r = generate_map_layout(nav, ref_map, maps, zero_area,
-					zero_marea, scale, &new_area,
-					head, depth);
-		if (r)
-			return r;
-		head = get_next_head(head);
-	}
-	if (comp_res & FILL_LEFT) {
-		GdkRectangle new_area;
-
-		new_area.x = screen_area->x;
-		new_area.width = map_draw_area.x - screen_area->x;
-		new_area.y = map_draw_area.y;
-		new_area.height = map_draw_area.height;
-//		printf("Drawing left\n");
-		r = generate_map_layout(nav, ref_map, maps, zero_area,
-					zero_marea, scale, &new_area, head,
-					depth);
-		if (r)
-			return r;
-		head = get_next_head(head);
-	}
-	if (comp_res & FILL_RIGHT) {
-		GdkRectangle new_area;
-
-		new_area.x = map_draw_area.x + map_draw_area.width;
-		new_area.width = screen_area->x + screen_area->width - new_area.x;
-		new_area.y = map_draw_area.y;
-		new_area.height = map_draw_area.height;
-//		printf("Drawing right\n");
-		r = generate_map_layout(nav, ref_map, maps, zero_area,
-					zero_marea, scale, &new_area, head,
-					depth);
-		if (r)
-			return r;
-		head = get_next_head(head);
-	}
+static void add_mapcache_entry(struct gropes_state *gs,
+			       struct gropes_mapcache_entry *e)
+{
+	e->prev = NULL;
+	e->next = gs->mc_head;
+	if (gs->mc_head == NULL)
+		gs->mc_tail = e;
+	else
+		gs->mc_head->prev = e;
+	gs->mc_head = e;
+	gs->mc_cur_size += e->size;
+}
 
-	return 0;
+static void remove_mapcache_entry(struct gropes_state *gs,
+				  struct gropes_mapcache_entry *e)
+{
+	if (e->prev != NULL)
+		e->prev->next = e->next;
+	else
+		gs->mc_head = e->next;
+	if (e->next != NULL)
+		e->next->prev = e->prev;
+	else
+		gs->mc_tail = e->prev;
+	gs->mc_cur_size -= e->size;
 }
 
+static void free_mapcache_entry(struct gropes_mapcache_entry *e)
+{
+	g_object_unref(e->pb);
+	free(e);
+}
 
-static void destroy_pix_buf(guchar *pixels, gpointer data)
+/* Turns the view so that the course track, in degrees clockwise from
+ * north, points up */
+void set_map_rotation(struct gropes_state *gs, struct map_state *ms,
+		      double track)
 {
-	struct gps_pixel_buf *pb = data;
+	double rotation = track * M_PI / 180;
 
-	if (pb->can_free)
-		free(pb->data);
+	if (fabs(remainder(rotation - ms->rotation, 2 * M_PI)) <
+	    MIN_ROTATION_STEP)
+		return;
+	pthread_mutex_lock(&ms->mutex);
+	ms->rotation = rotation;
+	ms->rot_valid = 0;
+	if (ms->me.pos_valid)
+		calc_item_pos(gs, ms, &ms->me);
+	pthread_mutex_unlock(&ms->mutex);
+	gtk_widget_queue_draw_area(ms->darea, 0, 0,
+				   ms->darea->allocation.width,
+				   ms->darea->allocation.height);
 }
 
-static void draw_single_map(GtkWidget *widget, struct gpsnav *nav,
-			    struct map_on_screen *mos, const GdkRectangle *isect)
+void purge_map_cache(struct gropes_state *gs)
 {
-	struct gps_pixel_buf pb_need, pb_got;
-	GdkPixbuf *map_pb;
-
-	memset(&pb_need, 0, sizeof(pb_need));
-	pb_need.x = mos->map_area.x + (isect->x - mos->draw_area.x);
-	pb_need.y = mos->map_area.y + (isect->y - mos->draw_area.y);
-	pb_need.width = isect->width;
-	pb_need.height = isect->height;
-	pb_need.bpp = 24;
-	pb_need.row_stride = pb_need.width * 3;
-	pb_got = pb_need;
-
-	if (gpsnav_get_map_pixels(nav, mos->map, &pb_got) < 0) {
-		fprintf(stderr, "gpsnav_get_map_pixels() failed\n");
-		grey_fill(widget, isect);
-		return;
-	}
+	struct gropes_mapcache_entry *e;
 
-	map_pb = gdk_pixbuf_new_from_data(pb_got.data, GDK_COLORSPACE_RGB, FALSE, 8,
-					  pb_got.width, pb_got.height, pb_got.row_stride,
-					  destroy_pix_buf, &pb_got);
-	if (map_pb == NULL) {
-		grey_fill(widget, isect);
-		return;
+	while ((e = gs->mc_head) != NULL) {
+		remove_mapcache_entry(gs, e);
+		free_mapcache_entry(e);
 	}
-	gdk_draw_pixbuf(widget->window, widget->style->fg_gc[GTK_STATE_NORMAL],
-			map_pb, pb_need.x - pb_got.x, pb_need.y - pb_got.y,
-			isect->x, isect->y, isect->width, isect->height,
-			GDK_RGB_DITHER_NONE, 0, 0);
-	g_object_unref(map_pb);
 }
 
-static void draw_single_map_scaled(GtkWidget *widget, struct gpsnav *nav,
-				   struct map_on_screen *mos, GdkRectangle *isect)
+static GdkPixbuf *scale_map(struct gpsnav *nav, struct map_on_screen *mos)
 {
 	struct gps_pixel_buf pb;
 	GdkPixbuf *map_pb, *sub_pb, *scaled_pb;
@@ -426,14 +134,14 @@ static void draw_single_map_scaled(GtkWidget *widget, struct gpsnav *nav,
 
 	if (gpsnav_get_map_pixels(nav, mos->map, &pb) < 0) {
 		fprintf(stderr, "gpsnav_get_map_pixels() failed\n");
-		goto fail;
+		return NULL;
 	}
 
 	map_pb = gdk_pixbuf_new_from_data(pb.data, GDK_COLORSPACE_RGB, FALSE, 8,
 					  pb.width, pb.height, pb.row_stride,
 					  destroy_pix_buf, &pb);
 	if (map_pb == NULL)
-		goto fail;
+		return NULL;
 	sub_pb = gdk_pixbuf_new_subpixbuf(map_pb, mos->map_area.x - pb.x,
 					  mos->map_area.y - pb.y,
 					  mos->map_area.width,
@@ -443,27 +151,212 @@ static void draw_single_map_scaled(GtkWidget *widget, struct gpsnav *nav,
 					    mos->draw_area.height,
 					    GDK_INTERP_BILINEAR);
 	g_object_unref(sub_pb);
+
+	return scaled_pb;
+}
+
+static struct gropes_mapcache_entry *
+find_mapcache_entry(struct gropes_state *gs, struct map_on_screen *mos)
+{
+	struct gropes_mapcache_entry *e;
+	GdkRectangle *ma = &mos->map_area;
+
+	for (e = gs->mc_head; e != NULL; e = e->next) {
+		if (e->map == mos->map && e->map_area.x == ma->x &&
+		    e->map_area.y == ma->y && e->map_area.width == ma->width &&
+		    e->map_area.height == ma->height &&
+		    e->width == mos->draw_area.width &&
+		    e->height == mos->draw_area.height)
+			return e;
+	}
+	return NULL;
+}
+
+static int is_map_cached(struct gropes_state *gs, struct map_on_screen *mos)
+{
+	return find_mapcache_entry(gs, mos) != NULL;
+}
+
+static GdkPixbuf *get_scaled_map(struct gropes_state *gs,
+				 struct map_on_screen *mos)
+{
+	struct gropes_mapcache_entry *e;
+
+	e = find_mapcache_entry(gs, mos);
+	if (e != NULL) {
+		if (e != gs->mc_head) {
+			remove_mapcache_entry(gs, e);
+			add_mapcache_entry(gs, e);
+		}
+		return e->pb;
+	}
+
+	e = malloc(sizeof(*e));
+	if (e == NULL)
+		return NULL;
+	pthread_mutex_lock(&gs->pixels_lock);
+	e->pb = scale_map(gs->nav, mos);
+	pthread_mutex_unlock(&gs->pixels_lock);
+	if (e->pb == NULL) {
+		free(e);
+		return NULL;
+	}
+	e->map = mos->map;
+	e->map_area = mos->map_area;
+	e->width = mos->draw_area.width;
+	e->height = mos->draw_area.height;
+	e->size = sizeof(*e) + gdk_pixbuf_get_rowstride(e->pb) * e->height;
+	while (gs->mc_tail != NULL &&
+	       gs->mc_cur_size + e->size > gs->mc_max_size) {
+		struct gropes_mapcache_entry *old = gs->mc_tail;
+
+		remove_mapcache_entry(gs, old);
+		free_mapcache_entry(old);
+	}
+	add_mapcache_entry(gs, e);
+
+	return e->pb;
+}
+
+/* Scales only the part of the map feeding isect, with the same
+ * transformation gdk_pixbuf_scale_simple() would use for the whole
+ * draw area */
+static GdkPixbuf *scale_map_area(struct gpsnav *nav, struct map_on_screen *mos,
+				 const GdkRectangle *isect)
+{
+	struct gps_pixel_buf pb;
+	GdkRectangle *ma = &mos->map_area, *sa = &mos->draw_area;
+	GdkPixbuf *map_pb, *sub_pb, *scaled_pb;
+	double fx, fy;
+	int x, y, sx, sy, ex, ey, margin_x, margin_y;
+
+	fx = (double) ma->width / sa->width;
+	fy = (double) ma->height / sa->height;
+	/* The filter reads up to one destination pixel beyond the area */
+	margin_x = ceil(fx) + 1;
+	margin_y = ceil(fy) + 1;
+	x = isect->x - sa->x;
+	y = isect->y - sa->y;
+	sx = MAX(ma->x, ma->x + (int) floor(x * fx) - margin_x);
+	sy = MAX(ma->y, ma->y + (int) floor(y * fy) - margin_y);
+	ex = MIN(ma->x + ma->width,
+		 ma->x + (int) ceil((x + isect->width) * fx) + margin_x);
+	ey = MIN(ma->y + ma->height,
+		 ma->y + (int) ceil((y + isect->height) * fy) + margin_y);
+
+	memset(&pb, 0, sizeof(pb));
+	pb.x = sx;
+	pb.y = sy;
+	pb.width = ex - sx;
+	pb.height = ey - sy;
+	pb.bpp = 24;
+	pb.row_stride = pb.width * 3;
+
+	if (gpsnav_get_map_pixels(nav, mos->map, &pb) < 0) {
+		fprintf(stderr, "gpsnav_get_map_pixels() failed\n");
+		return NULL;
+	}
+
+	map_pb = gdk_pixbuf_new_from_data(pb.data, GDK_COLORSPACE_RGB, FALSE, 8,
+					  pb.width, pb.height, pb.row_stride,
+					  destroy_pix_buf, &pb);
+	if (map_pb == NULL)
+		return NULL;
+	/* The filter clamps at the edges of what it is given */
+	sub_pb = gdk_pixbuf_new_subpixbuf(map_pb, sx - pb.x, sy - pb.y,
+					  ex - sx, ey - sy);
+	g_object_unref(map_pb);
+	scaled_pb = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, isect->width,
+				   isect->height);
+	if (scaled_pb == NULL) {
+		g_object_unref(sub_pb);
+		return NULL;
+	}
+	gdk_pixbuf_scale(sub_pb, scaled_pb, 0, 0, isect->width, isect->height,
+			 (sx - ma->x) / fx - x, (sy - ma->y) / fy - y,
+			 1 / fx, 1 / fy, GDK_INTERP_BILINEAR);
+	g_object_unref(sub_pb);
+
+	return scaled_pb;
+}
+
+static void draw_single_map_scaled(struct draw_target *t,
+				   struct gropes_state *gs,
+				   const struct layout_view *lv,
+				   struct map_on_screen *mos, GdkRectangle *isect)
+{
+	GdkPixbuf *scaled_pb;
+	GdkRectangle need;
+
+	/* Small parts of maps not in the cache, such as a strip panned
+	 * into view, are resampled alone. The render thread draws in
+	 * tiles, so this goes by all of the map the layout view needs. */
+	if (!gdk_rectangle_intersect(&mos->clip_area,
+				     (GdkRectangle *) &lv->area, &need))
+		need = *isect;
+	if (!is_map_cached(gs, mos) &&
+	    2 * need.width * need.height <
+	    mos->draw_area.width * mos->draw_area.height) {
+		pthread_mutex_lock(&gs->pixels_lock);
+		scaled_pb = scale_map_area(gs->nav, mos, isect);
+		pthread_mutex_unlock(&gs->pixels_lock);
+		if (scaled_pb == NULL)
+			return;
+		target_draw_pixbuf(t, scaled_pb, 0, 0, isect);
+		g_object_unref(scaled_pb);
+		return;
+	}
+
+	scaled_pb = get_scaled_map(gs, mos);
 	if (scaled_pb == NULL)
-		goto fail;
-	gdk_draw_pixbuf(widget->window, widget->style->fg_gc[GTK_STATE_NORMAL],
-			scaled_pb, isect->x - mos->draw_area.x,
-			isect->y - mos->draw_area.y, isect->x, isect->y,
-			isect->width, isect->height, GDK_RGB_DITHER_NONE, 0, 0);
-	g_object_unref(scaled_pb);
-	return;
-fail:
-	grey_fill(widget, isect);
-	return;
+		return;
+	target_draw_pixbuf(t, scaled_pb, isect->x - mos->draw_area.x,
+			   isect->y - mos->draw_area.y, isect);
 }
 
-void draw_maps(struct gropes_state *state, GtkWidget *widget,
-	       struct map_on_screen *mos_list, const GdkRectangle *area)
+static int is_map_scaled(const struct map_on_screen *mos)
+{
+	return mos->map_area.height != mos->draw_area.height ||
+		mos->map_area.width != mos->draw_area.width;
+}
+
+static void get_layout_view(struct map_state *ms, struct layout_view *lv,
+			    const GdkRectangle *area)
+{
+	lv->mos_list = ms->mos_list;
+	lv->ref_map = ms->ref_map;
+	lv->marea = ms->layout_marea;
+	lv->scale = ms->scale;
+	lv->area = *area;
+}
+
+/* Copies the unscaled maps within area from the server-side tiles */
+void draw_unscaled_maps(struct gropes_state *gs, struct map_state *ms,
+			GtkWidget *widget, GdkDrawable *d,
+			const GdkRectangle *area)
 {
 	struct map_on_screen *mos;
+	GdkRectangle isect;
+
+	for (mos = ms->mos_list; mos != NULL; mos = mos->next) {
+		if (mos->map == NULL || mos->warp || is_map_scaled(mos))
+			continue;
+		if (gdk_rectangle_intersect(&mos->clip_area, (GdkRectangle *) area, &isect))
+			draw_single_map_tiled(gs, widget, d, mos, &isect);
+	}
+}
+
+void draw_map_rectangles(struct gropes_state *gs, struct map_state *ms,
+			 GdkDrawable *d, const GdkRectangle *area)
+{
+	struct map_on_screen *mos;
+	GdkRectangle isect;
 	GdkGC *gc;
 	GdkColor blue;
 
-	gc = gdk_gc_new(GDK_DRAWABLE(widget->window));
+	if (!gs->opt_draw_map_rectangles)
+		return;
+	gc = gdk_gc_new(d);
 	if (gc == NULL)
 		return;
 	blue.red = 0;
@@ -471,42 +364,243 @@ void draw_maps(struct gropes_state *state, GtkWidget *widget,
 	blue.blue = 0xffff;
 	blue.pixel = 0x0000ff;
 	gdk_gc_set_foreground(gc, &blue);
-	for (mos = mos_list; mos != NULL; mos = mos->next) {
-		GdkRectangle isect;
+	gdk_gc_set_clip_rectangle(gc, (GdkRectangle *) area);
+	for (mos = ms->mos_list; mos != NULL; mos = mos->next) {
+		if (mos->map != NULL &&
+		    gdk_rectangle_intersect(&mos->clip_area, (GdkRectangle *) area, &isect))
+			gdk_draw_rectangle(d, gc, FALSE, mos->clip_area.x,
+					   mos->clip_area.y, mos->clip_area.width - 1,
+					   mos->clip_area.height - 1);
+	}
+	g_object_unref(gc);
+}
 
-		if (!gdk_rectangle_intersect(&mos->draw_area, (GdkRectangle *) area, &isect))
-			continue;
+/* Draws the maps of the layout within area to d. Scaled and warped
+ * maps are composed on the client side when the visual allows, and
+ * unscaled maps are then copied from the server-side tiles. */
+static void draw_maps(struct gropes_state *state, struct map_state *ms,
+		      GtkWidget *widget, GdkDrawable *d,
+		      const GdkRectangle *area)
+{
+	struct layout_view lv;
+	struct draw_target t;
+
+	get_layout_view(ms, &lv, area);
+	target_init(state, &t, widget, d, area);
+	render_maps(state, &lv, &t);
+	target_finish(&t);
+	draw_unscaled_maps(state, ms, widget, d, area);
+	draw_map_rectangles(state, ms, d, area);
+}
+
+/* Composes the scaled and warped maps of the layout within the area of
+ * t. The rest stays grey, for draw_unscaled_maps() to fill in. With a
+ * client-side target this makes no X calls, so the render thread runs
+ * it too. */
+void render_maps(struct gropes_state *gs, const struct layout_view *lv,
+		 struct draw_target *t)
+{
+	struct map_on_screen *mos;
+	GdkRectangle isect;
 
-		if (mos->map == NULL) {
-			grey_fill(widget, &isect);
+	/* Blank and failed areas stay grey */
+	target_fill(t, &t->area);
+	for (mos = lv->mos_list; mos != NULL; mos = mos->next) {
+		if (mos->map == NULL || (!mos->warp && !is_map_scaled(mos)))
 			continue;
-		}
+		if (!gdk_rectangle_intersect(&mos->clip_area, &t->area, &isect))
+			continue;
+
+		if (mos->warp)
+			draw_single_map_warped(gs, lv, t, mos, &isect);
+		else
+			draw_single_map_scaled(t, gs, lv, mos, &isect);
+	}
+}
+
+/* Fills area, the whole backing store, with its old content moved and
+ * zoomed to the new layout, to show until the maps are rendered.
+ * Returns -1 if there is nothing to show. */
+static int preview_backing(struct map_state *ms, GtkWidget *widget,
+			   const GdkRectangle *area)
+{
+	GdkPixbuf *old, *pb;
+	GdkRectangle dest;
+	double f, ox, oy;
+
+	if (ms->backing_scale == 0 || ms->backing_ref_map != ms->ref_map)
+		return -1;
+	/* New pixels per old pixel */
+	f = ms->backing_scale / ms->scale;
+	if (f < 0.25 || f > 4)
+		return -1;
+	/* Where the old content starts in the new layout */
+	ox = (ms->backing_marea.start.e - ms->layout_marea.start.e) / ms->scale;
+	oy = (ms->layout_marea.end.n - ms->backing_marea.end.n) / ms->scale;
+	dest.x = MAX(0, (int) ceil(ox));
+	dest.y = MAX(0, (int) ceil(oy));
+	dest.width = MIN(area->width, (int) floor(ox + area->width * f)) -
+		dest.x;
+	dest.height = MIN(area->height, (int) floor(oy + area->height * f)) -
+		dest.y;
+	if (dest.width <= 0 || dest.height <= 0)
+		return -1;
+
+	old = gdk_pixbuf_get_from_drawable(NULL, ms->backing,
+					   gtk_widget_get_colormap(widget),
+					   0, 0, 0, 0, area->width,
+					   area->height);
+	if (old == NULL)
+		return -1;
+	pb = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, dest.width,
+			    dest.height);
+	if (pb == NULL) {
+		g_object_unref(old);
+		return -1;
+	}
+	gdk_pixbuf_scale(old, pb, 0, 0, dest.width, dest.height,
+			 ox - dest.x, oy - dest.y, f, f, GDK_INTERP_NEAREST);
+	g_object_unref(old);
+	grey_fill(widget, ms->backing, area);
+	gdk_draw_pixbuf(ms->backing, widget->style->fg_gc[GTK_STATE_NORMAL],
+			pb, 0, 0, dest.x, dest.y, dest.width, dest.height,
+			GDK_RGB_DITHER_NONE, 0, 0);
+	g_object_unref(pb);
+
+	return 0;
+}
 
-		if (mos->map_area.height != mos->draw_area.height ||
-		    mos->map_area.width != mos->draw_area.width) {
-			draw_single_map_scaled(widget, state->nav, mos, &isect);
+/* Makes sure the backing store holds the whole layout */
+static int update_backing(struct gropes_state *gs, struct map_state *ms,
+			  GtkWidget *widget)
+{
+	GdkRectangle area;
+	gint width, height;
+
+	area.x = area.y = 0;
+	area.width = ms->width + 2 * ms->margin_x;
+	area.height = ms->height + 2 * ms->margin_y;
+	if (ms->backing != NULL) {
+		gdk_drawable_get_size(ms->backing, &width, &height);
+		if (width != area.width || height != area.height) {
+			g_object_unref(ms->backing);
+			ms->backing = NULL;
+		}
+	}
+	if (ms->backing == NULL) {
+		ms->backing = gdk_pixmap_new(widget->window, area.width,
+					     area.height, -1);
+		if (ms->backing == NULL)
+			return -1;
+		ms->backing_valid = 0;
+		ms->backing_scale = 0;
+	}
+	if (!ms->backing_valid) {
+		if (gs->renderer != NULL) {
+			if (preview_backing(ms, widget, &area) < 0)
+				grey_fill(widget, ms->backing, &area);
+			render_queue(gs, ms, &area, 1);
 		} else
-			draw_single_map(widget, state->nav, mos, &isect);
+			draw_maps(gs, ms, widget, ms->backing, &area);
+		ms->backing_valid = 1;
+		ms->rot_valid = 0;
+		ms->backing_ref_map = ms->ref_map;
+		ms->backing_marea = ms->layout_marea;
+		ms->backing_scale = ms->scale;
+	}
+	return 0;
+}
 
-		if (state->opt_draw_map_rectangles)
-			gdk_draw_rectangle(widget->window, gc, FALSE, mos->draw_area.x,
-					   mos->draw_area.y, mos->draw_area.width - 1,
-					   mos->draw_area.height - 1);
+static int get_pixbuf(GdkPixbuf **pb, int width, int height)
+{
+	if (*pb != NULL && gdk_pixbuf_get_width(*pb) == width &&
+	    gdk_pixbuf_get_height(*pb) == height)
+		return 0;
+	if (*pb != NULL)
+		g_object_unref(*pb);
+	*pb = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, width, height);
+
+	return *pb == NULL ? -1 : 0;
+}
+
+/* Draws the view turned by ms->rotation around its center. Only the
+ * square that the turned view reaches into is read back from the
+ * backing store, and the result is kept until the view changes. */
+static int draw_rotated_view(struct gropes_state *gs, struct map_state *ms,
+			     GtkWidget *widget, const GdkRectangle *area)
+{
+	struct rgb_image src, dst;
+	const GdkColor *bg;
+	uint8_t bg_rgb[3];
+	int r, x, y;
+
+	if (!ms->rot_valid) {
+		r = ceil(hypot(ms->width, ms->height) / 2) + 1;
+		x = ms->view_x + ms->width / 2 - r;
+		y = ms->view_y + ms->height / 2 - r;
+		if (x < 0 || y < 0 ||
+		    x + 2 * r > ms->width + 2 * ms->margin_x ||
+		    y + 2 * r > ms->height + 2 * ms->margin_y)
+			return -1;
+		if (get_pixbuf(&ms->north_pb, 2 * r, 2 * r) < 0 ||
+		    get_pixbuf(&ms->rot_pb, ms->width, ms->height) < 0)
+			return -1;
+		if (gdk_pixbuf_get_from_drawable(ms->north_pb, ms->backing,
+						 gtk_widget_get_colormap(widget),
+						 x, y, 0, 0, 2 * r, 2 * r) == NULL)
+			return -1;
+
+		src.data = gdk_pixbuf_get_pixels(ms->north_pb);
+		src.width = src.height = 2 * r;
+		src.stride = gdk_pixbuf_get_rowstride(ms->north_pb);
+		dst.data = gdk_pixbuf_get_pixels(ms->rot_pb);
+		dst.width = ms->width;
+		dst.height = ms->height;
+		dst.stride = gdk_pixbuf_get_rowstride(ms->rot_pb);
+		bg = &widget->style->bg[GTK_STATE_NORMAL];
+		bg_rgb[0] = bg->red >> 8;
+		bg_rgb[1] = bg->green >> 8;
+		bg_rgb[2] = bg->blue >> 8;
+		rotate_rgb(&src, ms->view_x + ms->width / 2.0 - x,
+			   ms->view_y + ms->height / 2.0 - y, ms->rotation,
+			   &dst, bg_rgb,
+			   gs->opt_smooth_rotation ? ROTATE_BILINEAR : 0);
+		ms->rot_valid = 1;
 	}
-	g_object_unref(gc);
+	gdk_draw_pixbuf(widget->window, widget->style->fg_gc[GTK_STATE_NORMAL],
+			ms->rot_pb, area->x, area->y, area->x, area->y,
+			area->width, area->height, GDK_RGB_DITHER_NONE, 0, 0);
+
+	return 0;
 }
 
-static int compare_draw_area(const void *arg1, const void *arg2)
+void draw_map_view(struct gropes_state *gs, struct map_state *ms,
+		   GtkWidget *widget, const GdkRectangle *area)
+{
+	if (update_backing(gs, ms, widget) < 0) {
+		grey_fill(widget, widget->window, area);
+		return;
+	}
+	if (ms->rotation != 0 &&
+	    draw_rotated_view(gs, ms, widget, area) == 0)
+		return;
+	gdk_draw_drawable(widget->window, widget->style->fg_gc[GTK_STATE_NORMAL],
+			  ms->backing, area->x + ms->view_x,
+			  area->y + ms->view_y, area->x, area->y,
+			  area->width, area->height);
+}
+
+static int compare_clip_area(const void *arg1, const void *arg2)
 {
 	const struct map_on_screen *m1 = arg1, *m2 = arg2;
 
-	if (m1->draw_area.y < m2->draw_area.y)
+	if (m1->clip_area.y < m2->clip_area.y)
 		return -1;
-	if (m1->draw_area.y > m2->draw_area.y)
+	if (m1->clip_area.y > m2->clip_area.y)
 		return 1;
-	if (m1->draw_area.x < m2->draw_area.x)
+	if (m1->clip_area.x < m2->clip_area.x)
 		return -1;
-	if (m1->draw_area.x > m2->draw_area.x)
+	if (m1->clip_area.x > m2->clip_area.x)
 		return 1;
 	return 0;
 }
@@ -524,7 +618,7 @@ static void sort_map_list(struct map_on_screen **head)
 		smallest = start;
 		prev = &start->next;
 		for (mos = start->next; mos != NULL; mos = mos->next) {
-			if (compare_draw_area(mos, smallest) < 0) {
+			if (compare_clip_area(mos, smallest) < 0) {
 				smallest = mos;
 				smallest_ptr = prev;
 			}
@@ -551,26 +645,117 @@ static void sort_map_list(struct map_on_screen **head)
 }
 
 
+/* Moves the entry by dx, dy and clips what it covers to the screen.
+ * The placement itself is only moved, so that the map keeps its exact
+ * scale and offset however often it is panned. Returns 0 if nothing
+ * is left. */
+static int translate_mos_entry(struct map_on_screen *mos, int dx, int dy,
+			       int width, int height)
+{
+	GdkRectangle screen, clip;
+
+	mos->draw_area.x += dx;
+	mos->draw_area.y += dy;
+	mos->clip_area.x += dx;
+	mos->clip_area.y += dy;
+	screen.x = screen.y = 0;
+	screen.width = width;
+	screen.height = height;
+	if (!gdk_rectangle_intersect(&mos->clip_area, &screen, &clip))
+		return 0;
+	mos->clip_area = clip;
+
+	return 1;
+}
+
+/* At an unchanged scale the existing layout only moves by whole
+ * pixels, so translate it and lay out the strips that came into view.
+ * A valid backing store is scrolled along, and only the new strips
+ * are drawn to it. */
+static int translate_map_layout(struct gropes_state *gs, struct map_state *ms,
+				int dx, int dy)
+{
+	struct map_on_screen *mos, **prev;
+	GdkRectangle screen, strips[2];
+	int i, r, strip_count = 0;
+
+	prev = &ms->mos_list;
+	while ((mos = *prev) != NULL) {
+		if (!translate_mos_entry(mos, dx, dy, ms->layout_width,
+					 ms->layout_height)) {
+			*prev = mos->next;
+			free(mos);
+			continue;
+		}
+		prev = &mos->next;
+	}
+
+	screen.x = screen.y = 0;
+	screen.width = ms->layout_width;
+	screen.height = ms->layout_height;
+	if (dy != 0) {
+		strips[strip_count] = screen;
+		strips[strip_count].height = abs(dy);
+		if (dy < 0)
+			strips[strip_count].y = screen.height + dy;
+		strip_count++;
+	}
+	if (dx != 0) {
+		strips[strip_count] = screen;
+		strips[strip_count].width = abs(dx);
+		if (dx < 0)
+			strips[strip_count].x = screen.width + dx;
+		strips[strip_count].height = screen.height - abs(dy);
+		if (dy > 0)
+			strips[strip_count].y = dy;
+		strip_count++;
+	}
+	for (i = 0; i < strip_count; i++) {
+		r = generate_map_layout(gs->nav, ms->ref_map, &screen,
+					&ms->layout_marea, ms->scale,
+					&strips[i], prev);
+		if (r)
+			return r;
+		prev = get_next_head(prev);
+	}
+
+	if (ms->backing == NULL || !ms->backing_valid)
+		return 0;
+	/* The copy handles the overlap */
+	gdk_draw_drawable(ms->backing, ms->darea->style->fg_gc[GTK_STATE_NORMAL],
+			  ms->backing, 0, 0, dx, dy, screen.width,
+			  screen.height);
+	ms->backing_marea = ms->layout_marea;
+	for (i = 0; i < strip_count; i++) {
+		if (gs->renderer != NULL) {
+			grey_fill(ms->darea, ms->backing, &strips[i]);
+			render_queue(gs, ms, &strips[i], 0);
+		} else
+			draw_maps(gs, ms, ms->darea, ms->backing, &strips[i]);
+	}
+	return 0;
+}
+
 void change_map_center(struct gropes_state *gs, struct map_state *ms,
 		       const struct gps_mcoord *cent, double scale)
 {
 	struct map_on_screen *mos;
-	struct gps_map **maps;
-	struct gps_marea *marea;
+	struct gps_marea *marea, *lmarea, old_marea;
 	GdkRectangle draw_area;
-	int width, height, r;
+	double fdx, fdy;
+	int width, height, dx, dy, view_x, view_y, same_layout, r;
+	int margin_x, margin_y, radius;
 
 	pthread_mutex_lock(&ms->mutex);
 
-	free_mos_list(ms->mos_list);
-	ms->mos_list = NULL;
+	old_marea = ms->marea;
 
 	if (scale < 0.1)
 		scale = 0.1;
 
 	ms->scale = scale;
 	ms->center_mpos = *cent;
-	gpsnav_get_coord_for_metric(ms->ref_map, cent, &ms->center_pos);
+	gpsnav_get_coord_for_metric_interp(ms->ref_map, cent, &ms->center_pos);
 
 #if 0
 	{
@@ -608,34 +793,73 @@ void change_map_center(struct gropes_state *gs, struct map_state *ms,
 	if (ms->me.pos_valid)
 		calc_item_pos(gs, ms, &ms->me);
 
-	maps = gpsnav_find_maps_for_marea(gs->nav, ms->ref_map, marea);
-	if (maps == NULL) {
-		/* FIXME: Try to find a new ref map for latlong area */
-//		printf("No maps found!\n");
-		goto ret;
+	/* The layout and the backing store cover the view and a margin of
+	 * BACKING_MARGIN pixels around it. A track-up view is turned out
+	 * of the square around its circumscribed circle, so the margin
+	 * then reaches past that. */
+	margin_x = margin_y = BACKING_MARGIN;
+	if (gs->opt_track_up) {
+		radius = ceil(hypot(width, height) / 2) + 1;
+		margin_x += radius - width / 2;
+		margin_y += radius - height / 2;
+	}
+	width += 2 * margin_x;
+	height += 2 * margin_y;
+
+	/* Screen y grows southwards, so a move north shifts the layout
+	 * down */
+	fdx = (old_marea.start.e - marea->start.e) / scale;
+	fdy = (marea->start.n - old_marea.start.n) / scale;
+	same_layout = ms->mos_list != NULL && ms->layout_scale == scale &&
+		ms->layout_ref_map == ms->ref_map &&
+		ms->layout_width == width && ms->layout_height == height &&
+		fabs(fdx - rint(fdx)) < 1e-6 && fabs(fdy - rint(fdy)) < 1e-6 &&
+		fabs(fdx) < width && fabs(fdy) < height;
+	view_x = ms->view_x - (same_layout ? rint(fdx) : 0);
+	view_y = ms->view_y - (same_layout ? rint(fdy) : 0);
+	if (same_layout &&
+	    abs(view_x - margin_x) <= BACKING_MARGIN &&
+	    abs(view_y - margin_y) <= BACKING_MARGIN) {
+		/* The view is still within the layout */
+		ms->view_x = view_x;
+		ms->view_y = view_y;
+		goto draw;
 	}
 
-#if 0
-	{
-		int i;
+	/* Center the view in the layout again */
+	dx = margin_x - view_x;
+	dy = margin_y - view_y;
+	ms->view_x = ms->margin_x = margin_x;
+	ms->view_y = ms->margin_y = margin_y;
+	lmarea = &ms->layout_marea;
+	lmarea->start.e = marea->start.e - margin_x * scale;
+	lmarea->end.n = marea->end.n + margin_y * scale;
+	lmarea->start.n = lmarea->end.n - height * scale;
+	lmarea->end.e = lmarea->start.e + width * scale;
+	if (same_layout && abs(dx) < width && abs(dy) < height) {
+		r = translate_map_layout(gs, ms, dx, dy);
+	} else {
+		free_mos_list(ms->mos_list);
+		ms->mos_list = NULL;
+		ms->backing_valid = 0;
 
-		for (i = 0; maps[i] != NULL; i++);
-		printf("%d map(s) found for area\n", i);
+		draw_area.x = draw_area.y = 0;
+		draw_area.width = width;
+		draw_area.height = height;
+		r = generate_map_layout(gs->nav, ms->ref_map, &draw_area, lmarea,
+					ms->scale, &draw_area, &ms->mos_list);
 	}
-#endif
-
-	draw_area.x = draw_area.y = 0;
-	draw_area.width = width;
-	draw_area.height = height;
-	r = generate_map_layout(gs->nav, ms->ref_map, maps, &draw_area, marea,
-				ms->scale, &draw_area, &ms->mos_list, 0);
-	free(maps);
 	if (r < 0) {
 		gps_error("generate_map_layout failed");
 		free_mos_list(ms->mos_list);
 		ms->mos_list = NULL;
-		goto ret;
+		ms->backing_valid = 0;
+		goto draw;
 	}
+	ms->layout_ref_map = ms->ref_map;
+	ms->layout_scale = scale;
+	ms->layout_width = width;
+	ms->layout_height = height;
 	sort_map_list(&ms->mos_list);
 	for (mos = ms->mos_list; mos != NULL; mos = mos->next) {
 		GdkRectangle *sa, *ma;
@@ -665,9 +889,10 @@ void change_map_center(struct gropes_state *gs, struct map_state *ms,
 		}
 #endif
 	}
+draw:
+	ms->rot_valid = 0;
 	gtk_widget_queue_draw_area(ms->darea, 0, 0,
 				   ms->darea->allocation.width,
 				   ms->darea->allocation.height);
-ret:
 	pthread_mutex_unlock(&ms->mutex);
 }
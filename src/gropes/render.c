@@ -0,0 +1,372 @@
+/*
+ * Drawing maps in the background
+ *
+ * Decoding and scaling the maps of a new layout used to block the main
+ * loop. Instead, the main thread now fills the parts of the backing
+ * store that need maps with a placeholder and queues them here. The
+ * render thread composes their scaled and warped maps in RENDER_TILE
+ * tiles into client-side RGB buffers, from its own copy of the layout,
+ * starting from the middle of the view. An idle callback uploads
+ * finished tiles to the backing store through the compose image, adds
+ * the unscaled maps from the server-side tiles and repaints them on
+ * the screen.
+ *
+ * Tiles are placed on the pixel grid of the view, which stays the same
+ * while the layout is only translated. Starting over, as after a
+ * change of scale, bumps the generation, and work queued for older
+ * generations is dropped.
+ *
+ * While the thread runs, it is the only user of the map and warp
+ * caches. Decoded map pixels are shared under pixels_lock.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "gropes.h"
+
+#define RENDER_TILE	128
+
+struct render_job {
+	struct layout_view lv;	/* with a copy of the layout */
+	unsigned int gen;
+	long ox, oy;		/* layout origin on the pixel grid */
+	guchar bg[3];
+	GdkRectangle *tiles;	/* in layout coordinates */
+	int n_tiles, next_tile;
+
+	struct render_job *next;
+};
+
+struct render_tile {
+	unsigned int gen;
+	long x, y;		/* on the pixel grid */
+	int width, height;
+	guchar *rgb;
+
+	struct render_tile *next;
+};
+
+struct renderer {
+	struct gropes_state *gs;
+	struct map_state *ms;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	unsigned int quit:1;
+	unsigned int gen;
+	/* The part of the pixel grid the layout covers */
+	long win_x, win_y;
+	int win_width, win_height;
+
+	struct render_job *job_head, *job_tail;
+	struct render_tile *done_head, *done_tail;
+	guint idle_id;
+};
+
+static void free_job(struct render_job *job)
+{
+	free_mos_list(job->lv.mos_list);
+	free(job->tiles);
+	free(job);
+}
+
+static struct map_on_screen *copy_mos_list(const struct map_on_screen *mos)
+{
+	struct map_on_screen *head = NULL, **prev = &head, *e;
+
+	for (; mos != NULL; mos = mos->next) {
+		e = malloc(sizeof(*e));
+		if (e == NULL) {
+			free_mos_list(head);
+			return NULL;
+		}
+		*e = *mos;
+		e->next = NULL;
+		*prev = e;
+		prev = &e->next;
+	}
+	return head;
+}
+
+static long tile_distance(const GdkRectangle *t, long cx, long cy)
+{
+	long dx = t->x + t->width / 2 - cx, dy = t->y + t->height / 2 - cy;
+
+	return dx * dx + dy * dy;
+}
+
+static long sort_cx, sort_cy;
+
+static int compare_tiles(const void *arg1, const void *arg2)
+{
+	long d1 = tile_distance(arg1, sort_cx, sort_cy);
+	long d2 = tile_distance(arg2, sort_cx, sort_cy);
+
+	return d1 < d2 ? -1 : d1 > d2;
+}
+
+static struct render_job *create_job(struct map_state *ms,
+				     const GdkRectangle *area)
+{
+	struct render_job *job;
+	const GdkColor *bg;
+	int x, y, n;
+
+	job = malloc(sizeof(*job));
+	if (job == NULL)
+		return NULL;
+	memset(job, 0, sizeof(*job));
+	job->lv.ref_map = ms->ref_map;
+	job->lv.marea = ms->layout_marea;
+	job->lv.scale = ms->scale;
+	job->lv.area = *area;
+	job->lv.mos_list = copy_mos_list(ms->mos_list);
+	job->ox = lrint(ms->layout_marea.start.e / ms->scale);
+	job->oy = lrint(-ms->layout_marea.end.n / ms->scale);
+	bg = &ms->darea->style->bg[GTK_STATE_NORMAL];
+	job->bg[0] = bg->red >> 8;
+	job->bg[1] = bg->green >> 8;
+	job->bg[2] = bg->blue >> 8;
+
+	n = ((area->width + RENDER_TILE - 1) / RENDER_TILE) *
+		((area->height + RENDER_TILE - 1) / RENDER_TILE);
+	job->tiles = malloc(n * sizeof(*job->tiles));
+	if ((ms->mos_list != NULL && job->lv.mos_list == NULL) ||
+	    job->tiles == NULL) {
+		free_job(job);
+		return NULL;
+	}
+	for (y = area->y; y < area->y + area->height; y += RENDER_TILE) {
+		for (x = area->x; x < area->x + area->width;
+		     x += RENDER_TILE) {
+			GdkRectangle *t = &job->tiles[job->n_tiles++];
+
+			t->x = x;
+			t->y = y;
+			t->width = MIN(RENDER_TILE, area->x + area->width - x);
+			t->height = MIN(RENDER_TILE, area->y + area->height - y);
+		}
+	}
+	/* What is on the screen first */
+	sort_cx = ms->view_x + ms->width / 2;
+	sort_cy = ms->view_y + ms->height / 2;
+	qsort(job->tiles, job->n_tiles, sizeof(*job->tiles), compare_tiles);
+
+	return job;
+}
+
+void render_queue(struct gropes_state *gs, struct map_state *ms,
+		  const GdkRectangle *area, int restart)
+{
+	struct renderer *r = gs->renderer;
+	struct render_job *job;
+
+	job = create_job(ms, area);
+	pthread_mutex_lock(&r->lock);
+	if (restart)
+		r->gen++;
+	r->win_x = lrint(ms->layout_marea.start.e / ms->scale);
+	r->win_y = lrint(-ms->layout_marea.end.n / ms->scale);
+	r->win_width = ms->layout_width;
+	r->win_height = ms->layout_height;
+	if (job != NULL) {
+		job->gen = r->gen;
+		if (r->job_tail == NULL)
+			r->job_head = job;
+		else
+			r->job_tail->next = job;
+		r->job_tail = job;
+		pthread_cond_signal(&r->cond);
+	} else
+		fprintf(stderr, "Unable to queue maps for drawing\n");
+	pthread_mutex_unlock(&r->lock);
+}
+
+static int tile_wanted(struct renderer *r, struct render_job *job,
+		       const GdkRectangle *area)
+{
+	long x = area->x + job->ox, y = area->y + job->oy;
+
+	return job->gen == r->gen &&
+		x + area->width > r->win_x && x < r->win_x + r->win_width &&
+		y + area->height > r->win_y && y < r->win_y + r->win_height;
+}
+
+static struct render_tile *render_tile(struct gropes_state *gs,
+				       struct render_job *job,
+				       const GdkRectangle *area)
+{
+	struct render_tile *tile;
+	struct draw_target t;
+
+	tile = malloc(sizeof(*tile) + area->width * area->height * 3);
+	if (tile == NULL)
+		return NULL;
+	tile->gen = job->gen;
+	tile->x = area->x + job->ox;
+	tile->y = area->y + job->oy;
+	tile->width = area->width;
+	tile->height = area->height;
+	tile->rgb = (guchar *) (tile + 1);
+	tile->next = NULL;
+	target_init_rgb(gs, &t, area, tile->rgb, area->width * 3, job->bg);
+	render_maps(gs, &job->lv, &t);
+
+	return tile;
+}
+
+static void upload_tile(struct renderer *r, struct render_tile *tile)
+{
+	struct map_state *ms = r->ms;
+	GdkRectangle area, backing, dest;
+	struct draw_target t;
+	long ox, oy;
+
+	ox = lrint(ms->layout_marea.start.e / ms->scale);
+	oy = lrint(-ms->layout_marea.end.n / ms->scale);
+	area.x = tile->x - ox;
+	area.y = tile->y - oy;
+	area.width = tile->width;
+	area.height = tile->height;
+	backing.x = backing.y = 0;
+	backing.width = ms->layout_width;
+	backing.height = ms->layout_height;
+	if (!gdk_rectangle_intersect(&area, &backing, &dest))
+		return;
+	target_init(r->gs, &t, ms->darea, ms->backing, &dest);
+	target_draw_rgb(&t, tile->rgb + (dest.y - area.y) * tile->width * 3 +
+			(dest.x - area.x) * 3, tile->width * 3, &dest);
+	target_finish(&t);
+	/* The layout may have moved since, but its scale is the same */
+	draw_unscaled_maps(r->gs, ms, ms->darea, ms->backing, &dest);
+	draw_map_rectangles(r->gs, ms, ms->backing, &dest);
+
+	ms->rot_valid = 0;
+	if (ms->rotation != 0)
+		gtk_widget_queue_draw(ms->darea);
+	else
+		gtk_widget_queue_draw_area(ms->darea, dest.x - ms->view_x,
+					   dest.y - ms->view_y, dest.width,
+					   dest.height);
+}
+
+static gboolean upload_tiles(gpointer data)
+{
+	struct renderer *r = data;
+	struct render_tile *tile, *next;
+
+	gdk_threads_enter();
+	pthread_mutex_lock(&r->lock);
+	tile = r->done_head;
+	r->done_head = r->done_tail = NULL;
+	r->idle_id = 0;
+	pthread_mutex_unlock(&r->lock);
+	for (; tile != NULL; tile = next) {
+		next = tile->next;
+		if (tile->gen == r->gen && r->ms->backing != NULL &&
+		    r->ms->backing_valid)
+			upload_tile(r, tile);
+		free(tile);
+	}
+	gdk_threads_leave();
+
+	return FALSE;
+}
+
+static void *render_thread(void *arg)
+{
+	struct renderer *r = arg;
+	struct render_job *job;
+	struct render_tile *tile;
+	GdkRectangle area;
+
+	pthread_mutex_lock(&r->lock);
+	while (!r->quit) {
+		job = r->job_head;
+		if (job == NULL) {
+			pthread_cond_wait(&r->cond, &r->lock);
+			continue;
+		}
+		if (job->gen != r->gen || job->next_tile == job->n_tiles) {
+			r->job_head = job->next;
+			if (r->job_head == NULL)
+				r->job_tail = NULL;
+			free_job(job);
+			continue;
+		}
+		area = job->tiles[job->next_tile++];
+		if (!tile_wanted(r, job, &area))
+			continue;
+
+		/* The job stays queued, and only this thread frees it */
+		pthread_mutex_unlock(&r->lock);
+		tile = render_tile(r->gs, job, &area);
+		pthread_mutex_lock(&r->lock);
+		if (tile == NULL)
+			continue;
+		if (r->done_tail == NULL)
+			r->done_head = tile;
+		else
+			r->done_tail->next = tile;
+		r->done_tail = tile;
+		if (r->idle_id == 0)
+			r->idle_id = g_idle_add(upload_tiles, r);
+	}
+	pthread_mutex_unlock(&r->lock);
+
+	return NULL;
+}
+
+int render_start(struct gropes_state *gs, struct map_state *ms)
+{
+	struct renderer *r;
+
+	r = malloc(sizeof(*r));
+	if (r == NULL)
+		return -ENOMEM;
+	memset(r, 0, sizeof(*r));
+	r->gs = gs;
+	r->ms = ms;
+	pthread_mutex_init(&r->lock, NULL);
+	pthread_cond_init(&r->cond, NULL);
+	if (pthread_create(&r->thread, NULL, render_thread, r) != 0) {
+		pthread_cond_destroy(&r->cond);
+		pthread_mutex_destroy(&r->lock);
+		free(r);
+		return -1;
+	}
+	gs->renderer = r;
+
+	return 0;
+}
+
+void render_stop(struct gropes_state *gs)
+{
+	struct renderer *r = gs->renderer;
+	struct render_job *job;
+	struct render_tile *tile;
+
+	if (r == NULL)
+		return;
+	pthread_mutex_lock(&r->lock);
+	r->quit = 1;
+	pthread_cond_signal(&r->cond);
+	pthread_mutex_unlock(&r->lock);
+	pthread_join(r->thread, NULL);
+
+	while ((job = r->job_head) != NULL) {
+		r->job_head = job->next;
+		free_job(job);
+	}
+	while ((tile = r->done_head) != NULL) {
+		r->done_head = tile->next;
+		free(tile);
+	}
+	if (r->idle_id != 0)
+		g_source_remove(r->idle_id);
+	pthread_cond_destroy(&r->cond);
+	pthread_mutex_destroy(&r->lock);
+	free(r);
+	gs->renderer = NULL;
+}
@@ -0,0 +1,134 @@
+/*
+ * Rotation benchmark: an 800x480 track-up view rotated out of its
+ * circumscribing square, with the fixed point kernel against the
+ * per-pixel floating point loop gropes used before.
+ *
+ * Usage: gropes-rotate-bench [frames]
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "rotate.h"
+#include "bench.h"
+
+#define VIEW_WIDTH	800
+#define VIEW_HEIGHT	480
+
+/* The old pixbuf_rotate(), on plain buffers with an RGBA result */
+static uint8_t *old_rotate(const struct rgb_image *src, double angle,
+			   int width, int height)
+{
+	int x, y, x_rot, y_rot, x_tran, y_tran, center_x, center_y;
+	double cosv, sinv;
+	uint8_t *pixels_rot;
+
+	pixels_rot = malloc(width * height * 4);
+	if (pixels_rot == NULL)
+		exit(1);
+	cosv = cos(2 * M_PI - angle);
+	sinv = sin(2 * M_PI - angle);
+	center_x = src->width / 2;
+	center_y = src->height / 2;
+	memset(pixels_rot, 0x00, width * height * 4);
+	for (y_rot = 0; y_rot < height; y_rot++) {
+		for (x_rot = 0; x_rot < width; x_rot++) {
+			x_tran = x_rot - width / 2;
+			y_tran = y_rot - height / 2;
+
+			x = x_tran * cosv - y_tran * sinv;
+			y = x_tran * sinv + y_tran * cosv;
+
+			x += center_x;
+			y += center_y;
+
+			if (x >= 0 && y >= 0 && x < src->width && y < src->height)
+				memcpy(pixels_rot + (y_rot * width + x_rot) * 4,
+				       src->data + y * src->stride + x * 3, 3);
+		}
+	}
+	return pixels_rot;
+}
+
+/* Compares against nearest neighbour in double precision */
+static int count_mismatches(const struct rgb_image *src, double cx, double cy,
+			    double angle, const struct rgb_image *dst)
+{
+	double c = cos(angle), s = sin(angle);
+	int x, y, bad = 0;
+
+	for (y = 0; y < dst->height; y++) {
+		for (x = 0; x < dst->width; x++) {
+			double ox = x + 0.5 - dst->width / 2.0;
+			double oy = y + 0.5 - dst->height / 2.0;
+			double fu = cx + ox * c - oy * s;
+			double fv = cy + ox * s + oy * c;
+			int u = floor(fu), v = floor(fv);
+			const uint8_t *d = dst->data + y * dst->stride + x * 3;
+
+			/* Ties may go either way */
+			if (fu - u < 1.0 / 256 || u + 1 - fu < 1.0 / 256 ||
+			    fv - v < 1.0 / 256 || v + 1 - fv < 1.0 / 256)
+				continue;
+			if (u < 0 || v < 0 || u >= src->width || v >= src->height)
+				continue;
+			if (memcmp(d, src->data + v * src->stride + u * 3, 3))
+				bad++;
+		}
+	}
+	return bad;
+}
+
+int main(int argc, char *argv[])
+{
+	static const double angles[] = { 0, 7, 30, 45, 90, 123, 200, 315 };
+	static const uint8_t bg[3] = { 0xd6, 0xd6, 0xd6 };
+	struct rgb_image src, dst;
+	double start, t_old, t_near, t_bil;
+	int i, r, x, y, frames, side, bad;
+
+	frames = argc > 1 ? atoi(argv[1]) : 20;
+
+	side = ceil(hypot(VIEW_WIDTH, VIEW_HEIGHT)) + 2;
+	src.width = src.height = side;
+	src.stride = side * 3;
+	src.data = malloc(src.stride * side);
+	dst.width = VIEW_WIDTH;
+	dst.height = VIEW_HEIGHT;
+	dst.stride = VIEW_WIDTH * 3;
+	dst.data = malloc(dst.stride * VIEW_HEIGHT);
+	if (src.data == NULL || dst.data == NULL)
+		return 1;
+	srand(1);
+	for (y = 0; y < side; y++)
+		for (x = 0; x < side * 3; x++)
+			src.data[y * src.stride + x] = rand();
+
+	for (i = 0; i < sizeof(angles) / sizeof(angles[0]); i++) {
+		double a = angles[i] * M_PI / 180;
+
+		start = now();
+		for (r = 0; r < frames; r++)
+			free(old_rotate(&src, a, VIEW_WIDTH, VIEW_HEIGHT));
+		t_old = now() - start;
+		start = now();
+		for (r = 0; r < frames; r++)
+			rotate_rgb(&src, side / 2.0, side / 2.0, a, &dst, bg, 0);
+		t_near = now() - start;
+		bad = count_mismatches(&src, side / 2.0, side / 2.0, a, &dst);
+		start = now();
+		for (r = 0; r < frames; r++)
+			rotate_rgb(&src, side / 2.0, side / 2.0, a, &dst, bg,
+				   ROTATE_BILINEAR);
+		t_bil = now() - start;
+		printf("%3.0f deg: old %.2f ms, nearest %.2f ms (%.1fx, "
+		       "%d px differ), bilinear %.2f ms\n",
+		       angles[i], t_old * 1e3 / frames, t_near * 1e3 / frames,
+		       t_old / t_near, bad, t_bil * 1e3 / frames);
+	}
+	free(src.data);
+	free(dst.data);
+
+	return 0;
+}
@@ -0,0 +1,150 @@
+/*
+ * Rotating RGB images
+ *
+ * The destination is walked in ROTATE_TILE square tiles, so that the
+ * source pixels read for one tile stay in the cache at any angle.
+ * Each row of a tile is a straight line through the source, stepped in
+ * 16.16 fixed point. The part of the row that falls inside the source
+ * is found up front, so the inner loops need no bounds checks, and the
+ * rest of the row gets the background color.
+ */
+#include <math.h>
+#include "rotate.h"
+
+#define ROTATE_TILE	64
+
+static int64_t floor_div(int64_t a, int64_t b)
+{
+	return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+/* Narrows [*start, *end) to the steps i for which f + i * d is within
+ * [0, lim) */
+static void clip_span(int32_t f, int32_t d, int32_t lim, int *start, int *end)
+{
+	int64_t lo, hi;
+
+	if (d > 0) {
+		lo = -floor_div(f, d);
+		hi = floor_div((int64_t) lim - 1 - f, d);
+	} else if (d < 0) {
+		lo = -floor_div((int64_t) lim - 1 - f, -d);
+		hi = floor_div(f, -d);
+	} else if (f >= 0 && f < lim) {
+		return;
+	} else {
+		lo = 0;
+		hi = -1;
+	}
+	if (lo > *start)
+		*start = lo;
+	if (hi + 1 < *end)
+		*end = hi + 1;
+	if (*end < *start)
+		*end = *start;
+}
+
+static void fill_bg(uint8_t *d, int count, const uint8_t *bg)
+{
+	for (; count > 0; count--, d += 3) {
+		d[0] = bg[0];
+		d[1] = bg[1];
+		d[2] = bg[2];
+	}
+}
+
+static void span_nearest(const struct rgb_image *src, uint8_t *d, int count,
+			 int32_t u, int32_t v, int32_t du, int32_t dv)
+{
+	for (; count > 0; count--, d += 3) {
+		const uint8_t *p = src->data + (v >> 16) * src->stride +
+			(u >> 16) * 3;
+
+		d[0] = p[0];
+		d[1] = p[1];
+		d[2] = p[2];
+		u += du;
+		v += dv;
+	}
+}
+
+static void span_bilinear(const struct rgb_image *src, uint8_t *d, int count,
+			  int32_t u, int32_t v, int32_t du, int32_t dv)
+{
+	for (; count > 0; count--, d += 3) {
+		const uint8_t *p = src->data + (v >> 16) * src->stride +
+			(u >> 16) * 3;
+		const uint8_t *q = p + src->stride;
+		int fx = (u >> 8) & 0xff, fy = (v >> 8) & 0xff, c;
+
+		for (c = 0; c < 3; c++) {
+			int top, bottom;
+
+			top = p[c] * (256 - fx) + p[c + 3] * fx;
+			bottom = q[c] * (256 - fx) + q[c + 3] * fx;
+			d[c] = (top * (256 - fy) + bottom * fy + 32768) >> 16;
+		}
+		u += du;
+		v += dv;
+	}
+}
+
+/* Fills dst with src rotated by angle around (cx, cy), which ends up
+ * in the middle of dst. A step right in dst is a step of angle
+ * clockwise from right in src. */
+void rotate_rgb(const struct rgb_image *src, double cx, double cy,
+		double angle, struct rgb_image *dst, const uint8_t *bg,
+		int flags)
+{
+	double c = cos(angle), s = sin(angle), off;
+	int32_t du, dv, lim_u, lim_v;
+	int tx, ty, x, y;
+
+	du = lrint(c * 65536);
+	dv = lrint(s * 65536);
+	/* Bilinear sampling reads one pixel right and down */
+	if (flags & ROTATE_BILINEAR) {
+		lim_u = (src->width - 1) << 16;
+		lim_v = (src->height - 1) << 16;
+		off = 0.5;
+	} else {
+		lim_u = src->width << 16;
+		lim_v = src->height << 16;
+		off = 0;
+	}
+
+	for (ty = 0; ty < dst->height; ty += ROTATE_TILE) {
+		for (tx = 0; tx < dst->width; tx += ROTATE_TILE) {
+			int w = dst->width - tx < ROTATE_TILE ?
+				dst->width - tx : ROTATE_TILE;
+			int h = dst->height - ty < ROTATE_TILE ?
+				dst->height - ty : ROTATE_TILE;
+
+			for (y = ty; y < ty + h; y++) {
+				uint8_t *d = dst->data + y * dst->stride +
+					tx * 3;
+				double ox = tx + 0.5 - dst->width / 2.0;
+				double oy = y + 0.5 - dst->height / 2.0;
+				int32_t u, v;
+				int start = 0, end = w;
+
+				u = lrint((cx + ox * c - oy * s - off) * 65536);
+				v = lrint((cy + ox * s + oy * c - off) * 65536);
+				clip_span(u, du, lim_u, &start, &end);
+				clip_span(v, dv, lim_v, &start, &end);
+
+				fill_bg(d, start, bg);
+				x = end - start;
+				if (flags & ROTATE_BILINEAR)
+					span_bilinear(src, d + start * 3, x,
+						      u + start * du,
+						      v + start * dv, du, dv);
+				else
+					span_nearest(src, d + start * 3, x,
+						     u + start * du,
+						     v + start * dv, du, dv);
+				fill_bg(d + end * 3, w - end, bg);
+			}
+		}
+	}
+}
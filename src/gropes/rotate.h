@@ -0,0 +1,18 @@
+#ifndef ROTATE_H
+#define ROTATE_H
+
+#include <stdint.h>
+
+#define ROTATE_BILINEAR	0x01
+
+/* Packed 24-bit RGB pixels */
+struct rgb_image {
+	uint8_t *data;
+	int width, height, stride;
+};
+
+void rotate_rgb(const struct rgb_image *src, double cx, double cy,
+		double angle, struct rgb_image *dst, const uint8_t *bg,
+		int flags);
+
+#endif
@@ -0,0 +1,182 @@
+/*
+ * Server-side cache of unscaled map pixels
+ *
+ * Maps drawn at their own scale are split into TILE_SIZE tiles on the
+ * map's pixel grid, so that the tiles stay valid however the layout
+ * clips the map. Each tile is uploaded once into a GdkPixmap, and
+ * drawing it again is a copy within the X server. The cache is kept
+ * within pt_max_pixels pixels, least recently used tiles going first.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "gropes.h"
+
+#define TILE_SIZE	256
+
+struct map_tile {
+	struct gps_map *map;
+	int tx, ty;
+	GdkPixmap *pm;
+	unsigned int pixels;
+
+	struct map_tile *next, *prev;
+};
+
+static void add_map_tile(struct gropes_state *gs, struct map_tile *t)
+{
+	t->prev = NULL;
+	t->next = gs->pt_head;
+	if (gs->pt_head == NULL)
+		gs->pt_tail = t;
+	else
+		gs->pt_head->prev = t;
+	gs->pt_head = t;
+	gs->pt_cur_pixels += t->pixels;
+}
+
+static void remove_map_tile(struct gropes_state *gs, struct map_tile *t)
+{
+	if (t->prev != NULL)
+		t->prev->next = t->next;
+	else
+		gs->pt_head = t->next;
+	if (t->next != NULL)
+		t->next->prev = t->prev;
+	else
+		gs->pt_tail = t->prev;
+	gs->pt_cur_pixels -= t->pixels;
+}
+
+static void free_map_tile(struct map_tile *t)
+{
+	g_object_unref(t->pm);
+	free(t);
+}
+
+void purge_tile_cache(struct gropes_state *gs)
+{
+	struct map_tile *t;
+
+	while ((t = gs->pt_head) != NULL) {
+		remove_map_tile(gs, t);
+		free_map_tile(t);
+	}
+}
+
+static GdkPixmap *create_tile_pixmap(struct gpsnav *nav, GtkWidget *widget,
+				     struct gps_map *map, int tx, int ty)
+{
+	struct gps_pixel_buf pb_need, pb_got;
+	GdkPixmap *pm;
+
+	memset(&pb_need, 0, sizeof(pb_need));
+	pb_need.x = tx * TILE_SIZE;
+	pb_need.y = ty * TILE_SIZE;
+	pb_need.width = MIN(TILE_SIZE, map->width - pb_need.x);
+	pb_need.height = MIN(TILE_SIZE, map->height - pb_need.y);
+	pb_need.bpp = 24;
+	pb_need.row_stride = pb_need.width * 3;
+	pb_got = pb_need;
+
+	if (gpsnav_get_map_pixels(nav, map, &pb_got) < 0) {
+		fprintf(stderr, "gpsnav_get_map_pixels() failed\n");
+		return NULL;
+	}
+	pm = gdk_pixmap_new(widget->window, pb_need.width, pb_need.height, -1);
+	if (pm != NULL)
+		gdk_draw_rgb_image(pm, widget->style->fg_gc[GTK_STATE_NORMAL],
+				   0, 0, pb_need.width, pb_need.height,
+				   GDK_RGB_DITHER_NONE, pb_got.data +
+				   (pb_need.y - pb_got.y) * pb_got.row_stride +
+				   (pb_need.x - pb_got.x) * 3,
+				   pb_got.row_stride);
+	if (pb_got.can_free)
+		free(pb_got.data);
+
+	return pm;
+}
+
+static struct map_tile *get_map_tile(struct gropes_state *gs,
+				     GtkWidget *widget, struct gps_map *map,
+				     int tx, int ty)
+{
+	struct map_tile *t;
+	gint width, height;
+
+	for (t = gs->pt_head; t != NULL; t = t->next) {
+		if (t->map == map && t->tx == tx && t->ty == ty) {
+			if (t != gs->pt_head) {
+				remove_map_tile(gs, t);
+				add_map_tile(gs, t);
+			}
+			return t;
+		}
+	}
+
+	t = malloc(sizeof(*t));
+	if (t == NULL)
+		return NULL;
+	pthread_mutex_lock(&gs->pixels_lock);
+	t->pm = create_tile_pixmap(gs->nav, widget, map, tx, ty);
+	pthread_mutex_unlock(&gs->pixels_lock);
+	if (t->pm == NULL) {
+		free(t);
+		return NULL;
+	}
+	t->map = map;
+	t->tx = tx;
+	t->ty = ty;
+	gdk_drawable_get_size(t->pm, &width, &height);
+	t->pixels = width * height;
+	while (gs->pt_tail != NULL &&
+	       gs->pt_cur_pixels + t->pixels > gs->pt_max_pixels) {
+		struct map_tile *old = gs->pt_tail;
+
+		remove_map_tile(gs, old);
+		free_map_tile(old);
+	}
+	add_map_tile(gs, t);
+
+	return t;
+}
+
+void draw_single_map_tiled(struct gropes_state *gs, GtkWidget *widget,
+			   GdkDrawable *d, struct map_on_screen *mos,
+			   const GdkRectangle *isect)
+{
+	GdkGC *gc = widget->style->fg_gc[GTK_STATE_NORMAL];
+	GdkRectangle need;
+	int tx, ty;
+
+	/* The part of the map shown in isect */
+	need.x = mos->map_area.x + (isect->x - mos->draw_area.x);
+	need.y = mos->map_area.y + (isect->y - mos->draw_area.y);
+	need.width = isect->width;
+	need.height = isect->height;
+	for (ty = need.y / TILE_SIZE;
+	     ty <= (need.y + need.height - 1) / TILE_SIZE; ty++) {
+		for (tx = need.x / TILE_SIZE;
+		     tx <= (need.x + need.width - 1) / TILE_SIZE; tx++) {
+			GdkRectangle tile_area, area;
+			struct map_tile *t;
+
+			tile_area.x = tx * TILE_SIZE;
+			tile_area.y = ty * TILE_SIZE;
+			tile_area.width = tile_area.height = TILE_SIZE;
+			if (!gdk_rectangle_intersect(&tile_area, &need, &area))
+				continue;
+			t = get_map_tile(gs, widget, mos->map, tx, ty);
+			if (t == NULL) {
+				area.x += isect->x - need.x;
+				area.y += isect->y - need.y;
+				grey_fill(widget, d, &area);
+				continue;
+			}
+			gdk_draw_drawable(d, gc, t->pm, area.x - tile_area.x,
+					  area.y - tile_area.y,
+					  area.x + isect->x - need.x,
+					  area.y + isect->y - need.y,
+					  area.width, area.height);
+		}
+	}
+}
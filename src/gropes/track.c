@@ -0,0 +1,353 @@
+/*
+ * Drawing the track at any scale
+ *
+ * Every point saved to the track is also fed through TRACK_LEVELS
+ * levels of detail. Level k keeps a point only if it is more than
+ * level_tolerance(k) metres from the point the level kept before it,
+ * and only points kept by level k are offered to level k + 1. A redraw
+ * uses the coarsest level whose tolerance is below a pixel, skips the
+ * chunks whose bounds miss the view, and draws each connected run of
+ * the rest with one gdk_draw_lines().
+ *
+ * Each level keeps at most TRACK_LEVEL_CHUNKS chunks, so the fine
+ * levels only reach back so far. History older than a level holds is
+ * drawn from the finest coarser level that has it.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "gropes.h"
+
+/* Tolerance of level 1 in metres, each level after it has four times
+ * that of the one before */
+#define TRACK_MIN_TOLERANCE	0.5
+/* Width of the track line */
+#define TRACK_LINE_WIDTH	5
+/* Segments are clipped this far outside the view, well within the
+ * 16-bit coordinates of the X protocol */
+#define TRACK_GUARD		1024
+
+struct track_run {
+	GdkDrawable *d;
+	GdkGC *gc;
+	GdkPoint *pts;
+	int count, alloc;
+	double x, y;	/* the previous point, unclipped */
+	unsigned int have_prev:1;
+	double min_x, min_y, max_x, max_y;
+};
+
+static double level_tolerance(int k)
+{
+	return k == 0 ? 0 : TRACK_MIN_TOLERANCE * (1 << 2 * (k - 1));
+}
+
+static int pick_level(double scale)
+{
+	int k;
+
+	for (k = TRACK_LEVELS - 1; k > 0; k--)
+		if (level_tolerance(k) <= scale)
+			break;
+	return k;
+}
+
+static void extend_bounds(struct track_chunk *c, const struct gps_mcoord *mpos)
+{
+	struct gps_marea *b = &c->bounds;
+
+	if (c->count == 0) {
+		b->start = b->end = *mpos;
+		return;
+	}
+	if (mpos->n < b->start.n)
+		b->start.n = mpos->n;
+	if (mpos->e < b->start.e)
+		b->start.e = mpos->e;
+	if (mpos->n > b->end.n)
+		b->end.n = mpos->n;
+	if (mpos->e > b->end.e)
+		b->end.e = mpos->e;
+}
+
+static int level_append(struct track_level *l, const struct gps_mcoord *mpos,
+			unsigned int seq)
+{
+	struct track_chunk *c = l->tail;
+
+	if (c == NULL || c->count == TRACK_CHUNK_POINTS) {
+		struct track_chunk *n;
+
+		n = malloc(sizeof(*n));
+		if (n == NULL)
+			return -1;
+		n->count = 0;
+		n->next = NULL;
+		if (c != NULL) {
+			extend_bounds(n, &c->pt[c->count - 1]);
+			n->pt[0] = c->pt[c->count - 1];
+			n->seq[0] = c->seq[c->count - 1];
+			n->count = 1;
+			c->next = n;
+		} else
+			l->head = n;
+		l->tail = c = n;
+		if (++l->n_chunks > TRACK_LEVEL_CHUNKS) {
+			struct track_chunk *old = l->head;
+
+			l->head = old->next;
+			l->n_chunks--;
+			free(old);
+		}
+	}
+	extend_bounds(c, mpos);
+	c->pt[c->count] = *mpos;
+	c->seq[c->count] = seq;
+	c->count++;
+
+	return 0;
+}
+
+void track_add_point(struct item_on_screen *item,
+		     const struct gps_mcoord *mpos, unsigned int seq)
+{
+	int k;
+
+	for (k = 0; k < TRACK_LEVELS; k++) {
+		struct track_level *l = &item->track_lod[k];
+
+		if (l->tail != NULL) {
+			const struct gps_mcoord *last;
+
+			last = &l->tail->pt[l->tail->count - 1];
+			if (hypot(mpos->n - last->n, mpos->e - last->e) <=
+			    level_tolerance(k))
+				break;
+		}
+		if (level_append(l, mpos, seq) < 0)
+			break;
+	}
+}
+
+void track_clear_lod(struct item_on_screen *item)
+{
+	struct track_chunk *c, *next;
+	int k;
+
+	for (k = 0; k < TRACK_LEVELS; k++) {
+		for (c = item->track_lod[k].head; c != NULL; c = next) {
+			next = c->next;
+			free(c);
+		}
+		item->track_lod[k].head = item->track_lod[k].tail = NULL;
+		item->track_lod[k].n_chunks = 0;
+	}
+}
+
+/* The part of the map the track may be seen on */
+static void get_view_bounds(struct map_state *ms, struct gps_marea *view)
+{
+	double hw, hh, cn, ce;
+
+	hw = ms->width / 2.0;
+	hh = ms->height / 2.0;
+	if (ms->rotation != 0)
+		hw = hh = hypot(hw, hh);
+	hw = (hw + TRACK_LINE_WIDTH) * ms->scale;
+	hh = (hh + TRACK_LINE_WIDTH) * ms->scale;
+	cn = (ms->marea.start.n + ms->marea.end.n) / 2;
+	ce = (ms->marea.start.e + ms->marea.end.e) / 2;
+	view->start.n = cn - hh;
+	view->start.e = ce - hw;
+	view->end.n = cn + hh;
+	view->end.e = ce + hw;
+}
+
+static int bounds_overlap(const struct gps_marea *a, const struct gps_marea *b)
+{
+	return a->start.n <= b->end.n && b->start.n <= a->end.n &&
+		a->start.e <= b->end.e && b->start.e <= a->end.e;
+}
+
+/* Liang-Barsky clipping of the segment to the guard rectangle.
+ * Returns -1 if nothing is left of it. */
+static int clip_segment(const struct track_run *r, double *x0, double *y0,
+			double *x1, double *y1)
+{
+	double dx = *x1 - *x0, dy = *y1 - *y0, t0 = 0, t1 = 1;
+	double p[4], q[4];
+	int i;
+
+	p[0] = -dx;
+	q[0] = *x0 - r->min_x;
+	p[1] = dx;
+	q[1] = r->max_x - *x0;
+	p[2] = -dy;
+	q[2] = *y0 - r->min_y;
+	p[3] = dy;
+	q[3] = r->max_y - *y0;
+	for (i = 0; i < 4; i++) {
+		double t;
+
+		if (p[i] == 0) {
+			if (q[i] < 0)
+				return -1;
+			continue;
+		}
+		t = q[i] / p[i];
+		if (p[i] < 0) {
+			if (t > t1)
+				return -1;
+			if (t > t0)
+				t0 = t;
+		} else {
+			if (t < t0)
+				return -1;
+			if (t < t1)
+				t1 = t;
+		}
+	}
+	if (t1 < 1) {
+		*x1 = *x0 + t1 * dx;
+		*y1 = *y0 + t1 * dy;
+	}
+	if (t0 > 0) {
+		*x0 += t0 * dx;
+		*y0 += t0 * dy;
+	}
+	return (t0 > 0 ? 0x01 : 0) | (t1 < 1 ? 0x02 : 0);
+}
+
+static void run_flush(struct track_run *r)
+{
+	if (r->count > 1)
+		gdk_draw_lines(r->d, r->gc, r->pts, r->count);
+	r->count = 0;
+}
+
+static void run_add(struct track_run *r, double fx, double fy)
+{
+	GdkPoint *p;
+	int x = lrint(fx), y = lrint(fy);
+
+	/* Points on the same pixel add nothing */
+	if (r->count > 0 && r->pts[r->count - 1].x == x &&
+	    r->pts[r->count - 1].y == y)
+		return;
+	if (r->count == r->alloc) {
+		int alloc = r->alloc ? 2 * r->alloc : 256;
+
+		p = realloc(r->pts, alloc * sizeof(*p));
+		if (p == NULL)
+			return;
+		r->pts = p;
+		r->alloc = alloc;
+	}
+	p = &r->pts[r->count++];
+	p->x = x;
+	p->y = y;
+}
+
+static void run_point(struct track_run *r, struct map_state *ms,
+		      const struct gps_mcoord *mpos)
+{
+	double x, y, x0, y0, x1, y1;
+	int clipped;
+
+	get_xy_unclipped(ms, mpos, &x, &y);
+	if (r->have_prev) {
+		x0 = r->x;
+		y0 = r->y;
+		x1 = x;
+		y1 = y;
+		clipped = clip_segment(r, &x0, &y0, &x1, &y1);
+		if (clipped < 0) {
+			run_flush(r);
+		} else {
+			if (r->count == 0 || (clipped & 0x01)) {
+				run_flush(r);
+				run_add(r, x0, y0);
+			}
+			run_add(r, x1, y1);
+			if (clipped & 0x02)
+				run_flush(r);
+		}
+	}
+	r->x = x;
+	r->y = y;
+	r->have_prev = 1;
+}
+
+/* Draws the points of level k that come before fix number until,
+ * starting with the older ones from a coarser level if k lacks them */
+static void draw_level(struct track_run *r, struct map_state *ms,
+		       const struct gps_marea *view,
+		       struct item_on_screen *item, int k, unsigned int until)
+{
+	struct track_level *l = &item->track_lod[k];
+	struct track_chunk *c;
+	unsigned int first;
+	int i, j;
+
+	if (l->head == NULL)
+		return;
+	first = l->head->seq[0];
+	for (j = k + 1; first > 0 && j < TRACK_LEVELS; j++) {
+		if (item->track_lod[j].head != NULL &&
+		    item->track_lod[j].head->seq[0] < first) {
+			draw_level(r, ms, view, item, j, first);
+			break;
+		}
+	}
+	for (c = l->head; c != NULL && c->seq[0] < until; c = c->next) {
+		if (!bounds_overlap(&c->bounds, view)) {
+			run_flush(r);
+			r->have_prev = 0;
+			continue;
+		}
+		for (i = 0; i < c->count && c->seq[i] < until; i++)
+			run_point(r, ms, &c->pt[i]);
+	}
+}
+
+void draw_track(struct map_state *ms, struct item_on_screen *item)
+{
+	struct track_level *l;
+	struct gps_marea view;
+	struct track_run run;
+	GdkColor color;
+
+	l = &item->track_lod[pick_level(ms->scale)];
+	if (l->head == NULL)
+		return;
+
+	memset(&run, 0, sizeof(run));
+	run.d = ms->darea->window;
+	run.gc = gdk_gc_new(GDK_DRAWABLE(run.d));
+	if (run.gc == NULL)
+		return;
+	color.red = 0xffff;
+	color.green = 0x0;
+	color.blue = 0;
+	color.pixel = 0x00ff00;
+	gdk_gc_set_foreground(run.gc, &color);
+	gdk_gc_set_line_attributes(run.gc, TRACK_LINE_WIDTH, GDK_LINE_SOLID,
+				   GDK_CAP_PROJECTING, GDK_JOIN_MITER);
+	run.min_x = run.min_y = -TRACK_GUARD;
+	run.max_x = ms->width + TRACK_GUARD;
+	run.max_y = ms->height + TRACK_GUARD;
+
+	get_view_bounds(ms, &view);
+	draw_level(&run, ms, &view, item, pick_level(ms->scale), UINT_MAX);
+
+	/* The level may lag behind the last recorded fix and the item */
+	if (!run.have_prev)
+		run_point(&run, ms, &l->tail->pt[l->tail->count - 1]);
+	run_point(&run, ms, &item->track.mpos);
+	if (item->pos_valid)
+		run_point(&run, ms, &item->mpos);
+	run_flush(&run);
+
+	free(run.pts);
+	g_object_unref(run.gc);
+}
@@ -0,0 +1,160 @@
+/*
+ * Recording the track
+ *
+ * Fixes are packed into a track_log_chunk. The first fix of a chunk is
+ * kept whole, and each one after it as the zigzag varint coded
+ * differences in latitude, longitude and time to the one before, which
+ * is five bytes or so for a fix a second. A full chunk is appended to
+ * the spill file and reused, so only one chunk is ever kept in memory.
+ *
+ * Each chunk in the spill file is a header of six little endian 32-bit
+ * words, TRACK_LOG_MAGIC, count, len, la, lo and time, followed by len
+ * bytes of coded fixes. The file is only written if spill_fname is
+ * set. Each time it is opened, once per run and again after the track
+ * is cleared, a session header of the same six words comes first,
+ * with TRACK_SESSION_MAGIC, the time it was opened and zeros.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "gropes.h"
+
+#define TRACK_LOG_MAGIC		0x4b525447	/* "GTRK" */
+#define TRACK_SESSION_MAGIC	0x53455347	/* "GSES" */
+/* The longest a coded fix can get, three 32-bit varints */
+#define TRACK_MAX_RECORD	15
+
+static int put_varint(uint8_t *p, uint32_t v)
+{
+	int n = 0;
+
+	while (v >= 0x80) {
+		p[n++] = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	p[n++] = v;
+
+	return n;
+}
+
+static uint32_t zigzag(int32_t v)
+{
+	return ((uint32_t) v << 1) ^ (uint32_t) (v >> 31);
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static int write_header(FILE *f, uint32_t magic, uint32_t count,
+			uint32_t len, int32_t la, int32_t lo, uint32_t time)
+{
+	uint8_t hdr[24];
+
+	put_le32(hdr, magic);
+	put_le32(hdr + 4, count);
+	put_le32(hdr + 8, len);
+	put_le32(hdr + 12, la);
+	put_le32(hdr + 16, lo);
+	put_le32(hdr + 20, time);
+
+	return fwrite(hdr, sizeof(hdr), 1, f) == 1 ? 0 : -1;
+}
+
+static int spill_chunk(struct item_track *t)
+{
+	struct track_log_chunk *c = t->chunk;
+
+	if (c->count == 0)
+		return 0;
+	if (t->spill == NULL) {
+		if (t->spill_fname == NULL)
+			return 0;
+		t->spill = fopen(t->spill_fname, "ab");
+		if (t->spill == NULL) {
+			fprintf(stderr, "Unable to open %s: %s\n",
+				t->spill_fname, strerror(errno));
+			return -1;
+		}
+		if (write_header(t->spill, TRACK_SESSION_MAGIC, 0, 0, 0, 0,
+				 time(NULL)) < 0) {
+			/* Try again with the next chunk */
+			fclose(t->spill);
+			t->spill = NULL;
+			goto fail;
+		}
+	}
+	if (write_header(t->spill, TRACK_LOG_MAGIC, c->count, c->len, c->la,
+			 c->lo, c->time) < 0 ||
+	    (c->len && fwrite(c->data, c->len, 1, t->spill) != 1) ||
+	    fflush(t->spill) != 0)
+		goto fail;
+	return 0;
+fail:
+	fprintf(stderr, "Unable to write %s\n", t->spill_fname);
+	return -1;
+}
+
+int track_log_add(struct item_track *t, const struct gps_coord *pos,
+		  const struct gps_mcoord *mpos, uint32_t time)
+{
+	struct track_log_chunk *c = t->chunk;
+	int32_t la, lo;
+
+	la = lrint(pos->la * 1e7);
+	lo = lrint(pos->lo * 1e7);
+	if (c == NULL) {
+		c = malloc(sizeof(*c));
+		if (c == NULL)
+			return -ENOMEM;
+		c->count = 0;
+		t->chunk = c;
+	} else if (c->len + TRACK_MAX_RECORD > TRACK_LOG_BYTES) {
+		/* The chunk is gone from memory whether or not it got
+		 * written */
+		spill_chunk(t);
+		c->count = 0;
+	}
+	if (c->count == 0) {
+		c->la = la;
+		c->lo = lo;
+		c->time = time;
+		c->len = 0;
+	} else {
+		/* Differences wrap around, as across the date line */
+		c->len += put_varint(c->data + c->len,
+				     zigzag((uint32_t) la - (uint32_t) t->la));
+		c->len += put_varint(c->data + c->len,
+				     zigzag((uint32_t) lo - (uint32_t) t->lo));
+		c->len += put_varint(c->data + c->len, time - t->time);
+	}
+	c->count++;
+
+	t->la = la;
+	t->lo = lo;
+	t->time = time;
+	t->mpos = *mpos;
+	t->count++;
+
+	return 0;
+}
+
+/* Writes out what is left of the track and starts a new one */
+void track_log_close(struct item_track *t)
+{
+	if (t->chunk != NULL) {
+		spill_chunk(t);
+		free(t->chunk);
+		t->chunk = NULL;
+	}
+	if (t->spill != NULL) {
+		fclose(t->spill);
+		t->spill = NULL;
+	}
+	t->count = 0;
+}
@@ -7,12 +7,56 @@
 #define DEFAULT_WIDTH		800
 #define DEFAULT_HEIGHT		480
 
+/* Turns a displacement on a track-up screen into one on the north-up
+ * map */
+static void unrotate(const struct map_state *ms, double *dx, double *dy)
+{
+	double c = cos(ms->rotation), s = sin(ms->rotation), x = *dx;
+
+	*dx = c * x - s * *dy;
+	*dy = s * x + c * *dy;
+}
+
+/* Screen position of mpos, which may be off the screen */
+void get_xy_unclipped(struct map_state *ms, const struct gps_mcoord *mpos,
+		      double *x_out, double *y_out)
+{
+	double c = cos(ms->rotation), s = sin(ms->rotation), px, py;
+
+	px = (mpos->e - ms->marea.start.e) / ms->scale - ms->width / 2.0;
+	py = (ms->marea.end.n - mpos->n) / ms->scale - ms->height / 2.0;
+	*x_out = ms->width / 2.0 + c * px + s * py;
+	*y_out = ms->height / 2.0 - s * px + c * py;
+}
+
+static int get_xy_on_rotated_screen(struct map_state *ms,
+				    const struct gps_mcoord *mpos,
+				    int *x_out, int *y_out)
+{
+	double fx, fy;
+	int x, y;
+
+	get_xy_unclipped(ms, mpos, &fx, &fy);
+	x = floor(fx);
+	y = floor(fy);
+	if (x < 0 || y < 0 || x >= ms->width || y >= ms->height)
+		return -1;
+
+	*x_out = x;
+	*y_out = y;
+
+	return 0;
+}
+
 int get_xy_on_screen(struct map_state *ms, const struct gps_mcoord *mpos,
 			    int *x_out, int *y_out)
 {
 	struct gps_marea *marea;
 	int x, y;
 
+	if (ms->rotation != 0)
+		return get_xy_on_rotated_screen(ms, mpos, x_out, y_out);
+
 	marea = &ms->marea;
 
 	if (mpos->n < marea->start.n || mpos->n >= marea->end.n)
@@ -59,10 +103,12 @@ static void scroll_map(struct gropes_state *gs, struct map_state *ms,
 			int diff_x, int diff_y, double new_scale)
 {
 	struct gps_mcoord mcent;
+	double dx = diff_x, dy = diff_y;
 
+	unrotate(ms, &dx, &dy);
 	mcent = ms->center_mpos;
-	mcent.n -= diff_y * ms->scale;
-	mcent.e += diff_x * ms->scale;
+	mcent.n -= dy * ms->scale;
+	mcent.e += dx * ms->scale;
 	change_map_center(gs, ms, &mcent, new_scale);
 }
 
@@ -80,6 +126,14 @@ gboolean on_darea_clicked(GtkWidget *widget,
 	gropes_state.opt_follow_gps = 0;
 	gtk_toggle_action_set_active(GTK_TOGGLE_ACTION(action), FALSE);
 
+	if (event->button == 1) {
+		/* Drag the map with the pointer */
+		map_state->dragging = 1;
+		map_state->drag_x = event->x;
+		map_state->drag_y = event->y;
+		return TRUE;
+	}
+
 	diff_x = event->x - widget->allocation.width / 2;
 	diff_y = event->y - widget->allocation.height / 2;
 //	printf("Click %dx%d!\n", diff_x, diff_y);
@@ -95,23 +149,48 @@ gboolean on_darea_clicked(GtkWidget *widget,
 	return TRUE;
 }
 
+gboolean on_darea_released(GtkWidget *widget,
+			   GdkEventButton *event,
+			   gpointer user_data)
+{
+	struct map_state *ms = user_data;
+
+	if (event->button == 1)
+		ms->dragging = 0;
+
+	return TRUE;
+}
+
 gboolean on_pointer_motion(GtkWidget *widget,
 				  GdkEventMotion *event,
 				  gpointer user_data)
 {
 	struct map_state *ms = user_data;
 	int diff_x, diff_y;
+	double dx, dy;
 	struct gps_mcoord mpoint;
 	struct gps_coord point;
 	char pointer_loc[128], *pos;
 
-	diff_x = event->x - widget->allocation.width / 2;
-	diff_y = event->y - widget->allocation.height / 2;
+	if (ms->dragging && (event->state & GDK_BUTTON1_MASK)) {
+		diff_x = event->x - ms->drag_x;
+		diff_y = event->y - ms->drag_y;
+		if (diff_x != 0 || diff_y != 0) {
+			ms->drag_x = event->x;
+			ms->drag_y = event->y;
+			scroll_map(&gropes_state, ms, -diff_x, -diff_y,
+				   ms->scale);
+		}
+	}
+
+	dx = event->x - widget->allocation.width / 2;
+	dy = event->y - widget->allocation.height / 2;
+	unrotate(ms, &dx, &dy);
 	mpoint = ms->center_mpos;
-	mpoint.n -= diff_y * ms->scale;
-	mpoint.e += diff_x * ms->scale;
+	mpoint.n -= dy * ms->scale;
+	mpoint.e += dx * ms->scale;
 
-	gpsnav_get_coord_for_metric(ms->ref_map, &mpoint, &point);
+	gpsnav_get_coord_for_metric_interp(ms->ref_map, &mpoint, &point);
 
 	pos = fmt_location(&point);
 	sprintf(pointer_loc, "<span size=\"large\">%s</span>", pos);
@@ -237,6 +316,28 @@ void on_gps_follow(GtkToggleAction *action, struct gropes_state *gs)
 		change_map_center(gs, ms, &ms->me.mpos, ms->scale);
 }
 
+void on_track_up(GtkToggleAction *action, struct gropes_state *gs)
+{
+	struct map_state *ms = &gs->big_map;
+
+	gs->opt_track_up = gtk_toggle_action_get_active(action);
+	ms->rotation = 0;
+	if (gs->opt_track_up && ms->me.pos_valid &&
+	    ms->me.speed.speed >= TRACK_UP_MIN_SPEED)
+		ms->rotation = ms->me.speed.track * M_PI / 180;
+	/* The layout margin depends on the mode */
+	change_map_center(gs, ms, &ms->center_mpos, ms->scale);
+}
+
+void on_smooth_rotation(GtkToggleAction *action, struct gropes_state *gs)
+{
+	struct map_state *ms = &gs->big_map;
+
+	gs->opt_smooth_rotation = gtk_toggle_action_get_active(action);
+	ms->rot_valid = 0;
+	gtk_widget_queue_draw(ms->darea);
+}
+
 void on_clear_track(GtkAction *action, struct gropes_state *gs)
 {
 	struct map_state *ms = &gs->big_map;
@@ -274,11 +375,14 @@ GtkWidget *create_big_map_darea(struct gropes_state *state)
 			   GTK_SIGNAL_FUNC(on_darea_configure), &state->big_map);
 	gtk_signal_connect(GTK_OBJECT(darea), "button-press-event",
 			   GTK_SIGNAL_FUNC(on_darea_clicked), &state->big_map);
+	gtk_signal_connect(GTK_OBJECT(darea), "button-release-event",
+			   GTK_SIGNAL_FUNC(on_darea_released), &state->big_map);
 	gtk_signal_connect(GTK_OBJECT(darea), "motion-notify-event",
 			   GTK_SIGNAL_FUNC(on_pointer_motion), &state->big_map);
 
 	gtk_widget_set_events(darea, GDK_EXPOSURE_MASK | GDK_PROPERTY_CHANGE_MASK |
-			      GDK_BUTTON_PRESS_MASK | GDK_KEY_PRESS_MASK |
+			      GDK_BUTTON_PRESS_MASK | GDK_BUTTON_RELEASE_MASK |
+			      GDK_KEY_PRESS_MASK |
 			      GDK_POINTER_MOTION_MASK);
 
 	ms->darea = darea;
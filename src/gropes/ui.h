@@ -21,10 +21,15 @@ struct ui_info_area {
 
 int get_xy_on_screen(struct map_state *ms, const struct gps_mcoord *mpos,
 			    int *x_out, int *y_out);
+void get_xy_unclipped(struct map_state *ms, const struct gps_mcoord *mpos,
+		      double *x_out, double *y_out);
 char *fmt_location(const struct gps_coord *coord);
 gboolean on_darea_clicked(GtkWidget *widget,
 			  GdkEventButton *event,
 			  gpointer user_data);
+gboolean on_darea_released(GtkWidget *widget,
+			   GdkEventButton *event,
+			   gpointer user_data);
 gboolean on_pointer_motion(GtkWidget *widget,
 			  GdkEventMotion *event,
 			  gpointer user_data);
@@ -43,6 +48,8 @@ void on_scroll(GtkAction *action, struct gropes_state *gs);
 void on_gps_connect(GtkAction *action, struct gropes_state *gs);
 void on_gps_disconnect(GtkAction *action, struct gropes_state *gs);
 void on_gps_follow(GtkToggleAction *action, struct gropes_state *gs);
+void on_track_up(GtkToggleAction *action, struct gropes_state *gs);
+void on_smooth_rotation(GtkToggleAction *action, struct gropes_state *gs);
 void on_clear_track(GtkAction *action, struct gropes_state *gs);
 void on_draw_track(GtkToggleAction *action, struct gropes_state *gs);
 void on_menu_exit(GtkAction *action, struct gropes_state *gs);
@@ -58,6 +58,8 @@ static const GtkRadioActionEntry mode_entries[] = {
 static const GtkToggleActionEntry toggle_entries[] = {
 	{ "GPSFollow",	NULL,   "_Follow",    "F", "Center map automatically to GPS location", G_CALLBACK(on_gps_follow), FALSE },
 	{ "TrackDraw",	NULL,   "_DrawTrack", "T", "Draw track", G_CALLBACK(on_draw_track), FALSE },
+	{ "TrackUp",	NULL,   "_Track Up",  "U", "Turn the map to the direction of travel", G_CALLBACK(on_track_up), FALSE },
+	{ "SmoothRotation", NULL, "_Smooth Rotation", NULL, "Filter the turned map", G_CALLBACK(on_smooth_rotation), FALSE },
 };
 
 static const char *ui_description =
@@ -80,6 +82,9 @@ static const char *ui_description =
 "      <menuitem action='ZoomIn'/>"
 "      <menuitem action='ZoomOut'/>"
 "      <separator/>"
+"      <menuitem action='TrackUp'/>"
+"      <menuitem action='SmoothRotation'/>"
+"      <separator/>"
 "      <menuitem action='ScrollUp'/>"
 "      <menuitem action='ScrollDown'/>"
 "      <menuitem action='ScrollLeft'/>"
@@ -74,6 +74,8 @@ static const GtkToggleActionEntry toggle_entries[] = {
 	{ "GPSFollow",	NULL,	"_Follow", "F", "Center map automatically to GPS location", G_CALLBACK(on_gps_follow), FALSE },
 	{ "FullScreen", NULL,	"Full Screen", "F6", "Full screen", G_CALLBACK(on_hildon_fullscreen), FALSE },
 	{ "TrackDraw",	NULL,   "_DrawTrack", "T", "Draw track", G_CALLBACK(on_draw_track), FALSE },
+	{ "TrackUp",	NULL,   "_Track Up",  "U", "Turn the map to the direction of travel", G_CALLBACK(on_track_up), FALSE },
+	{ "SmoothRotation", NULL, "_Smooth Rotation", NULL, "Filter the turned map", G_CALLBACK(on_smooth_rotation), FALSE },
 };
 
 static const char *ui_description =
@@ -96,6 +98,9 @@ static const char *ui_description =
 "      <menuitem action='ZoomIn'/>"
 "      <menuitem action='ZoomOut'/>"
 "      <separator/>"
+"      <menuitem action='TrackUp'/>"
+"      <menuitem action='SmoothRotation'/>"
+"      <separator/>"
 "      <menuitem action='ScrollUp'/>"
 "      <menuitem action='ScrollDown'/>"
 "      <menuitem action='ScrollLeft'/>"
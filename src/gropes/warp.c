@@ -0,0 +1,310 @@
+/*
+ * Drawing maps whose projection differs from the reference map's
+ *
+ * The view is split into WARP_TILE_SIZE tiles aligned to the view's
+ * pixel grid, so that panning at a fixed scale keeps hitting the same
+ * tiles. For each tile, the corners of a mesh of WARP_CELL_SIZE cells
+ * are projected exactly from the view projection to map pixels; inside
+ * a cell the map pixel positions are interpolated bilinearly, stepping
+ * in 16.16 fixed point. Warped tiles are kept in an LRU cache of
+ * wt_max_size bytes.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "gropes.h"
+
+#define WARP_TILE_SIZE	128
+#define WARP_CELL_SIZE	16
+#define WARP_MESH_SIZE	(WARP_TILE_SIZE / WARP_CELL_SIZE + 1)
+
+/* Largest source coordinate the fixed point stepping can hold */
+#define WARP_MAX_COORD	32000.0
+
+struct warp_tile {
+	struct gps_map *map, *ref_map;
+	double scale;
+	long tx, ty;
+	GdkPixbuf *pb;		/* NULL if the map does not reach the tile */
+	unsigned int size;
+
+	struct warp_tile *next, *prev;
+};
+
+static void add_warp_tile(struct gropes_state *gs, struct warp_tile *t)
+{
+	t->prev = NULL;
+	t->next = gs->wt_head;
+	if (gs->wt_head == NULL)
+		gs->wt_tail = t;
+	else
+		gs->wt_head->prev = t;
+	gs->wt_head = t;
+	gs->wt_cur_size += t->size;
+}
+
+static void remove_warp_tile(struct gropes_state *gs, struct warp_tile *t)
+{
+	if (t->prev != NULL)
+		t->prev->next = t->next;
+	else
+		gs->wt_head = t->next;
+	if (t->next != NULL)
+		t->next->prev = t->prev;
+	else
+		gs->wt_tail = t->prev;
+	gs->wt_cur_size -= t->size;
+}
+
+static void free_warp_tile(struct warp_tile *t)
+{
+	if (t->pb != NULL)
+		g_object_unref(t->pb);
+	free(t);
+}
+
+void purge_warp_cache(struct gropes_state *gs)
+{
+	struct warp_tile *t;
+
+	while ((t = gs->wt_head) != NULL) {
+		remove_warp_tile(gs, t);
+		free_warp_tile(t);
+	}
+}
+
+/* Resamples one mesh cell. c[] holds the map pixel coordinates of the
+ * cell corners in the order top-left, top-right, bottom-left,
+ * bottom-right, relative to the source buffer. */
+static void warp_cell(const struct gps_pixel_buf *src, const double (*c)[2],
+		      guchar *dst, int dst_stride)
+{
+	int x, y;
+
+	for (y = 0; y < WARP_CELL_SIZE; y++) {
+		double fy = (y + 0.5) / WARP_CELL_SIZE;
+		double lx, ly, rx, ry;
+		int sx, sy, dx, dy;
+		guchar *d = dst + y * dst_stride;
+
+		lx = c[0][0] + (c[2][0] - c[0][0]) * fy;
+		ly = c[0][1] + (c[2][1] - c[0][1]) * fy;
+		rx = c[1][0] + (c[3][0] - c[1][0]) * fy;
+		ry = c[1][1] + (c[3][1] - c[1][1]) * fy;
+		dx = (rx - lx) * 65536 / WARP_CELL_SIZE;
+		dy = (ry - ly) * 65536 / WARP_CELL_SIZE;
+		sx = lx * 65536 + dx / 2;
+		sy = ly * 65536 + dy / 2;
+		for (x = 0; x < WARP_CELL_SIZE; x++, d += 4) {
+			int ix = sx >> 16, iy = sy >> 16;
+
+			if (ix >= 0 && iy >= 0 &&
+			    ix < src->width && iy < src->height) {
+				const uint8_t *s = src->data +
+					iy * src->row_stride + ix * 3;
+
+				d[0] = s[0];
+				d[1] = s[1];
+				d[2] = s[2];
+				d[3] = 0xff;
+			} else
+				d[3] = 0;
+			sx += dx;
+			sy += dy;
+		}
+	}
+}
+
+static int create_warp_tile(struct gpsnav *nav, struct warp_tile *t)
+{
+	double n[WARP_MESH_SIZE * WARP_MESH_SIZE];
+	double e[WARP_MESH_SIZE * WARP_MESH_SIZE];
+	double la[WARP_MESH_SIZE * WARP_MESH_SIZE];
+	double lo[WARP_MESH_SIZE * WARP_MESH_SIZE];
+	double min_x, min_y, max_x, max_y;
+	struct gps_map *map = t->map;
+	struct gps_pixel_buf pb;
+	guchar *pixels;
+	int i, j, stride;
+
+	for (j = 0; j < WARP_MESH_SIZE; j++) {
+		for (i = 0; i < WARP_MESH_SIZE; i++) {
+			e[j * WARP_MESH_SIZE + i] = t->scale *
+				(t->tx * WARP_TILE_SIZE + i * WARP_CELL_SIZE);
+			n[j * WARP_MESH_SIZE + i] = -t->scale *
+				(t->ty * WARP_TILE_SIZE + j * WARP_CELL_SIZE);
+		}
+	}
+	gpsnav_get_coords_for_metric(t->ref_map, WARP_MESH_SIZE * WARP_MESH_SIZE,
+				     n, e, sizeof(double), la, lo,
+				     sizeof(double));
+	gpsnav_get_metric_for_coords(map, WARP_MESH_SIZE * WARP_MESH_SIZE,
+				     la, lo, sizeof(double), n, e,
+				     sizeof(double));
+
+	/* Mesh nodes as map pixel coordinates, in e[] and n[] */
+	min_x = min_y = HUGE_VAL;
+	max_x = max_y = -HUGE_VAL;
+	for (i = 0; i < WARP_MESH_SIZE * WARP_MESH_SIZE; i++) {
+		e[i] = (e[i] - map->marea.start.e) / map->scale_x;
+		n[i] = map->height - (n[i] - map->marea.start.n) / map->scale_y;
+		if (!isfinite(e[i]) || !isfinite(n[i]))
+			return 0;
+		if (e[i] < min_x)
+			min_x = e[i];
+		if (e[i] > max_x)
+			max_x = e[i];
+		if (n[i] < min_y)
+			min_y = n[i];
+		if (n[i] > max_y)
+			max_y = n[i];
+	}
+	min_x = floor(min_x) > 0 ? floor(min_x) : 0;
+	min_y = floor(min_y) > 0 ? floor(min_y) : 0;
+	max_x = ceil(max_x) < map->width ? ceil(max_x) : map->width;
+	max_y = ceil(max_y) < map->height ? ceil(max_y) : map->height;
+	if (max_x <= min_x || max_y <= min_y)
+		return 0;
+
+	memset(&pb, 0, sizeof(pb));
+	pb.x = min_x;
+	pb.y = min_y;
+	pb.width = max_x - min_x;
+	pb.height = max_y - min_y;
+	pb.bpp = 24;
+	pb.row_stride = pb.width * 3;
+	if (gpsnav_get_map_pixels(nav, map, &pb) < 0) {
+		fprintf(stderr, "gpsnav_get_map_pixels() failed\n");
+		return -1;
+	}
+
+	t->pb = gdk_pixbuf_new(GDK_COLORSPACE_RGB, TRUE, 8, WARP_TILE_SIZE,
+			       WARP_TILE_SIZE);
+	if (t->pb == NULL) {
+		if (pb.can_free)
+			free(pb.data);
+		return -1;
+	}
+	gdk_pixbuf_fill(t->pb, 0);
+	pixels = gdk_pixbuf_get_pixels(t->pb);
+	stride = gdk_pixbuf_get_rowstride(t->pb);
+	for (j = 0; j < WARP_MESH_SIZE - 1; j++) {
+		for (i = 0; i < WARP_MESH_SIZE - 1; i++) {
+			double c[4][2];
+			int k = j * WARP_MESH_SIZE + i, l;
+
+			c[0][0] = e[k] - pb.x;
+			c[0][1] = n[k] - pb.y;
+			c[1][0] = e[k + 1] - pb.x;
+			c[1][1] = n[k + 1] - pb.y;
+			c[2][0] = e[k + WARP_MESH_SIZE] - pb.x;
+			c[2][1] = n[k + WARP_MESH_SIZE] - pb.y;
+			c[3][0] = e[k + WARP_MESH_SIZE + 1] - pb.x;
+			c[3][1] = n[k + WARP_MESH_SIZE + 1] - pb.y;
+			for (l = 0; l < 4; l++)
+				if (fabs(c[l][0]) > WARP_MAX_COORD ||
+				    fabs(c[l][1]) > WARP_MAX_COORD)
+					break;
+			if (l < 4)
+				continue;
+			warp_cell(&pb, (const double (*)[2]) c,
+				  pixels + j * WARP_CELL_SIZE * stride +
+				  i * WARP_CELL_SIZE * 4, stride);
+		}
+	}
+	if (pb.can_free)
+		free(pb.data);
+	t->size += WARP_TILE_SIZE * WARP_TILE_SIZE * 4;
+
+	return 0;
+}
+
+static struct warp_tile *get_warp_tile(struct gropes_state *gs,
+				       struct gps_map *map,
+				       struct gps_map *ref_map, double scale,
+				       long tx, long ty)
+{
+	struct warp_tile *t;
+	int r;
+
+	for (t = gs->wt_head; t != NULL; t = t->next) {
+		if (t->map == map && t->ref_map == ref_map &&
+		    t->scale == scale && t->tx == tx && t->ty == ty) {
+			if (t != gs->wt_head) {
+				remove_warp_tile(gs, t);
+				add_warp_tile(gs, t);
+			}
+			return t;
+		}
+	}
+
+	t = malloc(sizeof(*t));
+	if (t == NULL)
+		return NULL;
+	memset(t, 0, sizeof(*t));
+	t->map = map;
+	t->ref_map = ref_map;
+	t->scale = scale;
+	t->tx = tx;
+	t->ty = ty;
+	t->size = sizeof(*t);
+	pthread_mutex_lock(&gs->pixels_lock);
+	r = create_warp_tile(gs->nav, t);
+	pthread_mutex_unlock(&gs->pixels_lock);
+	if (r < 0) {
+		free_warp_tile(t);
+		return NULL;
+	}
+	while (gs->wt_tail != NULL &&
+	       gs->wt_cur_size + t->size > gs->wt_max_size) {
+		struct warp_tile *old = gs->wt_tail;
+
+		remove_warp_tile(gs, old);
+		free_warp_tile(old);
+	}
+	add_warp_tile(gs, t);
+
+	return t;
+}
+
+static long floor_div(long a, long b)
+{
+	return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+void draw_single_map_warped(struct gropes_state *gs,
+			    const struct layout_view *lv,
+			    struct draw_target *target, struct map_on_screen *mos,
+			    const GdkRectangle *isect)
+{
+	long ox, oy, tx, ty;
+
+	/* Layout position of the view's pixel grid origin */
+	ox = lrint(lv->marea.start.e / lv->scale);
+	oy = lrint(-lv->marea.end.n / lv->scale);
+	for (ty = floor_div(isect->y + oy, WARP_TILE_SIZE);
+	     ty <= floor_div(isect->y + isect->height - 1 + oy, WARP_TILE_SIZE);
+	     ty++) {
+		for (tx = floor_div(isect->x + ox, WARP_TILE_SIZE);
+		     tx <= floor_div(isect->x + isect->width - 1 + ox,
+				     WARP_TILE_SIZE);
+		     tx++) {
+			GdkRectangle tile_area, area;
+			struct warp_tile *t;
+
+			tile_area.x = tx * WARP_TILE_SIZE - ox;
+			tile_area.y = ty * WARP_TILE_SIZE - oy;
+			tile_area.width = tile_area.height = WARP_TILE_SIZE;
+			if (!gdk_rectangle_intersect(&tile_area,
+						     (GdkRectangle *) isect,
+						     &area))
+				continue;
+			t = get_warp_tile(gs, mos->map, lv->ref_map,
+					  lv->scale, tx, ty);
+			if (t == NULL || t->pb == NULL)
+				continue;
+			target_draw_pixbuf(target, t->pb, area.x - tile_area.x,
+					   area.y - tile_area.y, &area);
+		}
+	}
+}
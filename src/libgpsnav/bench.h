@@ -0,0 +1,27 @@
+#ifndef GPSNAV_BENCH_H
+#define GPSNAV_BENCH_H
+
+/* Helpers shared by the benchmark programs */
+
+#include <stdio.h>
+#include <time.h>
+
+static inline double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Returns 1 and complains if value is above limit, or NaN, so that
+ * make check catches accuracy regressions */
+static inline int bench_limit(const char *what, double value, double limit)
+{
+	if (value <= limit)
+		return 0;
+	printf("FAIL: %s %g is above the limit of %g\n", what, value, limit);
+	return 1;
+}
+
+#endif
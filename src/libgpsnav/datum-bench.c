@@ -0,0 +1,225 @@
+/*
+ * Datum transformation benchmark: the precomputed ECEF transform
+ * against the per-point Molodensky-style code it replaced.
+ *
+ * Usage: gpsnav-datum-bench [datum name] [points] [rounds]
+ *
+ * Run by make check, which fails if an error is over its limit.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include <gpsnav/gpsnav.h>
+#include <gpsnav/coord.h>
+
+#include "bench.h"
+
+static const double wgs84_a	= 6378137.0;
+static const double wgs84_invf	= 298.257223563;
+
+/* The previous implementation, kept for comparison */
+static void molod_translate(struct gps_coord *coord,
+			    const struct gps_datum *other_d, int from_wgs84)
+{
+	double phi, lambda;
+	double a0, b0, es0, f0;
+	double es1, f1;
+	double psi, psi1;
+	double x, y, z;
+	double dx, dy, dz, a, f;
+
+	dx = other_d->dx;
+	dy = other_d->dy;
+	dz = other_d->dz;
+	a = other_d->ellipsoid->a;
+	f = 1.0 / other_d->ellipsoid->invf;
+
+	phi = coord->la * M_PI / 180.0;
+	lambda = coord->lo * M_PI / 180.0;
+
+	if (from_wgs84) {
+		a0 = wgs84_a;
+		f0 = 1.0 / wgs84_invf;
+		f1 = f;
+	} else {
+		a0 = a;
+		f0 = f;
+		f1 = 1.0 / wgs84_invf;
+		dx = -dx;
+		dy = -dy;
+		dz = -dz;
+	}
+
+	b0 = a0 * (1 - f0);
+	es0 = 2 * f0 - f0*f0;
+	es1 = 2 * f1 - f1*f1;
+
+	if (coord->la == 0.0 || coord->la == 90.0 || coord->la == -90.0)
+		psi = phi;
+	else
+		psi = atan((1 - es0) * tan(phi));
+
+	if (coord->lo == 90.0 || coord->lo == -90.0) {
+		x = 0.0;
+		y = fabs(a0 * b0 / sqrt(b0*b0 + a0*a0 * pow(tan(psi), 2.0)));
+	} else {
+		x = fabs((a0 * b0) /
+			 sqrt((1 + pow(tan(lambda), 2.0)) *
+			      (b0*b0 + a0*a0 * pow(tan(psi), 2.0))));
+		y = fabs(x * tan(lambda));
+	}
+
+	if (coord->lo < -90.0 || coord->lo > 90.0)
+		x = -x;
+	if (coord->lo < 0.0)
+		y = -y;
+
+	if (coord->la == 90.0)
+		z = b0;
+	else if (coord->la == -90.0)
+		z = -b0;
+	else
+		z = tan(psi) * sqrt((a0*a0 * b0*b0) / (b0*b0 + a0*a0 * pow(tan(psi), 2.0)));
+
+	psi1 = atan((z - dz) / sqrt((x - dx)*(x - dx) + (y - dy)*(y - dy)));
+	coord->la = atan(tan(psi1) / (1 - es1)) * 180.0 / M_PI;
+	coord->lo = atan((y - dy) / (x - dx)) * 180.0 / M_PI;
+	if (x-dx < 0.0) {
+		if (y-dy > 0.0)
+			coord->lo += 180.0;
+		else
+			coord->lo -= 180.0;
+	}
+}
+
+/* Reference result: the same ECEF shift, inverted by iterating the
+ * latitude to convergence */
+static void exact_translate(struct gps_coord *coord,
+			    const struct gps_datum *dtm)
+{
+	double a0, es0, f, phi, lam, nu, x, y, z, p, h;
+	int i;
+
+	a0 = wgs84_a;
+	f = 1.0 / wgs84_invf;
+	es0 = 2 * f - f * f;
+	phi = coord->la * M_PI / 180.0;
+	lam = coord->lo * M_PI / 180.0;
+	nu = a0 / sqrt(1 - es0 * sin(phi) * sin(phi));
+	x = nu * cos(phi) * cos(lam) - dtm->dx;
+	y = nu * cos(phi) * sin(lam) - dtm->dy;
+	z = nu * (1 - es0) * sin(phi) - dtm->dz;
+
+	f = 1.0 / dtm->ellipsoid->invf;
+	es0 = 2 * f - f * f;
+	a0 = dtm->ellipsoid->a;
+	p = sqrt(x * x + y * y);
+	phi = atan2(z, p * (1 - es0));
+	h = 0;
+	for (i = 0; i < 20; i++) {
+		nu = a0 / sqrt(1 - es0 * sin(phi) * sin(phi));
+		h = p / cos(phi) - nu;
+		phi = atan2(z, p * (1 - es0 * nu / (nu + h)));
+	}
+	coord->la = phi * 180.0 / M_PI;
+	coord->lo = atan2(y, x) * 180.0 / M_PI;
+}
+
+/* Ground distance of a small lat/lon difference, in meters */
+static double distance(const struct gps_coord *c1, const struct gps_coord *c2)
+{
+	double dn, de;
+
+	dn = (c1->la - c2->la) * M_PI / 180.0 * wgs84_a;
+	de = (c1->lo - c2->lo) * M_PI / 180.0 * wgs84_a *
+		cos(c1->la * M_PI / 180.0);
+	return sqrt(dn * dn + de * de);
+}
+
+int main(int argc, char *argv[])
+{
+	const struct gps_datum *dtm;
+	struct gps_datum_transform xf;
+	struct gps_coord *in, *out, c;
+	const char *name;
+	int i, r, points, rounds;
+	double start, t_old, t_new, err, max_old, max_new;
+	volatile double sink = 0;
+
+	name = argc > 1 ? argv[1] : "European 1950";
+	points = argc > 2 ? atoi(argv[2]) : 10000;
+	rounds = argc > 3 ? atoi(argv[3]) : 100;
+
+	dtm = gpsnav_find_datum(NULL, name);
+	if (dtm == NULL) {
+		fprintf(stderr, "Unknown datum '%s'\n", name);
+		return 1;
+	}
+	if (dtm - gps_datum_table == 1) {
+		fprintf(stderr, "'%s' uses a polynomial fit, not a shift\n",
+			name);
+		return 1;
+	}
+	in = malloc(points * sizeof(*in));
+	out = malloc(points * sizeof(*out));
+	if (in == NULL || out == NULL)
+		return 1;
+	srand(1);
+	for (i = 0; i < points; i++) {
+		in[i].la = (rand() % 170000) / 1000.0 - 85.0;
+		in[i].lo = (rand() % 360000) / 1000.0 - 180.0;
+	}
+
+	gpsnav_init_datum_transform(&xf, NULL, dtm);
+	max_old = max_new = 0;
+	for (i = 0; i < points; i++) {
+		struct gps_coord ref = in[i];
+
+		exact_translate(&ref, dtm);
+		c = in[i];
+		molod_translate(&c, dtm, 1);
+		err = distance(&ref, &c);
+		if (err > max_old)
+			max_old = err;
+		c = in[i];
+		gpsnav_transform_datum(&xf, 1, &c.la, &c.lo, 0);
+		err = distance(&ref, &c);
+		if (err > max_new)
+			max_new = err;
+	}
+	printf("WGS 84 -> %s, %d points\n", dtm->name, points);
+	printf("max error: old %.3f mm, new %.3f mm\n",
+	       max_old * 1e3, max_new * 1e3);
+
+	start = now();
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < points; i++) {
+			c = in[i];
+			molod_translate(&c, dtm, 1);
+			sink += c.la;
+		}
+	}
+	t_old = now() - start;
+
+	start = now();
+	for (r = 0; r < rounds; r++) {
+		memcpy(out, in, points * sizeof(*out));
+		gpsnav_transform_datum(&xf, points, &out[0].la, &out[0].lo,
+				       sizeof(out[0]));
+		sink += out[points - 1].la;
+	}
+	t_new = now() - start;
+
+	printf("old: %.1f ns/point, new batch: %.1f ns/point (%.2fx)\n",
+	       t_old * 1e9 / ((double) points * rounds),
+	       t_new * 1e9 / ((double) points * rounds), t_old / t_new);
+
+	free(in);
+	free(out);
+
+	/* The batch transform is the exact shift, in meters */
+	return bench_limit("batch transform error", max_new, 0.001);
+}
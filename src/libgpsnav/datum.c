@@ -183,96 +183,6 @@ const struct gps_datum gps_datum_table[] = {
 static const double wgs84_a	= 6378137.0;		/* WGS84 semimajor axis */
 static const double wgs84_invf	= 298.257223563;	/* WGS84 1/f */
 
-static void molod_translate(struct gps_coord *coord,
-			    const struct gps_datum *other_d, int from_wgs84)
-{
-	double phi;
-	double lambda;
-	double a0, b0, es0, f0;               /* Reference ellipsoid of input data */
-	double a1, b1, es1, f1;              /* Reference ellipsoid of output data */
-	double psi;                                         /* geocentric latitude */
-	double x, y, z;           /* 3D coordinates with respect to original datum */
-	double psi1;                            /* transformed geocentric latitude */
-	double dx, dy, dz, a, f;
-
-	dx = other_d->dx;
-	dy = other_d->dy;
-	dz = other_d->dz;
-	a = other_d->ellipsoid->a;
-	f = 1.0 / other_d->ellipsoid->invf;
-
-	phi = coord->la * M_PI / 180.0;
-	lambda = coord->lo * M_PI / 180.0;
-
-	if (from_wgs84) {	       /* convert from WGS84 to new datum */
-		a0 = wgs84_a;	       /* WGS84 semimajor axis */
-		f0 = 1.0 / wgs84_invf; /* WGS84 flattening */
-		a1 = a;
-		f1 = f;
-	} else {                       /* convert from datum to WGS84 */
-		a0 = a;                /* semimajor axis */
-		f0 = f;                /* flattening */
-		a1 = wgs84_a;          /* WGS84 semimajor axis */
-		f1 = 1.0 / wgs84_invf; /* WGS84 flattening */
-		dx = -dx;
-		dy = -dy;
-		dz = -dz;
-	}
-
-	b0 = a0 * (1 - f0);                     /* semiminor axis for input datum */
-	es0 = 2 * f0 - f0*f0;                   /* eccentricity^2 */
-
-	b1 = a1 * (1 - f1);                     /* semiminor axis for output datum */
-	es1 = 2 * f1 - f1*f1;                   /* eccentricity^2 */
-
-	/* Convert geodedic latitude to geocentric latitude, psi */
-	if (coord->la == 0.0 || coord->la == 90.0 || coord->la == -90.0)
-		psi = phi;
-	else
-		psi = atan((1 - es0) * tan(phi));
-
-	/* Calc x and y axis coordinates with respect to original ellipsoid */
-	if (coord->lo == 90.0 || coord->lo == -90.0) {
-		x = 0.0;
-		y = fabs(a0 * b0 / sqrt(b0*b0 + a0*a0 * pow(tan(psi), 2.0)));
-	} else {
-		x = fabs((a0 * b0) /
-			 sqrt((1 + pow(tan(lambda), 2.0)) *
-			      (b0*b0 + a0*a0 * pow(tan(psi), 2.0))));
-		y = fabs(x * tan(lambda));
-	}
-
-	if (coord->lo < -90.0 || coord->lo > 90.0)
-		x = -x;
-	if (coord->lo < 0.0)
-		y = -y;
-
-	/* Calculate z axis coordinate with respect to the original ellipsoid */
-	if (coord->la == 90.0)
-		z = b0;
-	else if (coord->la == -90.0)
-		z = -b0;
-	else
-		z = tan(psi) * sqrt((a0*a0 * b0*b0) / (b0*b0 + a0*a0 * pow(tan(psi), 2.0)));
-
-	/* Calculate the geodetic latitude with respect to the new ellipsoid */
-	psi1 = atan((z - dz) / sqrt((x - dx)*(x - dx) + (y - dy)*(y - dy)));
-
-	/* Convert to geocentric latitude and save return value */
-	coord->la = atan(tan(psi1) / (1 - es1)) * 180.0 / M_PI;
-
-	/* Calculate the longitude with respect to the new ellipsoid */
-	coord->lo = atan((y - dy) / (x - dx)) * 180.0 / M_PI;
-
-	/* Correct the resultant for negative x values */
-	if (x-dx < 0.0) {
-		if (y-dy > 0.0)
-			coord->lo += 180.0;
-		else
-			coord->lo -= 180.0;
-	}
-}
-
 static void wgs84_to_kkj(struct gps_coord *coord)
 {
 	double la, lo;
@@ -307,42 +217,126 @@ static void kkj_to_wgs84(struct gps_coord *coord)
 	coord->lo = lo + d_lo;
 }
 
+static void set_ellipsoid(const struct gps_datum *dtm, double *a, double *es)
+{
+	double f;
+
+	if (dtm == NULL) {
+		*a = wgs84_a;
+		f = 1.0 / wgs84_invf;
+	} else {
+		*a = dtm->ellipsoid->a;
+		f = 1.0 / dtm->ellipsoid->invf;
+	}
+	*es = 2 * f - f * f;
+}
+
+static int datum_index(const struct gps_datum *dtm)
+{
+	if (dtm == NULL)
+		return GPS_DATUM_WGS84;
+	return dtm - gps_datum_table;
+}
+
+void gpsnav_init_datum_transform(struct gps_datum_transform *xf,
+				 const struct gps_datum *from_dtm,
+				 const struct gps_datum *to_dtm)
+{
+	memset(xf, 0, sizeof(*xf));
+	if (datum_index(from_dtm) == datum_index(to_dtm))
+		return;
+
+	/* KKJ has its own polynomial fit to WGS 84 */
+	if (datum_index(from_dtm) == GPS_DATUM_FINLAND_HAYFORD) {
+		xf->flags |= GPS_DATUM_XFORM_FROM_KKJ;
+		from_dtm = NULL;
+	}
+	if (datum_index(to_dtm) == GPS_DATUM_FINLAND_HAYFORD) {
+		xf->flags |= GPS_DATUM_XFORM_TO_KKJ;
+		to_dtm = NULL;
+	}
+	if (datum_index(from_dtm) == datum_index(to_dtm))
+		return;
+
+	set_ellipsoid(from_dtm, &xf->a0, &xf->es0);
+	set_ellipsoid(to_dtm, &xf->a1, &xf->es1);
+	xf->b1 = xf->a1 * sqrt(1 - xf->es1);
+	xf->ep1 = xf->es1 / (1 - xf->es1);
+	/* The shifts are from the datum to WGS 84, so going through WGS 84
+	 * collapses into a single translation */
+	if (from_dtm != NULL) {
+		xf->dx += from_dtm->dx;
+		xf->dy += from_dtm->dy;
+		xf->dz += from_dtm->dz;
+	}
+	if (to_dtm != NULL) {
+		xf->dx -= to_dtm->dx;
+		xf->dy -= to_dtm->dy;
+		xf->dz -= to_dtm->dz;
+	}
+	xf->flags |= GPS_DATUM_XFORM_ECEF;
+}
+
+static void ecef_translate(const struct gps_datum_transform *xf,
+			   double *la, double *lo)
+{
+	double phi, lam, sin_phi, cos_phi, nu;
+	double x, y, z, p, r, sin_th, cos_th;
+
+	phi = *la * M_PI / 180.0;
+	lam = *lo * M_PI / 180.0;
+	sin_phi = sin(phi);
+	cos_phi = cos(phi);
+
+	/* Geodetic to geocentric cartesian on the source ellipsoid */
+	nu = xf->a0 / sqrt(1 - xf->es0 * sin_phi * sin_phi);
+	x = nu * cos_phi * cos(lam) + xf->dx;
+	y = nu * cos_phi * sin(lam) + xf->dy;
+	z = nu * (1 - xf->es0) * sin_phi + xf->dz;
+
+	/* And back on the target ellipsoid with Bowring's formula, which
+	 * is exact to well below a millimeter near the surface */
+	p = sqrt(x * x + y * y);
+	r = sqrt(z * xf->a1 * z * xf->a1 + p * xf->b1 * p * xf->b1);
+	sin_th = z * xf->a1 / r;
+	cos_th = p * xf->b1 / r;
+	*la = atan2(z + xf->ep1 * xf->b1 * sin_th * sin_th * sin_th,
+		    p - xf->es1 * xf->a1 * cos_th * cos_th * cos_th) *
+		180.0 / M_PI;
+	*lo = atan2(y, x) * 180.0 / M_PI;
+}
+
+void gpsnav_transform_datum(const struct gps_datum_transform *xf, int count,
+			    double *la, double *lo, size_t stride)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		struct gps_coord c;
+
+		c.la = *la;
+		c.lo = *lo;
+		if (xf->flags & GPS_DATUM_XFORM_FROM_KKJ)
+			kkj_to_wgs84(&c);
+		if (xf->flags & GPS_DATUM_XFORM_ECEF)
+			ecef_translate(xf, &c.la, &c.lo);
+		if (xf->flags & GPS_DATUM_XFORM_TO_KKJ)
+			wgs84_to_kkj(&c);
+		*la = c.la;
+		*lo = c.lo;
+		la = (double *) ((char *) la + stride);
+		lo = (double *) ((char *) lo + stride);
+	}
+}
+
 void gpsnav_convert_datum(struct gps_coord *coord,
 			  const struct gps_datum *from_dtm,
 			  const struct gps_datum *to_dtm)
 {
-	struct gps_coord tmp;
-	int from_idx, to_idx;
-
-	tmp = *coord;
-	if (from_dtm != NULL)
-		from_idx = from_dtm - gps_datum_table;
-	else
-		from_idx = GPS_DATUM_WGS84;
-	switch (from_idx) {
-	case GPS_DATUM_WGS84:
-		break;
-	case GPS_DATUM_FINLAND_HAYFORD:
-		kkj_to_wgs84(&tmp);
-		break;
-	default:
-		molod_translate(&tmp, from_dtm, 0);
-	}
+	struct gps_datum_transform xf;
 
-	if (to_dtm != NULL)
-		to_idx = to_dtm - gps_datum_table;
-	else
-		to_idx = GPS_DATUM_WGS84;
-	switch (to_idx) {
-	case GPS_DATUM_WGS84:
-		break;
-	case GPS_DATUM_FINLAND_HAYFORD:
-		wgs84_to_kkj(&tmp);
-		break;
-	default:
-		molod_translate(&tmp, to_dtm, 1);
-	}
-	*coord = tmp;
+	gpsnav_init_datum_transform(&xf, from_dtm, to_dtm);
+	gpsnav_transform_datum(&xf, 1, &coord->la, &coord->lo, 0);
 }
 
 const struct gps_datum *gpsnav_find_datum(struct gpsnav *gpsnav, const char *name)
@@ -10,6 +10,9 @@
 #include <gpsnav/coord.h>
 #include <gpsnav/pixcache.h>
 
+#include "rtree.h"
+#include "strset.h"
+
 /* This is so fucking lame */
 static struct gpsnav *lame_gpsnav_pointer;
 
@@ -111,6 +114,13 @@ int gpsnav_init(struct gpsnav **gpsnav_out)
 	memset(gpsnav, 0, sizeof(*gpsnav));
 	LIST_INIT(&gpsnav->map_list);
 	LIST_INIT(&gpsnav->map_prov_list);
+	LIST_INIT(&gpsnav->map_part_list);
+	LIST_INIT(&gpsnav->proj_cache);
+	gpsnav->area_index = gps_rtree_new();
+	if (gpsnav->area_index == NULL) {
+		free(gpsnav);
+		return -1;
+	}
 
 	for (i = 0; i < sizeof(prov_table)/sizeof(prov_table[0]); i++)
 		add_provider(gpsnav, prov_table[i]);
@@ -133,6 +143,8 @@ void gpsnav_finish(struct gpsnav *nav)
 		gps_map_free(map);
 		map = next;
 	}
+	gps_rtree_free(nav->area_index);
+	gpsnav_purge_map_partitions(nav);
 	prov = nav->map_prov_list.lh_first;
 	while (prov != NULL) {
 		struct gps_map_provider *next;
@@ -140,9 +152,11 @@ void gpsnav_finish(struct gpsnav *nav)
 		next = prov->entries.le_next;
 		if (prov->finish != NULL)
 			prov->finish(nav, prov);
+		gps_strset_free(prov->map_keys);
 		free(prov);
 		prov = next;
 	}
+	gpsnav_purge_proj_cache(nav);
 	gpsnav_pixcache_purge(nav);
 	if (nav->gps_conn != NULL)
 		gps_close(nav->gps_conn);
@@ -308,6 +308,7 @@ static int parse_gmb(struct gmb_map *img, const char *filename)
 		goto fail;
 //	printf("GMB header ok: %ux%u, %d colors\n",
 //	       img->width, img->height, img->nr_colors);
+	fclose(f);
 	return 0;
 fail:
 	fclose(f);
@@ -369,7 +370,7 @@ static int mericd_init(struct gpsnav *gpsnav, struct gps_map_provider *prov)
 	projc[0] = "ellps=WGS84";
 	projc[1] = "proj=merc";
 	projc[2] = "no_defs";
-	pj = pj_init(3, projc);
+	pj = gpsnav_get_proj(gpsnav, 3, projc);
 	if (pj == NULL) {
 		gps_error("Unable to initialize projection");
 		free(data);
@@ -385,26 +386,9 @@ static void mericd_finish(struct gpsnav *gpsnav, struct gps_map_provider *prov)
 {
 	struct mericd_data *data = prov->data;
 
-	pj_free(data->proj);
 	free(data);
 }
 
-static int mericd_check_for_dupe(struct gpsnav *nav, const char *fname)
-{
-	struct gps_map *e;
-
-	for (e = nav->map_list.lh_first; e != NULL; e = e->entries.le_next) {
-		struct gmb_map *m;
-
-		if (strcmp(e->prov->name, "MeriCD") != 0)
-			continue;
-		m = e->data;
-		if (strcmp(m->gmb_filename, fname) == 0)
-			return -1;
-	}
-	return 0;
-}
-
 static int mericd_add_map(struct gpsnav *nav, struct gps_map *map,
 			  struct gps_key_value *kv, int kv_count,
 			  const char *base_path)
@@ -424,14 +408,14 @@ static int mericd_add_map(struct gpsnav *nav, struct gps_map *map,
 		return -1;
 	}
 
-	gmb_filename = gpsnav_get_full_path(gmb_filename, base_path);
+	/* Already resolved for the duplicate check */
+	if (map->key != NULL)
+		gmb_filename = strdup(map->key);
+	else
+		gmb_filename = gpsnav_get_full_path(gmb_filename, base_path);
 	if (gmb_filename == NULL)
 		return -ENOMEM;
 
-	if (mericd_check_for_dupe(nav, gmb_filename) < 0) {
-		free(gmb_filename);
-		return -EEXIST;
-	}
 	gmb_map = malloc(sizeof(*gmb_map));
 	if (gmb_map == NULL) {
 		free(gmb_filename);
@@ -454,6 +438,17 @@ static int mericd_add_map(struct gpsnav *nav, struct gps_map *map,
 	return 0;
 }
 
+static char *mericd_get_map_key(struct gps_key_value *kv, int kv_count,
+				const char *base_path)
+{
+	int i;
+
+	for (i = 0; i < kv_count; i++)
+		if (strcmp(kv[i].key, "gmb-filename") == 0)
+			return gpsnav_get_full_path(kv[i].value, base_path);
+	return NULL;
+}
+
 static void mericd_free_map(struct gps_map *map)
 {
 	struct gmb_map *gmb_map = map->data;
@@ -468,74 +463,373 @@ struct gps_map_provider mericd_provider = {
 	.add_map = mericd_add_map,
 	.get_map_info = mericd_get_map_info,
 	.free_map = mericd_free_map,
+	.get_map_key = mericd_get_map_key,
 	.init = mericd_init,
 	.finish = mericd_finish
 };
 
-static int find_gmb_file(FILE *f, const char *in8_fname, char *buf,
-			 size_t buf_len)
+#define MERICD_SCAN_MAX_THREADS	8
+#define MERICD_SCAN_MAX_NEST	50
+
+struct mericd_chart {
+	char *in8_fname;
+	char *gmb_fname;
+	struct gps_area area;
+};
+
+struct mericd_scan_dir {
+	char *path;
+	struct timespec mtime;
+	char **files;		/* .in8 and .gmb files in the directory */
+	int file_count;
+	struct mericd_chart *charts;
+	int chart_count;
+};
+
+struct mericd_cache_entry {
+	char *path;
+	struct timespec mtime;
+	int seen;
+};
+
+struct mericd_scan {
+	const struct gps_datum *from_datum, *to_datum;
+
+	struct mericd_scan_dir *dirs;
+	int dir_count, dir_alloc;
+
+	struct mericd_cache_entry *cache;
+	int cache_count;
+
+	pthread_mutex_t lock;
+	int next_dir;
+};
+
+static int has_extension(const char *fname, const char *ext)
 {
-	char line[256], *p;
-	int found, len, i;
-	struct stat st;
+	const char *p;
 
-	found = 0;
+	p = strrchr(fname, '.');
+	if (p == NULL)
+		return 0;
+	return strcasecmp(p, ext) == 0;
+}
+
+static int compare_cache_entries(const void *arg1, const void *arg2)
+{
+	const struct mericd_cache_entry *e1 = arg1, *e2 = arg2;
+
+	return strcmp(e1->path, e2->path);
+}
+
+/* The scan cache remembers the modification time of every directory
+ * we have already imported charts from. A directory whose mtime has
+ * not changed cannot contain new or renamed charts, so its charts
+ * are not parsed again. */
+static void mericd_cache_load(struct mericd_scan *scan, const char *fname)
+{
+	struct mericd_cache_entry *e;
+	char line[1024];
+	long sec, nsec;
+	int n, alloc;
+	FILE *f;
+
+	f = fopen(fname, "r");
+	if (f == NULL)
+		return;
+	alloc = 0;
 	while (fgets(line, sizeof(line), f) != NULL) {
-		if (strncasecmp(line, "[DATAFILE]", 10) == 0) {
-			found = 1;
+		n = 0;
+		if (sscanf(line, "%ld %ld %n", &sec, &nsec, &n) != 2 || n == 0)
+			continue;
+		line[strcspn(line, "\n")] = '\0';
+		if (scan->cache_count == alloc) {
+			alloc = alloc ? alloc * 2 : 64;
+			e = realloc(scan->cache, sizeof(*e) * alloc);
+			if (e == NULL)
+				break;
+			scan->cache = e;
+		}
+		e = &scan->cache[scan->cache_count];
+		e->path = strdup(line + n);
+		if (e->path == NULL)
 			break;
+		e->mtime.tv_sec = sec;
+		e->mtime.tv_nsec = nsec;
+		e->seen = 0;
+		scan->cache_count++;
+	}
+	fclose(f);
+	qsort(scan->cache, scan->cache_count, sizeof(*scan->cache),
+	      compare_cache_entries);
+}
+
+/* What the cache will hold once the charts found by this scan are in
+ * the map database */
+struct mericd_scan_cache {
+	struct mericd_cache_entry *entries;
+	int count;
+};
+
+void mericd_scan_cache_free(struct mericd_scan_cache *c)
+{
+	int i;
+
+	if (c == NULL)
+		return;
+	for (i = 0; i < c->count; i++)
+		free(c->entries[i].path);
+	free(c->entries);
+	free(c);
+}
+
+static struct mericd_scan_cache *mericd_cache_update(struct mericd_scan *scan)
+{
+	struct mericd_scan_cache *c;
+	struct mericd_cache_entry *e;
+	int i;
+
+	c = malloc(sizeof(*c));
+	if (c == NULL)
+		return NULL;
+	c->count = 0;
+	c->entries = malloc(sizeof(*c->entries) *
+			    (scan->cache_count + scan->dir_count + 1));
+	if (c->entries == NULL) {
+		free(c);
+		return NULL;
+	}
+	/* Keep directories from other scan roots */
+	for (i = 0; i < scan->cache_count; i++) {
+		if (scan->cache[i].seen)
+			continue;
+		c->entries[c->count++] = scan->cache[i];
+		scan->cache[i].path = NULL;
+	}
+	for (i = 0; i < scan->dir_count; i++) {
+		e = &c->entries[c->count];
+		e->path = strdup(scan->dirs[i].path);
+		if (e->path == NULL) {
+			mericd_scan_cache_free(c);
+			return NULL;
 		}
+		e->mtime = scan->dirs[i].mtime;
+		e->seen = 0;
+		c->count++;
 	}
-	if (found) {
-		char tmp_fname[64];
+	return c;
+}
 
-		if (fgets(tmp_fname, sizeof(tmp_fname), f) == NULL)
-			return -1;
-		while (tmp_fname[strlen(tmp_fname) - 1] == '\r' ||
-		       tmp_fname[strlen(tmp_fname) - 1] == '\n')
-			tmp_fname[strlen(tmp_fname) - 1] = '\0';
-		strcpy(line, in8_fname);
-		p = strrchr(line, '/');
-		if (p == NULL)
-			p = line;
-		else
-			p++;
-		strncpy(p, tmp_fname, sizeof(line) - (p - line) - 1);
-		line[sizeof(line) - 1] = '\0';
-	} else {
-		if (strlen(in8_fname) >= sizeof(line))
-			return -1;
-		strcpy(line, in8_fname);
-		p = strrchr(line, '.');
-		if (p == NULL)
-			return -1;
-		strcpy(p, ".gmb");
+int mericd_scan_cache_save(const struct mericd_scan_cache *c,
+			   const char *fname)
+{
+	FILE *f;
+	int i;
+
+	f = fopen(fname, "w");
+	if (f == NULL) {
+		gps_error("Unable to open file '%s' for writing", fname);
+		return -1;
 	}
+	for (i = 0; i < c->count; i++) {
+		const struct mericd_cache_entry *e = &c->entries[i];
 
-	len = strlen(line);
-	if (len >= buf_len)
+		fprintf(f, "%ld %ld %s\n", (long) e->mtime.tv_sec,
+			e->mtime.tv_nsec, e->path);
+	}
+	if (fclose(f) != 0) {
+		gps_error("Unable to write file '%s'", fname);
 		return -1;
+	}
+	return 0;
+}
 
-	strcpy(buf, line);
+static int mericd_cache_is_fresh(struct mericd_scan *scan, const char *path,
+				 const struct timespec *mtime)
+{
+	struct mericd_cache_entry key, *e;
 
-	if (stat(buf, &st) == 0)
+	if (scan->cache_count == 0)
+		return 0;
+	key.path = (char *) path;
+	e = bsearch(&key, scan->cache, scan->cache_count, sizeof(*scan->cache),
+		    compare_cache_entries);
+	if (e == NULL)
 		return 0;
+	e->seen = 1;
+	return e->mtime.tv_sec == mtime->tv_sec &&
+	       e->mtime.tv_nsec == mtime->tv_nsec;
+}
 
-	p = strrchr(buf, '/');
-	if (p == NULL)
-		p = buf;
+static int add_dir_file(struct mericd_scan_dir *d, const char *name)
+{
+	char **files;
+
+	if ((d->file_count & 15) == 0) {
+		files = realloc(d->files, sizeof(*files) * (d->file_count + 16));
+		if (files == NULL)
+			return -ENOMEM;
+		d->files = files;
+	}
+	d->files[d->file_count] = strdup(name);
+	if (d->files[d->file_count] == NULL)
+		return -ENOMEM;
+	d->file_count++;
+	return 0;
+}
+
+static int add_scan_dir(struct mericd_scan *scan, const char *path,
+			const struct timespec *mtime)
+{
+	struct mericd_scan_dir *d;
+
+	if (scan->dir_count == scan->dir_alloc) {
+		int alloc;
+
+		alloc = scan->dir_alloc ? scan->dir_alloc * 2 : 16;
+		d = realloc(scan->dirs, sizeof(*d) * alloc);
+		if (d == NULL)
+			return -ENOMEM;
+		scan->dirs = d;
+		scan->dir_alloc = alloc;
+	}
+	d = &scan->dirs[scan->dir_count];
+	memset(d, 0, sizeof(*d));
+	d->path = strdup(path);
+	if (d->path == NULL)
+		return -ENOMEM;
+	d->mtime = *mtime;
+
+	return scan->dir_count++;
+}
+
+/* Walks the directory tree and collects the chart files of every
+ * directory that has changed since the last scan. Entry types come
+ * from d_type, so only file systems that do not fill it in cost
+ * an extra fstatat() per entry. */
+static int mericd_walk_dir(struct mericd_scan *scan, int parent_fd,
+			   const char *name, const char *path, int nest)
+{
+	struct dirent *dent;
+	struct stat st;
+	char buf[512];
+	int fd, idx, fresh, r;
+	DIR *dir;
+
+	fd = openat(parent_fd, name, O_RDONLY | O_DIRECTORY);
+	if (fd < 0) {
+		gps_error("%s: %s", path, strerror(errno));
+		return -1;
+	}
+	if (fstat(fd, &st) < 0) {
+		gps_error("%s: %s", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	dir = fdopendir(fd);
+	if (dir == NULL) {
+		gps_error("%s: %s", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	idx = add_scan_dir(scan, path, &st.st_mtim);
+	if (idx < 0) {
+		closedir(dir);
+		return idx;
+	}
+	fresh = mericd_cache_is_fresh(scan, path, &st.st_mtim);
+
+	r = 0;
+	while ((dent = readdir(dir)) != NULL) {
+		int type;
+
+		if (strcmp(dent->d_name, ".") == 0 ||
+		    strcmp(dent->d_name, "..") == 0)
+			continue;
+		type = dent->d_type;
+		if (type == DT_UNKNOWN || type == DT_LNK) {
+			if (fstatat(dirfd(dir), dent->d_name, &st, 0) < 0) {
+				gps_error("%s/%s: %s", path, dent->d_name,
+					  strerror(errno));
+				continue;
+			}
+			if (S_ISDIR(st.st_mode))
+				type = DT_DIR;
+			else if (S_ISREG(st.st_mode))
+				type = DT_REG;
+		}
+		if (type == DT_DIR) {
+			if (nest >= MERICD_SCAN_MAX_NEST) {
+				gps_error("%s/%s: nesting too far", path,
+					  dent->d_name);
+				continue;
+			}
+			snprintf(buf, sizeof(buf), "%s/%s", path, dent->d_name);
+			r = mericd_walk_dir(scan, dirfd(dir), dent->d_name, buf,
+					    nest + 1);
+			if (r == -ENOMEM)
+				break;
+			r = 0;
+			continue;
+		}
+		if (type != DT_REG || fresh)
+			continue;
+		if (!has_extension(dent->d_name, ".in8") &&
+		    !has_extension(dent->d_name, ".gmb"))
+			continue;
+		r = add_dir_file(&scan->dirs[idx], dent->d_name);
+		if (r < 0)
+			break;
+	}
+	closedir(dir);
+	return r;
+}
+
+/* Resolves the .gmb file name case-insensitively against the directory
+ * listing, preferring an exact match. Names pointing outside the
+ * directory fall back to probing the file system. */
+static char *find_gmb_file(const struct mericd_scan_dir *d, const char *gmb)
+{
+	char buf[512], *p;
+	const char *match;
+	struct stat st;
+	int i, len;
+
+	if (strchr(gmb, '/') == NULL) {
+		match = NULL;
+		for (i = 0; i < d->file_count; i++) {
+			if (strcmp(d->files[i], gmb) == 0) {
+				match = d->files[i];
+				break;
+			}
+			if (match == NULL && strcasecmp(d->files[i], gmb) == 0)
+				match = d->files[i];
+		}
+		if (match == NULL)
+			return NULL;
+		snprintf(buf, sizeof(buf), "%s/%s", d->path, match);
+		return strdup(buf);
+	}
+
+	if (snprintf(buf, sizeof(buf), "%s/%s", d->path, gmb) >= sizeof(buf))
+		return NULL;
+	if (stat(buf, &st) == 0)
+		return strdup(buf);
 
+	len = strlen(buf);
+	p = strrchr(buf, '/');
 	for (i = p - buf; i < len; i++)
 		buf[i] = tolower(buf[i]);
 	if (stat(buf, &st) == 0)
-		return 0;
+		return strdup(buf);
 
 	for (i = p - buf; i < len; i++)
 		buf[i] = toupper(buf[i]);
 	if (stat(buf, &st) == 0)
-		return 0;
+		return strdup(buf);
 
-	return -1;
+	return NULL;
 }
 
 static double parse_coord_value(double in)
@@ -563,17 +857,17 @@ static int close_enough(double a, double b)
 	return fabs(a - b) < 0.00001;
 }
 
-static void fix_map_coords(struct gps_map *map, const char *filename)
+static void fix_map_coords(struct gps_area *area, const char *filename)
 {
 	int fixed = 0;
 
 	if (check_map_name(filename, "M632")) {
-		if (close_enough(map->area.start.la, 59 + 51.300 / 60)) {
-			map->area.start.la += 0.100 / 60;
+		if (close_enough(area->start.la, 59 + 51.300 / 60)) {
+			area->start.la += 0.100 / 60;
 			fixed++;
 		}
-		if (close_enough(map->area.start.lo, 23 + 48.100 / 60)) {
-			map->area.start.lo += 0.010 / 60;
+		if (close_enough(area->start.lo, 23 + 48.100 / 60)) {
+			area->start.lo += 0.010 / 60;
 			fixed++;
 		}
 	}
@@ -582,139 +876,294 @@ static void fix_map_coords(struct gps_map *map, const char *filename)
 		printf("Fixed %d coordinate(s) of map %s\n", fixed, filename);
 }
 
-static int parse_in8(struct gpsnav *nav, struct gps_map *map,
-		     const char *filename,
-		     const struct gps_datum *from_dtm,
-		     const struct gps_datum *to_dtm)
+static char *next_line(char *p, char *end)
 {
-	FILE *in8_f;
-	char buf[512];
-	int found, ret;
-	struct gps_key_value kv;
+	p = memchr(p, '\n', end - p);
+	return p != NULL ? p + 1 : end;
+}
+
+/* Reads the rest of the file into a NUL terminated buffer, sized from
+ * fstat() but growing in case the file does too */
+static int read_file(int fd, char **bufp)
+{
+	struct stat st;
+	size_t alloc, len;
+	char *buf, *p;
+	ssize_t n;
+
+	/* Room for the NUL, and to see the end of file without growing */
+	alloc = 4096;
+	if (fstat(fd, &st) == 0 && st.st_size + 2 > alloc)
+		alloc = st.st_size + 2;
+	buf = malloc(alloc);
+	if (buf == NULL)
+		return -ENOMEM;
+	len = 0;
+	for (;;) {
+		if (len + 1 == alloc) {
+			p = realloc(buf, alloc * 2);
+			if (p == NULL) {
+				free(buf);
+				return -ENOMEM;
+			}
+			buf = p;
+			alloc *= 2;
+		}
+		n = read(fd, buf + len, alloc - 1 - len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0) {
+			free(buf);
+			return -1;
+		}
+		if (n == 0)
+			break;
+		len += n;
+	}
+	buf[len] = '\0';
+	*bufp = buf;
+
+	return len;
+}
 
-	in8_f = fopen(filename, "r");
-	if (in8_f == NULL) {
-		perror(filename);
+/* The whole .in8 file is read at once; only the NMEARECT and DATAFILE
+ * lines are actually parsed. */
+static int parse_in8(struct mericd_scan *scan, const struct mericd_scan_dir *d,
+		     const char *name, struct mericd_chart *chart)
+{
+	char fname[512], gmb[64], *buf, *p, *end;
+	struct gps_area *area = &chart->area;
+	int fd, n, found, len;
+
+	snprintf(fname, sizeof(fname), "%s/%s", d->path, name);
+	fd = open(fname, O_RDONLY);
+	if (fd < 0) {
+		perror(fname);
+		return -1;
+	}
+	n = read_file(fd, &buf);
+	close(fd);
+	if (n < 0) {
+		if (n == -ENOMEM)
+			return n;
+		perror(fname);
 		return -1;
 	}
+	end = buf + n;
+
 	found = 0;
-	while (fgets(buf, sizeof(buf), in8_f) != NULL) {
-		if (sscanf(buf, ";[NMEARECT] %lf,%lf,%lf,%lf", &map->area.start.lo,
-			   &map->area.start.la, &map->area.end.lo, &map->area.end.la) == 4) {
+	for (p = buf; p < end; p = next_line(p, end)) {
+		if (*p != ';' || strncmp(p, ";[NMEARECT]", 11) != 0)
+			continue;
+		if (sscanf(p, ";[NMEARECT] %lf,%lf,%lf,%lf", &area->start.lo,
+			   &area->start.la, &area->end.lo, &area->end.la) == 4) {
 			found = 1;
+			p = next_line(p, end);
 			break;
 		}
 	}
 	if (!found)
 		goto fail;
 
+	area->start.la = parse_coord_value(area->start.la);
+	area->start.lo = parse_coord_value(area->start.lo);
+	area->end.la = parse_coord_value(area->end.la);
+	area->end.lo = parse_coord_value(area->end.lo);
 
-
-	map->area.start.la = parse_coord_value(map->area.start.la);
-	map->area.start.lo = parse_coord_value(map->area.start.lo);
-	map->area.end.la = parse_coord_value(map->area.end.la);
-	map->area.end.lo = parse_coord_value(map->area.end.lo);
-	map->datum = NULL; /* FIXME: Or should it be Hayford? */
-	map->prov = gpsnav_find_provider(nav, mericd_provider.name);
-
-	fix_map_coords(map, filename);
+	fix_map_coords(area, fname);
 
 	/* the coordinates are in KKJ, so we convert them to WGS84 */
-	gpsnav_convert_datum(&map->area.start, from_dtm, to_dtm);
-	gpsnav_convert_datum(&map->area.end, from_dtm, to_dtm);
+	gpsnav_convert_datum(&area->start, scan->from_datum, scan->to_datum);
+	gpsnav_convert_datum(&area->end, scan->from_datum, scan->to_datum);
 
-	if (find_gmb_file(in8_f, filename, buf, sizeof(buf)) < 0) {
-		gps_error("%s: unable to locate .gmb file", buf);
-		goto fail;
+	found = 0;
+	for (; p < end; p = next_line(p, end)) {
+		if (strncasecmp(p, "[DATAFILE]", 10) == 0) {
+			found = 1;
+			p = next_line(p, end);
+			break;
+		}
 	}
-	fclose(in8_f);
-
-	kv.key = "gmb-filename";
-	kv.value = strdup(buf);
-	if (kv.value == NULL)
-		return -1;
+	if (found) {
+		len = strcspn(p, "\r\n");
+		if (len == 0 || len >= sizeof(gmb))
+			goto fail;
+		memcpy(gmb, p, len);
+		gmb[len] = '\0';
+	} else {
+		p = strrchr(name, '.');
+		len = p - name;
+		if (len + 5 > sizeof(gmb))
+			goto fail;
+		memcpy(gmb, name, len);
+		strcpy(gmb + len, ".gmb");
+	}
+	free(buf);
 
-	ret = gpsnav_add_map(nav, map, &kv, 1, NULL);
-	free(kv.value);
-	if (ret < 0)
+	chart->gmb_fname = find_gmb_file(d, gmb);
+	if (chart->gmb_fname == NULL) {
+		gps_error("%s: unable to locate .gmb file", fname);
 		return -1;
-
+	}
+	chart->in8_fname = strdup(fname);
+	if (chart->in8_fname == NULL) {
+		free(chart->gmb_fname);
+		return -ENOMEM;
+	}
 	return 0;
 fail:
-	fclose(in8_f);
+	free(buf);
 	return -1;
 }
 
-static int mericd_scan_subdir(struct gpsnav *nav, struct gps_map_provider *prov,
-			      const char *dirname, int nest)
+static void mericd_scan_dir_charts(struct mericd_scan *scan,
+				   struct mericd_scan_dir *d)
 {
-	struct dirent *dent;
-	DIR *dir;
-	char buf[512];
-	const struct gps_datum *from_datum, *to_datum;
+	int i, c;
+
+	c = 0;
+	for (i = 0; i < d->file_count; i++)
+		if (has_extension(d->files[i], ".in8"))
+			c++;
+	if (c == 0)
+		return;
+	d->charts = malloc(sizeof(*d->charts) * c);
+	if (d->charts == NULL)
+		return;
+	for (i = 0; i < d->file_count; i++) {
+		struct mericd_chart *chart = &d->charts[d->chart_count];
+
+		if (!has_extension(d->files[i], ".in8"))
+			continue;
+		if (parse_in8(scan, d, d->files[i], chart) != 0) {
+			gps_error("%s/%s: bad MeriCD map", d->path, d->files[i]);
+			continue;
+		}
+		d->chart_count++;
+	}
+}
 
-	from_datum = gpsnav_find_datum(nav, "Finland Hayford");
-	to_datum = gpsnav_find_datum(nav, "WGS 84");
-	if (from_datum == NULL || to_datum == NULL) {
-		gps_error("Unable to find correct datums from coordinate conversion");
-		return -1;
+static void *mericd_scan_thread(void *arg)
+{
+	struct mericd_scan *scan = arg;
+	int i;
+
+	for (;;) {
+		pthread_mutex_lock(&scan->lock);
+		i = scan->next_dir++;
+		pthread_mutex_unlock(&scan->lock);
+		if (i >= scan->dir_count)
+			break;
+		mericd_scan_dir_charts(scan, &scan->dirs[i]);
 	}
+	return NULL;
+}
 
-	dir = opendir(dirname);
-	if (dir == NULL) {
-		gps_error("%s: %s", dirname, strerror(errno));
-		return -1;
+/* Chart parsing is mostly waiting for the (often slow, removable)
+ * media, so the directories are handed out to a pool of threads.
+ * The maps are added afterwards in directory order, as
+ * gpsnav_add_map() is not thread safe. */
+static void mericd_parse_charts(struct mericd_scan *scan)
+{
+	pthread_t threads[MERICD_SCAN_MAX_THREADS];
+	long n;
+	int i, started;
+
+	n = sysconf(_SC_NPROCESSORS_ONLN) * 2;
+	if (n > MERICD_SCAN_MAX_THREADS)
+		n = MERICD_SCAN_MAX_THREADS;
+	if (n > scan->dir_count)
+		n = scan->dir_count;
+
+	pthread_mutex_init(&scan->lock, NULL);
+	scan->next_dir = 0;
+	started = 0;
+	for (i = 0; i < n; i++) {
+		if (pthread_create(&threads[started], NULL, mericd_scan_thread,
+				   scan) == 0)
+			started++;
 	}
+	/* Help out, or do all the work if no threads could be started */
+	mericd_scan_thread(scan);
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	pthread_mutex_destroy(&scan->lock);
+}
 
-	while ((dent = readdir(dir)) != NULL) {
-		struct gps_map *map;
-		struct stat st;
-		char *p;
+static int mericd_add_charts(struct gpsnav *nav, struct gps_map_provider *prov,
+			     struct mericd_scan *scan)
+{
+	int i, j, r;
 
-		if (strcmp(dent->d_name, ".") == 0 ||
-		    strcmp(dent->d_name, "..") == 0)
-			continue;
-		snprintf(buf, sizeof(buf), "%s/%s", dirname, dent->d_name);
-		if (stat(buf, &st) < 0) {
-			gps_error("%s: %s", buf, strerror(errno));
-			continue;
-		}
-		if (S_ISDIR(st.st_mode)) {
-			if (nest > 50) {
-				gps_error("%s: nesting too far", buf);
-				return -1;
+	for (i = 0; i < scan->dir_count; i++) {
+		struct mericd_scan_dir *d = &scan->dirs[i];
+
+		for (j = 0; j < d->chart_count; j++) {
+			struct mericd_chart *chart = &d->charts[j];
+			struct gps_key_value kv;
+			struct gps_map *map;
+
+			map = gps_map_new();
+			if (map == NULL) {
+				gps_error("malloc failed");
+				return -ENOMEM;
 			}
-			mericd_scan_subdir(nav, prov, buf, nest + 1);
-			continue;
+			map->area = chart->area;
+			map->datum = NULL; /* FIXME: Or should it be Hayford? */
+			map->prov = prov;
+
+			kv.key = "gmb-filename";
+			kv.value = chart->gmb_fname;
+			r = gpsnav_add_map(nav, map, &kv, 1, NULL);
+			if (r < 0) {
+				if (r != -EEXIST)
+					gps_error("%s: bad MeriCD map",
+						  chart->in8_fname);
+				gps_map_free(map);
+				continue;
+			}
+			/* We have a good map */
+			printf("Map found: %s\n", chart->in8_fname);
 		}
-		if (!S_ISREG(st.st_mode))
-			continue;
-		p = strrchr(buf, '.');
-		if (p == NULL)
-			continue;
-		if (strcasecmp(p, ".in8") != 0)
-			continue;
+	}
+	return 0;
+}
 
-		map = gps_map_new();
-		if (map == NULL) {
-			gps_error("malloc failed");
-			return -ENOMEM;
-		}
-		if (parse_in8(nav, map, buf, from_datum, to_datum) != 0) {
-			gps_error("%s: bad MeriCD map", buf);
-			gps_map_free(map);
-			continue;
+static void mericd_scan_free(struct mericd_scan *scan)
+{
+	int i, j;
+
+	for (i = 0; i < scan->dir_count; i++) {
+		struct mericd_scan_dir *d = &scan->dirs[i];
+
+		for (j = 0; j < d->chart_count; j++) {
+			free(d->charts[j].in8_fname);
+			free(d->charts[j].gmb_fname);
 		}
-		/* We have a good map */
-		printf("Map found: %s\n", buf);
+		free(d->charts);
+		for (j = 0; j < d->file_count; j++)
+			free(d->files[j]);
+		free(d->files);
+		free(d->path);
 	}
-	closedir(dir);
-	return 0;
+	free(scan->dirs);
+	for (i = 0; i < scan->cache_count; i++)
+		free(scan->cache[i].path);
+	free(scan->cache);
 }
 
-int mericd_scan_directory(struct gpsnav *nav, const char *dirname)
+/* Scans a MeriCD directory tree for charts. If cache_fname is given,
+ * directories that have not changed since the cache was saved are
+ * skipped. If new_cache is given, it is set to the cache to save once
+ * the charts found are safely in the map database. */
+int mericd_scan_directory_cached(struct gpsnav *nav, const char *dirname,
+				 const char *cache_fname,
+				 struct mericd_scan_cache **new_cache)
 {
 	struct gps_map_provider *prov;
+	struct mericd_scan scan;
+	char *path;
+	int r;
 
 	prov = gpsnav_find_provider(nav, mericd_provider.name);
 	if (prov == NULL) {
@@ -722,7 +1171,42 @@ int mericd_scan_directory(struct gpsnav *nav, const char *dirname)
 		return -1;
 	}
 
-	return mericd_scan_subdir(nav, prov, dirname, 0);
+	memset(&scan, 0, sizeof(scan));
+	scan.from_datum = gpsnav_find_datum(nav, "Finland Hayford");
+	scan.to_datum = gpsnav_find_datum(nav, "WGS 84");
+	if (scan.from_datum == NULL || scan.to_datum == NULL) {
+		gps_error("Unable to find correct datums from coordinate conversion");
+		return -1;
+	}
+
+	/* Cache keys must not depend on the current directory */
+	path = gpsnav_get_full_path(dirname, NULL);
+	if (path == NULL) {
+		gps_error("%s: unable to resolve path", dirname);
+		return -1;
+	}
+	if (cache_fname != NULL)
+		mericd_cache_load(&scan, cache_fname);
+
+	r = mericd_walk_dir(&scan, AT_FDCWD, path, path, 0);
+	free(path);
+	if (r == 0) {
+		mericd_parse_charts(&scan);
+		r = mericd_add_charts(nav, prov, &scan);
+	}
+	if (r == 0 && new_cache != NULL) {
+		*new_cache = mericd_cache_update(&scan);
+		if (*new_cache == NULL)
+			r = -ENOMEM;
+	}
+
+	mericd_scan_free(&scan);
+	return r;
+}
+
+int mericd_scan_directory(struct gpsnav *nav, const char *dirname)
+{
+	return mericd_scan_directory_cached(nav, dirname, NULL, NULL);
 }
 
 const char *mericd_get_gmb_filename(struct gps_map *map)
@@ -390,20 +390,15 @@ static void raster_free_map(struct gps_map *map)
 	free(raster_map);
 }
 
-static int raster_check_for_dupe(struct gpsnav *nav, const char *fname)
+static char *raster_get_map_key(struct gps_key_value *kv, int kv_count,
+				const char *base_path)
 {
-	struct gps_map *e;
+	int i;
 
-	for (e = nav->map_list.lh_first; e != NULL; e = e->entries.le_next) {
-		struct raster_map *rm;
-
-		if (strcmp(e->prov->name, "raster") != 0)
-			continue;
-		rm = e->data;
-		if (strcmp(rm->bitmap_filename, fname) == 0)
-			return -1;
-	}
-	return 0;
+	for (i = 0; i < kv_count; i++)
+		if (strcmp(kv[i].key, "bitmap-filename") == 0)
+			return gpsnav_get_full_path(kv[i].value, base_path);
+	return NULL;
 }
 
 static int raster_add_map(struct gpsnav *nav, struct gps_map *map,
@@ -454,16 +449,17 @@ static int raster_add_map(struct gpsnav *nav, struct gps_map *map,
 		return -1;
 	}
 
-	bitmap_filename = gpsnav_get_full_path(bitmap_filename, base_path);
+	/* Already resolved for the duplicate check */
+	if (map->key != NULL)
+		bitmap_filename = strdup(map->key);
+	else
+		bitmap_filename = gpsnav_get_full_path(bitmap_filename,
+						       base_path);
 	if (bitmap_filename == NULL)
 		return -1;
 
 	r = -1;
 
-	if (raster_check_for_dupe(nav, bitmap_filename) < 0) {
-		r = -EEXIST;
-		goto fail;
-	}
 	if (bitmap_type == NULL) {
 		gps_error("Did not get bitmap type");
 		goto fail;
@@ -498,21 +494,19 @@ static int raster_add_map(struct gpsnav *nav, struct gps_map *map,
 			sprintf(buf[c++], "x_0=%d", false_easting);
 		for (i = 0; i < c; i++)
 			projc[i] = buf[i];
-		pj = pj_init(c, projc);
+		pj = gpsnav_get_proj(nav, c, projc);
 		if (pj == NULL) {
 			gps_error("Invalid projection variables");
 			goto fail;
 		}
 		type = malloc(sizeof(*type));
 		if (type == NULL) {
-			pj_free(pj);
 			r = -ENOMEM;
 			goto fail;
 		}
 		if (tag != NULL) {
 			type->tag = strdup(tag);
 			if (type->tag == NULL) {
-				pj_free(pj);
 				free(type);
 				r = -ENOMEM;
 				goto fail;
@@ -521,7 +515,6 @@ static int raster_add_map(struct gpsnav *nav, struct gps_map *map,
 			type->tag = NULL;
 		type->proj_name = strdup(proj_str);
 		if (type->proj_name == NULL) {
-			pj_free(pj);
 			free(type->tag);
 			free(type);
 			r = -ENOMEM;
@@ -663,7 +656,6 @@ static void raster_finish(struct gpsnav *nav, struct gps_map_provider *prov)
 	while (type != NULL) {
 		struct raster_map_type *next;
 
-		pj_free(type->proj);
 		if (type->tag != NULL)
 			free(type->tag);
 		free(type->proj_name);
@@ -680,6 +672,7 @@ struct gps_map_provider raster_provider = {
 	.add_map = raster_add_map,
 	.get_map_info = raster_get_map_info,
 	.free_map = raster_free_map,
+	.get_map_key = raster_get_map_key,
 	.init = raster_init,
 	.finish = raster_finish
 };
@@ -10,12 +10,19 @@
 #include <gpsnav/coord.h>
 #include <gpsnav/pixcache.h>
 
+#include "rtree.h"
+#include "strset.h"
+#include "projgrid.h"
+#include "tmerc.h"
+
 static int calculate_map_scale(struct gps_map *map)
 {
 	double scale_rat;
 
-	gpsnav_get_metric_for_coord(map, &map->area.start, &map->marea.start);
-	gpsnav_get_metric_for_coord(map, &map->area.end, &map->marea.end);
+	gpsnav_get_metric_for_coords(map, 2, &map->area.start.la,
+				     &map->area.start.lo, sizeof(struct gps_coord),
+				     &map->marea.start.n, &map->marea.start.e,
+				     sizeof(struct gps_mcoord));
 	map->scale_y = (map->marea.end.n - map->marea.start.n) / map->height;
 	map->scale_x = (map->marea.end.e - map->marea.start.e) / map->width;
 	scale_rat = fabs(1.0 - map->scale_y / map->scale_x);
@@ -30,30 +37,189 @@ static int calculate_map_scale(struct gps_map *map)
 	return 0;
 }
 
+static struct gps_map_partition *find_map_partition(struct gpsnav *gpsnav,
+						    PJ *pj)
+{
+	struct gps_map_partition *part;
+
+	for (part = gpsnav->map_part_list.lh_first; part != NULL;
+	     part = part->entries.le_next) {
+		if (part->descr == pj->descr && part->lam0 == pj->lam0)
+			return part;
+	}
+	return NULL;
+}
+
+static struct gps_map_partition *get_map_partition(struct gpsnav *gpsnav,
+						   PJ *pj)
+{
+	struct gps_map_partition *part;
+
+	part = find_map_partition(gpsnav, pj);
+	if (part != NULL)
+		return part;
+
+	part = malloc(sizeof(*part));
+	if (part == NULL)
+		return NULL;
+	memset(part, 0, sizeof(*part));
+	part->descr = pj->descr;
+	part->lam0 = pj->lam0;
+	LIST_INSERT_HEAD(&gpsnav->map_part_list, part, entries);
+
+	return part;
+}
+
+void gpsnav_purge_map_partitions(struct gpsnav *gpsnav)
+{
+	struct gps_map_partition *part;
+	int i;
+
+	while ((part = gpsnav->map_part_list.lh_first) != NULL) {
+		LIST_REMOVE(part, entries);
+		for (i = 0; i < part->band_count; i++)
+			gps_rtree_free(part->bands[i].marea_index);
+		free(part->bands);
+		free(part);
+	}
+}
+
+#define SCALE_BAND_MIN	-32
+#define SCALE_BAND_MAX	32
+
+int gpsnav_get_scale_band(double scale)
+{
+	int band;
+
+	if (!(scale > 0))
+		return SCALE_BAND_MIN;
+	frexp(scale, &band);
+	/* frexp() gives scale = m * 2^band with 0.5 <= m < 1 */
+	band--;
+	if (band < SCALE_BAND_MIN)
+		return SCALE_BAND_MIN;
+	if (band > SCALE_BAND_MAX)
+		return SCALE_BAND_MAX;
+	return band;
+}
+
+static struct gps_scale_band *find_scale_band(struct gps_map_partition *part,
+					      int band)
+{
+	int lo = 0, hi = part->band_count;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+
+		if (part->bands[mid].band < band)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo < part->band_count && part->bands[lo].band == band)
+		return &part->bands[lo];
+	return NULL;
+}
+
+static struct gps_scale_band *get_scale_band(struct gps_map_partition *part,
+					     int band)
+{
+	struct gps_scale_band *bands;
+	struct gps_rtree *index;
+	int i;
+
+	bands = find_scale_band(part, band);
+	if (bands != NULL)
+		return bands;
+
+	index = gps_rtree_new();
+	if (index == NULL)
+		return NULL;
+	bands = realloc(part->bands, sizeof(*bands) * (part->band_count + 1));
+	if (bands == NULL) {
+		gps_rtree_free(index);
+		return NULL;
+	}
+	part->bands = bands;
+	for (i = part->band_count; i > 0 && bands[i - 1].band > band; i--)
+		bands[i] = bands[i - 1];
+	bands[i].band = band;
+	bands[i].marea_index = index;
+	part->band_count++;
+
+	return &bands[i];
+}
+
 int gpsnav_add_map(struct gpsnav *gpsnav, struct gps_map *map,
 		   struct gps_key_value *kv, int kv_count,
 		   const char *base_path)
 {
+	struct gps_map_partition *part;
+	struct gps_scale_band *band = NULL;
+	const char *key = NULL;
 	int r;
 
+	/* Duplicates are turned away before the provider reads any
+	 * files */
+	if (map->prov->get_map_key != NULL) {
+		map->key = map->prov->get_map_key(kv, kv_count, base_path);
+		key = map->key;
+	}
+	if (key != NULL && map->prov->map_keys != NULL &&
+	    gps_strset_contains(map->prov->map_keys, key)) {
+		r = -EEXIST;
+		goto fail;
+	}
+
 	if (map->prov->add_map != NULL) {
 		r = map->prov->add_map(gpsnav, map, kv, kv_count,
 				       base_path);
 		if (r < 0)
-			return r;
+			goto fail;
 	}
+	map->tmerc = gpsnav_get_tmerc(gpsnav, map->proj);
 
 	r = calculate_map_scale(map);
 	if (r < 0) {
 		gps_error("Invalid map scale");
-		map->prov->free_map(map);
-		map->data = NULL;
-		return -1;
+		r = -1;
+		goto fail_free;
+	}
+
+	/* Make sure none of the index inserts can fail */
+	if (key != NULL && map->prov->map_keys == NULL)
+		map->prov->map_keys = gps_strset_new();
+	part = get_map_partition(gpsnav, map->proj);
+	if (part != NULL)
+		band = get_scale_band(part,
+				      gpsnav_get_scale_band(map->scale_y));
+	if (band == NULL ||
+	    (key != NULL && (map->prov->map_keys == NULL ||
+			     gps_strset_reserve(map->prov->map_keys) < 0)) ||
+	    gps_rtree_reserve(gpsnav->area_index) < 0 ||
+	    gps_rtree_reserve(band->marea_index) < 0) {
+		gps_error("malloc failed");
+		r = -ENOMEM;
+		goto fail_free;
 	}
+	gps_rtree_insert(gpsnav->area_index, &map->area, map);
+	gps_rtree_insert(band->marea_index,
+			 (const struct gps_area *) &map->marea, map);
+	map->part = part;
+	if (key != NULL)
+		gps_strset_insert(map->prov->map_keys, key);
 
 	LIST_INSERT_HEAD(&gpsnav->map_list, map, entries);
 
 	return 0;
+fail_free:
+	map->prov->free_map(map);
+	map->data = NULL;
+fail:
+	/* Callers may free the map with a plain free() */
+	free(map->key);
+	map->key = NULL;
+	return r;
 }
 
 struct gps_map *gps_map_new(void)
@@ -73,6 +239,8 @@ void gps_map_free(struct gps_map *map)
 	if (map->prov != NULL && map->prov->free_map != NULL &&
 	    map->data != NULL)
 		map->prov->free_map(map);
+	gps_proj_grid_free(map->grid);
+	free(map->key);
 	free(map);
 }
 
@@ -129,8 +297,9 @@ int gpsnav_get_map_pixels(struct gpsnav *nav, struct gps_map *map,
 	return 0;
 }
 
-static int within_rectangle(struct gps_coord *coord, struct gps_coord *start,
-			    struct gps_coord *end)
+static int within_rectangle(const struct gps_coord *coord,
+			    const struct gps_coord *start,
+			    const struct gps_coord *end)
 {
 	if (coord->la < start->la || coord->lo < start->lo)
 		return 0;
@@ -139,34 +308,127 @@ static int within_rectangle(struct gps_coord *coord, struct gps_coord *start,
 	return 1;
 }
 
-static int coord_in_map(struct gps_map *map, struct gps_coord *coord)
+static int coord_in_map(struct gps_map *map, const struct gps_coord *coord)
 {
 	return within_rectangle(coord, &map->area.start, &map->area.end);
 }
 
-struct gps_map **gpsnav_find_maps(struct gpsnav *gpsnav,
-					 int (* check_map)(struct gps_map *map, void *arg),
-					 void *arg)
+int gpsnav_for_each_map(struct gpsnav *gpsnav,
+			int (* cb)(struct gps_map *map, void *arg), void *arg)
 {
-	struct gps_map **map_list;
 	struct gps_map *map;
-	int c;
+	int r;
 
-	map_list = NULL;
-	c = 0;
 	for (map = gpsnav->map_list.lh_first; map != NULL; map = map->entries.le_next) {
-		if (check_map != NULL)
-			if (!check_map(map, arg))
-				continue;
-
-		map_list = realloc(map_list, sizeof(*map_list) * (c + 2));
-		if (map_list == NULL)
-			return NULL;
-		map_list[c++] = map;
+		r = cb(map, arg);
+		if (r)
+			return r;
 	}
-	if (map_list != NULL)
-		map_list[c] = NULL;
-	return map_list;
+	return 0;
+}
+
+struct visit_arg {
+	int (* check_map)(struct gps_map *map, void *arg);
+	void *check_arg;
+	int (* cb)(struct gps_map *map, void *arg);
+	void *arg;
+};
+
+static int visit_checked_map(struct gps_map *map, void *arg)
+{
+	struct visit_arg *varg = arg;
+
+	if (varg->check_map != NULL && !varg->check_map(map, varg->check_arg))
+		return 0;
+	return varg->cb(map, varg->arg);
+}
+
+static int visit_indexed_map(void *data, void *arg)
+{
+	return visit_checked_map(data, arg);
+}
+
+/* Passes the maps whose indexed rectangle touches area through
+ * check_map, and the ones that pass on to cb */
+static int for_each_indexed_map(struct gps_rtree *index,
+				const struct gps_area *area,
+				int (* check_map)(struct gps_map *map, void *arg),
+				void *check_arg,
+				int (* cb)(struct gps_map *map, void *arg),
+				void *arg)
+{
+	struct visit_arg varg;
+
+	varg.check_map = check_map;
+	varg.check_arg = check_arg;
+	varg.cb = cb;
+	varg.arg = arg;
+	return gps_rtree_search(index, area, visit_indexed_map, &varg);
+}
+
+struct map_array {
+	struct gps_map **maps;
+	int count, alloc;
+};
+
+static int add_to_map_array(struct gps_map *map, void *arg)
+{
+	struct map_array *a = arg;
+	struct gps_map **maps;
+
+	if (a->count + 2 > a->alloc) {
+		a->alloc = a->alloc ? a->alloc * 2 : 16;
+		maps = realloc(a->maps, sizeof(*maps) * a->alloc);
+		if (maps == NULL)
+			return -ENOMEM;
+		a->maps = maps;
+	}
+	a->maps[a->count++] = map;
+	return 0;
+}
+
+/* Returns the NULL-terminated map array, or NULL if nothing was found */
+static struct gps_map **finish_map_array(struct map_array *a, int r)
+{
+	if (r < 0) {
+		free(a->maps);
+		return NULL;
+	}
+	if (a->maps != NULL)
+		a->maps[a->count] = NULL;
+	return a->maps;
+}
+
+struct map_buf {
+	struct gps_map **maps;
+	int max, count;
+};
+
+static int add_to_map_buf(struct gps_map *map, void *arg)
+{
+	struct map_buf *b = arg;
+
+	if (b->count < b->max)
+		b->maps[b->count] = map;
+	b->count++;
+	return 0;
+}
+
+struct gps_map **gpsnav_find_maps(struct gpsnav *gpsnav,
+					 int (* check_map)(struct gps_map *map, void *arg),
+					 void *arg)
+{
+	struct visit_arg varg;
+	struct map_array a;
+	int r;
+
+	memset(&a, 0, sizeof(a));
+	varg.check_map = check_map;
+	varg.check_arg = arg;
+	varg.cb = add_to_map_array;
+	varg.arg = &a;
+	r = gpsnav_for_each_map(gpsnav, visit_checked_map, &varg);
+	return finish_map_array(&a, r);
 }
 
 static int check_map_for_coord(struct gps_map *map, void *arg)
@@ -174,10 +436,42 @@ static int check_map_for_coord(struct gps_map *map, void *arg)
 	return coord_in_map(map, (struct gps_coord *) arg);
 }
 
+int gpsnav_for_each_map_for_coord(struct gpsnav *gpsnav,
+				  const struct gps_coord *coord,
+				  int (* cb)(struct gps_map *map, void *arg),
+				  void *arg)
+{
+	struct gps_area area;
+
+	area.start = *coord;
+	area.end = *coord;
+	return for_each_indexed_map(gpsnav->area_index, &area,
+				    check_map_for_coord, (void *) coord,
+				    cb, arg);
+}
+
 struct gps_map **gpsnav_find_maps_for_coord(struct gpsnav *gpsnav,
 					    struct gps_coord *coord)
 {
-	return gpsnav_find_maps(gpsnav, check_map_for_coord, coord);
+	struct map_array a;
+	int r;
+
+	memset(&a, 0, sizeof(a));
+	r = gpsnav_for_each_map_for_coord(gpsnav, coord, add_to_map_array, &a);
+	return finish_map_array(&a, r);
+}
+
+int gpsnav_get_maps_for_coord(struct gpsnav *gpsnav,
+			      const struct gps_coord *coord,
+			      struct gps_map **maps, int max_maps)
+{
+	struct map_buf b;
+
+	b.maps = maps;
+	b.max = max_maps;
+	b.count = 0;
+	gpsnav_for_each_map_for_coord(gpsnav, coord, add_to_map_buf, &b);
+	return b.count;
 }
 
 void gpsnav_calc_isect(const struct gps_area *a1,
@@ -236,30 +530,44 @@ static int check_map_for_area(struct gps_map *map, void *arg)
 	return 1;
 }
 
+int gpsnav_for_each_map_in_area(struct gpsnav *gpsnav,
+				const struct gps_area *area,
+				int (* cb)(struct gps_map *map, void *arg),
+				void *arg)
+{
+	return for_each_indexed_map(gpsnav->area_index, area,
+				    check_map_for_area, (void *) area,
+				    cb, arg);
+}
+
 struct gps_map **gpsnav_find_maps_for_area(struct gpsnav *gpsnav,
 					   const struct gps_area *area)
 {
-	return gpsnav_find_maps(gpsnav, check_map_for_area, (void *) area);
+	struct map_array a;
+	int r;
+
+	memset(&a, 0, sizeof(a));
+	r = gpsnav_for_each_map_in_area(gpsnav, area, add_to_map_array, &a);
+	return finish_map_array(&a, r);
 }
 
-struct marea_arg {
-	PJ *pj;
-	const struct gps_marea *area;
-};
+int gpsnav_get_maps_for_area(struct gpsnav *gpsnav,
+			     const struct gps_area *area,
+			     struct gps_map **maps, int max_maps)
+{
+	struct map_buf b;
+
+	b.maps = maps;
+	b.max = max_maps;
+	b.count = 0;
+	gpsnav_for_each_map_in_area(gpsnav, area, add_to_map_buf, &b);
+	return b.count;
+}
 
 static int check_map_for_marea(struct gps_map *map, void *arg)
 {
-	struct marea_arg *marg = arg;
+	const struct gps_marea *area = arg;
 	struct gps_marea isect;
-	const struct gps_marea *area = marg->area;
-	PJ *pj = marg->pj;
-	PJ *mpj = map->proj;
-
-	/* If the projections are not alike, we won't display
-	 * the maps at the same time */
-	if (pj->descr != mpj->descr ||
-	    pj->lam0 != mpj->lam0)
-		return 0;
 
 	gpsnav_calc_metric_isect(&map->marea, area, &isect);
 
@@ -269,54 +577,253 @@ static int check_map_for_marea(struct gps_map *map, void *arg)
 	return 1;
 }
 
+static struct gps_map_partition *get_ref_map_partition(struct gpsnav *gpsnav,
+							struct gps_map *ref_map)
+{
+	if (ref_map->part != NULL)
+		return ref_map->part;
+	return find_map_partition(gpsnav, ref_map->proj);
+}
+
+/* If the projections are not alike, we won't display the maps at
+ * the same time, so only ref_map's partition is searched. */
+int gpsnav_for_each_map_in_marea(struct gpsnav *gpsnav,
+				 struct gps_map *ref_map,
+				 const struct gps_marea *marea,
+				 int (* cb)(struct gps_map *map, void *arg),
+				 void *arg)
+{
+	struct gps_map_partition *part;
+	int i, r;
+
+	part = get_ref_map_partition(gpsnav, ref_map);
+	if (part == NULL)
+		return 0;
+	for (i = 0; i < part->band_count; i++) {
+		r = for_each_indexed_map(part->bands[i].marea_index,
+					 (const struct gps_area *) marea,
+					 check_map_for_marea, (void *) marea,
+					 cb, arg);
+		if (r)
+			return r;
+	}
+	return 0;
+}
+
+int gpsnav_for_each_map_in_marea_band(struct gpsnav *gpsnav,
+				      struct gps_map *ref_map,
+				      const struct gps_marea *marea,
+				      int band,
+				      int (* cb)(struct gps_map *map, void *arg),
+				      void *arg)
+{
+	struct gps_map_partition *part;
+	struct gps_scale_band *sb;
+
+	part = get_ref_map_partition(gpsnav, ref_map);
+	if (part == NULL)
+		return 0;
+	sb = find_scale_band(part, band);
+	if (sb == NULL)
+		return 0;
+	return for_each_indexed_map(sb->marea_index,
+				    (const struct gps_area *) marea,
+				    check_map_for_marea, (void *) marea,
+				    cb, arg);
+}
+
+int gpsnav_get_marea_scale_bands(struct gpsnav *gpsnav,
+				 struct gps_map *ref_map,
+				 int *bands, int max_bands)
+{
+	struct gps_map_partition *part;
+	int i;
+
+	part = get_ref_map_partition(gpsnav, ref_map);
+	if (part == NULL)
+		return 0;
+	for (i = 0; i < part->band_count && i < max_bands; i++)
+		bands[i] = part->bands[i].band;
+	return part->band_count;
+}
+
 struct gps_map **gpsnav_find_maps_for_marea(struct gpsnav *gpsnav,
 					    struct gps_map *ref_map,
 					    const struct gps_marea *marea)
 {
-	struct marea_arg arg;
-	PJ *proj = ref_map->proj;
+	struct map_array a;
+	int r;
+
+	memset(&a, 0, sizeof(a));
+	r = gpsnav_for_each_map_in_marea(gpsnav, ref_map, marea,
+					 add_to_map_array, &a);
+	return finish_map_array(&a, r);
+}
+
+int gpsnav_get_maps_for_marea(struct gpsnav *gpsnav, struct gps_map *ref_map,
+			      const struct gps_marea *marea,
+			      struct gps_map **maps, int max_maps)
+{
+	struct map_buf b;
+
+	b.maps = maps;
+	b.max = max_maps;
+	b.count = 0;
+	gpsnav_for_each_map_in_marea(gpsnav, ref_map, marea, add_to_map_buf, &b);
+	return b.count;
+}
+
+/* Points are converted in chunks, so that the unit conversions and
+ * the stride handling run as separate, simple loops */
+#define PROJ_CHUNK	64
+
+#define STRIDED(base, stride, i) \
+	(*(double *) ((char *) (base) + (size_t) (i) * (stride)))
+
+/* Same as pj_fwd() for an array of points, with the projection
+ * parameters loaded once */
+static void project_fwd(PJ *P, LP *lp, XY *xy, int count)
+{
+	double a = P->a, fr_meter = P->fr_meter, x0 = P->x0, y0 = P->y0;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		LP p = lp[i];
+		double t;
 
-	arg.pj = proj;
-	arg.area = marea;
-	return gpsnav_find_maps(gpsnav, check_map_for_marea, (void *) &arg);
+		if ((t = fabs(p.phi) - HALFPI) > 1.0e-12 || fabs(p.lam) > 10.) {
+			xy[i].x = xy[i].y = HUGE_VAL;
+			pj_errno = -14;
+			continue;
+		}
+		errno = pj_errno = 0;
+		if (fabs(t) <= 1.0e-12)
+			p.phi = p.phi < 0. ? -HALFPI : HALFPI;
+		else if (P->geoc)
+			p.phi = atan(P->rone_es * tan(p.phi));
+		p.lam -= P->lam0;
+		if (!P->over)
+			p.lam = pj_adjlon(p.lam);
+		xy[i] = P->fwd(p, P);
+		if (pj_errno || (pj_errno = errno)) {
+			xy[i].x = xy[i].y = HUGE_VAL;
+			continue;
+		}
+		xy[i].x = fr_meter * (a * xy[i].x + x0);
+		xy[i].y = fr_meter * (a * xy[i].y + y0);
+	}
+}
+
+/* Same as pj_inv() for an array of points */
+static void project_inv(PJ *P, XY *xy, LP *lp, int count)
+{
+	double ra = P->ra, to_meter = P->to_meter, x0 = P->x0, y0 = P->y0;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		XY p;
+
+		errno = pj_errno = 0;
+		p.x = (xy[i].x * to_meter - x0) * ra;
+		p.y = (xy[i].y * to_meter - y0) * ra;
+		lp[i] = P->inv(p, P);
+		if (pj_errno || (pj_errno = errno)) {
+			lp[i].lam = lp[i].phi = HUGE_VAL;
+			continue;
+		}
+		lp[i].lam += P->lam0;
+		if (!P->over)
+			lp[i].lam = pj_adjlon(lp[i].lam);
+		if (P->geoc && fabs(fabs(lp[i].phi) - HALFPI) > 1.0e-12)
+			lp[i].phi = atan(P->one_es * tan(lp[i].phi));
+	}
+}
+
+void gpsnav_get_metric_for_coords(struct gps_map *map, int count,
+				  const double *la, const double *lo,
+				  size_t in_stride, double *n, double *e,
+				  size_t out_stride)
+{
+	PJ *pj = map->proj;
+	struct gps_datum_transform xf;
+	LP lp[PROJ_CHUNK];
+	XY xy[PROJ_CHUNK];
+	int i, j, chunk;
+
+	gpsnav_init_datum_transform(&xf, NULL, map->datum);
+	for (i = 0; i < count; i += chunk) {
+		chunk = count - i < PROJ_CHUNK ? count - i : PROJ_CHUNK;
+		for (j = 0; j < chunk; j++) {
+			lp[j].phi = STRIDED(la, in_stride, i + j);
+			lp[j].lam = STRIDED(lo, in_stride, i + j);
+		}
+		if (map->datum != NULL)
+			gpsnav_transform_datum(&xf, chunk, &lp[0].phi,
+					       &lp[0].lam, sizeof(lp[0]));
+		for (j = 0; j < chunk; j++) {
+			lp[j].phi = deg2rad(lp[j].phi);
+			lp[j].lam = deg2rad(lp[j].lam);
+		}
+		project_fwd(pj, lp, xy, chunk);
+		for (j = 0; j < chunk; j++) {
+			STRIDED(n, out_stride, i + j) = xy[j].y;
+			STRIDED(e, out_stride, i + j) = xy[j].x;
+		}
+	}
+}
+
+void gpsnav_get_coords_for_metric(struct gps_map *map, int count,
+				  const double *n, const double *e,
+				  size_t in_stride, double *la, double *lo,
+				  size_t out_stride)
+{
+	PJ *pj = map->proj;
+	struct gps_datum_transform xf;
+	LP lp[PROJ_CHUNK];
+	XY xy[PROJ_CHUNK];
+	int i, j, chunk;
+
+	gpsnav_init_datum_transform(&xf, map->datum, NULL);
+	for (i = 0; i < count; i += chunk) {
+		chunk = count - i < PROJ_CHUNK ? count - i : PROJ_CHUNK;
+		for (j = 0; j < chunk; j++) {
+			xy[j].y = STRIDED(n, in_stride, i + j);
+			xy[j].x = STRIDED(e, in_stride, i + j);
+		}
+		/* PJ_tmerc's forward series is cheaper, but its inverse
+		 * needs an iterative meridian distance */
+		if (map->tmerc != NULL)
+			gps_tmerc_inv(map->tmerc, xy, lp, chunk);
+		else
+			project_inv(pj, xy, lp, chunk);
+		for (j = 0; j < chunk; j++) {
+			lp[j].phi = rad2deg(lp[j].phi);
+			lp[j].lam = rad2deg(lp[j].lam);
+		}
+		if (map->datum != NULL)
+			gpsnav_transform_datum(&xf, chunk, &lp[0].phi,
+					       &lp[0].lam, sizeof(lp[0]));
+		for (j = 0; j < chunk; j++) {
+			STRIDED(la, out_stride, i + j) = lp[j].phi;
+			STRIDED(lo, out_stride, i + j) = lp[j].lam;
+		}
+	}
 }
 
 void gpsnav_get_metric_for_coord(struct gps_map *map,
 				 const struct gps_coord *coord,
 				 struct gps_mcoord *out)
 {
-	struct gps_coord map_coord;
-	LP lp;
-	XY xy;
-
-	if (map->datum != NULL) {
-		map_coord = *coord;
-		coord = &map_coord;
-		gpsnav_convert_datum(&map_coord, NULL, map->datum);
-	}
-	lp.lam = deg2rad(coord->lo);
-	lp.phi = deg2rad(coord->la);
-//	printf("lam %f, phi %f\n", lp.lam, lp.phi);
-	xy = pj_fwd(lp, map->proj);
-//	printf("x %f, y %f\n", xy.x, xy.y);
-	out->n = xy.y;
-	out->e = xy.x;
+	gpsnav_get_metric_for_coords(map, 1, &coord->la, &coord->lo, 0,
+				     &out->n, &out->e, 0);
 }
 
 void gpsnav_get_coord_for_metric(struct gps_map *map,
 				 const struct gps_mcoord *mcoord,
 				 struct gps_coord *coord)
 {
-	LP lp;
-	XY xy;
-
-	xy.y = mcoord->n;
-	xy.x = mcoord->e;
-	lp = pj_inv(xy, map->proj);
-	coord->lo = rad2deg(lp.lam);
-	coord->la = rad2deg(lp.phi);
-	if (map->datum != NULL)
-		gpsnav_convert_datum(coord, map->datum, NULL);
+	gpsnav_get_coords_for_metric(map, 1, &mcoord->n, &mcoord->e, 0,
+				     &coord->la, &coord->lo, 0);
 }
 
 int gpsnav_get_xy_for_coord(struct gps_map *map, const struct gps_coord *coord,
@@ -346,12 +853,15 @@ int gpsnav_get_coord_for_xy(struct gps_map *map, int x, int y,
 
 double gpsnav_calculate_area(struct gps_map *map, const struct gps_area *area)
 {
-	struct gps_mcoord mc1, mc2;
+	struct gps_marea marea;
 
-	gpsnav_get_metric_for_coord(map, &area->start, &mc1);
-	gpsnav_get_metric_for_coord(map, &area->end, &mc2);
+	gpsnav_get_metric_for_coords(map, 2, &area->start.la, &area->start.lo,
+				     sizeof(struct gps_coord),
+				     &marea.start.n, &marea.start.e,
+				     sizeof(struct gps_mcoord));
 
-	return fabs((mc1.n - mc2.n) * (mc1.e - mc2.e));
+	return fabs((marea.start.n - marea.end.n) *
+		    (marea.start.e - marea.end.e));
 }
 
 int gpsnav_get_provider_map_info(struct gpsnav *nav, struct gps_map *map,
@@ -0,0 +1,342 @@
+/*
+ * Projection partitions of the map index, on a synthetic mix of MeriCD
+ * style Mercator tiles and KKJ tmerc sheets of two zones, all over
+ * the same part of Finland and at two scales.
+ *
+ * Metric-area queries must return exactly the maps that a scan of
+ * the whole map list finds in the reference map's projection, through
+ * the partition as a whole and band by band. Area queries must still
+ * find maps of every projection.
+ *
+ * Run by make check.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <gpsnav/gpsnav.h>
+#include <gpsnav/map.h>
+#include <gpsnav/coord.h>
+
+#include <lib_proj.h>
+
+#define MAX_MAPS	1024
+#define QUERIES		200
+
+struct map_set {
+	struct gps_map *maps[MAX_MAPS];
+	int count;
+};
+
+/* Which maps a query returned */
+struct found {
+	char seen[MAX_MAPS];
+	int count, wrong_band;
+	int band;
+};
+
+static struct map_set all;
+
+static void synth_free_map(struct gps_map *map)
+{
+}
+
+static struct gps_map_provider synth_prov = {
+	.name = "synthetic",
+	.free_map = synth_free_map,
+};
+
+static int map_index(const struct gps_map *map)
+{
+	return (int) (long) map->data;
+}
+
+static int add_grid(struct gpsnav *nav, PJ *pj, const struct gps_datum *datum,
+		    const struct gps_area *area, int tiles, int size)
+{
+	double tile_la, tile_lo;
+	int x, y, r;
+
+	tile_la = (area->end.la - area->start.la) / tiles;
+	tile_lo = (area->end.lo - area->start.lo) / tiles;
+	for (y = 0; y < tiles; y++) {
+		for (x = 0; x < tiles; x++) {
+			struct gps_map *map;
+
+			if (all.count == MAX_MAPS)
+				return -1;
+			map = gps_map_new();
+			if (map == NULL)
+				return -1;
+			map->area.start.la = area->start.la + y * tile_la;
+			map->area.start.lo = area->start.lo + x * tile_lo;
+			map->area.end.la = map->area.start.la + tile_la;
+			map->area.end.lo = map->area.start.lo + tile_lo;
+			map->width = map->height = size;
+			map->proj = pj;
+			map->datum = datum;
+			map->prov = &synth_prov;
+			map->data = (void *) (long) all.count;
+			r = gpsnav_add_map(nav, map, NULL, 0, NULL);
+			if (r < 0) {
+				free(map);
+				return r;
+			}
+			all.maps[all.count++] = map;
+		}
+	}
+	return 0;
+}
+
+/* A KKJ grid zone, as the raster provider sets it up */
+static PJ *get_kkj_proj(struct gpsnav *nav, const struct gps_datum *kkj,
+			int lon0, int false_easting)
+{
+	char buf[5][40], *projc[5];
+	int i;
+
+	sprintf(buf[0], "proj=tmerc");
+	sprintf(buf[1], "a=%f", kkj->ellipsoid->a);
+	sprintf(buf[2], "rf=%f", kkj->ellipsoid->invf);
+	sprintf(buf[3], "lon_0=%d", lon0);
+	sprintf(buf[4], "x_0=%d", false_easting);
+	for (i = 0; i < 5; i++)
+		projc[i] = buf[i];
+	return gpsnav_get_proj(nav, 5, projc);
+}
+
+static int same_projection(const struct gps_map *m1, const struct gps_map *m2)
+{
+	const PJ *p1 = m1->proj, *p2 = m2->proj;
+
+	return p1->descr == p2->descr && p1->lam0 == p2->lam0;
+}
+
+static int in_marea(const struct gps_map *map, const struct gps_marea *marea)
+{
+	struct gps_marea isect;
+
+	gpsnav_calc_metric_isect(&map->marea, marea, &isect);
+	return isect.start.n < isect.end.n && isect.start.e < isect.end.e;
+}
+
+static int in_area(const struct gps_map *map, const struct gps_area *area)
+{
+	return map->area.start.la < area->end.la &&
+		map->area.end.la > area->start.la &&
+		map->area.start.lo < area->end.lo &&
+		map->area.end.lo > area->start.lo;
+}
+
+/* Bounds of the metric areas of the maps in ref_map's projection, or
+ * of all maps if ref_map is NULL */
+static void get_bounds(const struct gps_map *ref_map, struct gps_marea *b)
+{
+	int i;
+
+	b->start.n = b->start.e = 1e100;
+	b->end.n = b->end.e = -1e100;
+	for (i = 0; i < all.count; i++) {
+		const struct gps_marea *m = &all.maps[i]->marea;
+
+		if (ref_map != NULL && !same_projection(all.maps[i], ref_map))
+			continue;
+		if (m->start.n < b->start.n)
+			b->start.n = m->start.n;
+		if (m->start.e < b->start.e)
+			b->start.e = m->start.e;
+		if (m->end.n > b->end.n)
+			b->end.n = m->end.n;
+		if (m->end.e > b->end.e)
+			b->end.e = m->end.e;
+	}
+}
+
+static int note_map(struct gps_map *map, void *arg)
+{
+	struct found *f = arg;
+
+	if (!f->seen[map_index(map)])
+		f->count++;
+	f->seen[map_index(map)] = 1;
+	if (f->band != 0 && gpsnav_get_scale_band(map->scale_y) != f->band)
+		f->wrong_band++;
+	return 0;
+}
+
+static double frand(double start, double end)
+{
+	return start + (rand() % 10000) / 10000.0 * (end - start);
+}
+
+/* Compares what was found against the expected flags, and complains
+ * about each difference */
+static int compare(const char *what, const struct found *f,
+		   const char *expected)
+{
+	int i, errors = 0;
+
+	for (i = 0; i < all.count; i++) {
+		if (f->seen[i] == expected[i])
+			continue;
+		if (errors++ == 0)
+			printf("FAIL: %s %s map %d\n", what,
+			       f->seen[i] ? "returned" : "missed", i);
+	}
+	if (f->wrong_band) {
+		printf("FAIL: %s returned %d maps from other bands\n", what,
+		       f->wrong_band);
+		errors += f->wrong_band;
+	}
+	return errors;
+}
+
+static int check_marea(struct gpsnav *nav, struct gps_map *ref_map,
+		       const struct gps_marea *marea)
+{
+	struct gps_map *buf[MAX_MAPS];
+	char expected[MAX_MAPS];
+	struct found f, bands_f;
+	int bands[64];
+	int i, n, band_count, expected_count = 0, errors = 0;
+
+	for (i = 0; i < all.count; i++) {
+		expected[i] = same_projection(all.maps[i], ref_map) &&
+			in_marea(all.maps[i], marea);
+		expected_count += expected[i];
+	}
+
+	memset(&f, 0, sizeof(f));
+	gpsnav_for_each_map_in_marea(nav, ref_map, marea, note_map, &f);
+	errors += compare("gpsnav_for_each_map_in_marea()", &f, expected);
+
+	n = gpsnav_get_maps_for_marea(nav, ref_map, marea, buf, MAX_MAPS);
+	memset(&f, 0, sizeof(f));
+	for (i = 0; i < n && i < MAX_MAPS; i++)
+		note_map(buf[i], &f);
+	if (n != expected_count) {
+		printf("FAIL: gpsnav_get_maps_for_marea() returned %d maps, "
+		       "not %d\n", n, expected_count);
+		errors++;
+	}
+	errors += compare("gpsnav_get_maps_for_marea()", &f, expected);
+
+	band_count = gpsnav_get_marea_scale_bands(nav, ref_map, bands,
+						  sizeof(bands) / sizeof(bands[0]));
+	if (band_count != 2) {
+		printf("FAIL: %d scale bands, not 2\n", band_count);
+		errors++;
+	}
+	memset(&bands_f, 0, sizeof(bands_f));
+	for (i = 0; i < band_count && i < 64; i++) {
+		bands_f.band = bands[i];
+		gpsnav_for_each_map_in_marea_band(nav, ref_map, marea, bands[i],
+						  note_map, &bands_f);
+	}
+	errors += compare("gpsnav_for_each_map_in_marea_band()", &bands_f,
+			  expected);
+
+	return errors;
+}
+
+static int check_random_mareas(struct gpsnav *nav, struct gps_map *ref_map,
+			       const struct gps_marea *bounds)
+{
+	int i, errors = 0;
+
+	for (i = 0; i < QUERIES; i++) {
+		struct gps_marea marea;
+
+		marea.start.n = frand(bounds->start.n, bounds->end.n);
+		marea.start.e = frand(bounds->start.e, bounds->end.e);
+		marea.end.n = frand(marea.start.n, bounds->end.n);
+		marea.end.e = frand(marea.start.e, bounds->end.e);
+		errors += check_marea(nav, ref_map, &marea);
+	}
+	return errors;
+}
+
+static int check_area(struct gpsnav *nav, const struct gps_area *area)
+{
+	char expected[MAX_MAPS];
+	struct found f;
+	int i;
+
+	for (i = 0; i < all.count; i++)
+		expected[i] = in_area(all.maps[i], area);
+	memset(&f, 0, sizeof(f));
+	gpsnav_for_each_map_in_area(nav, area, note_map, &f);
+	return compare("gpsnav_for_each_map_in_area()", &f, expected);
+}
+
+int main(int argc, char *argv[])
+{
+	struct gpsnav *nav;
+	const struct gps_datum *kkj;
+	struct gps_area area;
+	struct gps_map *ref_maps[3];
+	struct gps_marea whole, everything;
+	char *projc[3];
+	PJ *merc, *kkj2, *kkj3;
+	int i, j, errors = 0;
+
+	if (gpsnav_init(&nav) < 0)
+		return 1;
+	projc[0] = "ellps=WGS84";
+	projc[1] = "proj=merc";
+	projc[2] = "no_defs";
+	merc = gpsnav_get_proj(nav, 3, projc);
+	kkj = gpsnav_find_datum(nav, "Finland Hayford");
+	if (merc == NULL || kkj == NULL)
+		return 1;
+	kkj2 = get_kkj_proj(nav, kkj, 24, 2500000);
+	kkj3 = get_kkj_proj(nav, kkj, 27, 3500000);
+	if (kkj2 == NULL || kkj3 == NULL)
+		return 1;
+
+	/* Each projection at two scales a factor of 8 apart */
+	area.start.la = 60.0;
+	area.start.lo = 24.0;
+	area.end.la = 61.0;
+	area.end.lo = 26.0;
+	if (add_grid(nav, merc, NULL, &area, 4, 256) < 0 ||
+	    add_grid(nav, merc, NULL, &area, 8, 1024) < 0)
+		return 1;
+	ref_maps[0] = all.maps[all.count - 1];
+	if (add_grid(nav, kkj3, kkj, &area, 4, 256) < 0 ||
+	    add_grid(nav, kkj3, kkj, &area, 8, 1024) < 0)
+		return 1;
+	ref_maps[1] = all.maps[all.count - 1];
+	if (add_grid(nav, kkj2, kkj, &area, 4, 256) < 0 ||
+	    add_grid(nav, kkj2, kkj, &area, 8, 1024) < 0)
+		return 1;
+	ref_maps[2] = all.maps[all.count - 1];
+
+	/* Metric areas of different projections are compared only
+	 * through the bounds of all maps, where the partitions must keep
+	 * them apart */
+	get_bounds(NULL, &everything);
+	srand(1);
+	for (i = 0; i < 3; i++) {
+		get_bounds(ref_maps[i], &whole);
+		errors += check_marea(nav, ref_maps[i], &whole);
+		errors += check_marea(nav, ref_maps[i], &everything);
+		errors += check_random_mareas(nav, ref_maps[i], &whole);
+		errors += check_random_mareas(nav, ref_maps[i], &everything);
+	}
+	for (j = 0; j < QUERIES; j++) {
+		struct gps_area a;
+
+		a.start.la = frand(59.9, 61.1);
+		a.start.lo = frand(23.9, 26.1);
+		a.end.la = frand(a.start.la, 61.1);
+		a.end.lo = frand(a.start.lo, 26.1);
+		errors += check_area(nav, &a);
+	}
+	printf("%d maps in 3 projections, %d queries: %d errors\n", all.count,
+	       3 * (2 * QUERIES + 2) + QUERIES, errors);
+
+	gpsnav_finish(nav);
+
+	return errors != 0;
+}
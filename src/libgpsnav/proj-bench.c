@@ -0,0 +1,318 @@
+/*
+ * Projection and datum microbenchmarks over fixed coordinate sets.
+ *
+ * Reports the cost per point of the proj4 projections and datum
+ * conversions gpsnav uses, and their error against closed-form or
+ * higher accuracy references, in ULPs or meters.
+ *
+ * Usage: gpsnav-proj-bench [rounds]
+ *
+ * Run by make check, which fails if an error is over its limit.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include <gpsnav/gpsnav.h>
+#include <gpsnav/map.h>
+#include <gpsnav/coord.h>
+
+#include <lib_proj.h>
+
+#include "tmerc.h"
+#include "bench.h"
+
+#define deg2rad(x)	((x) * M_PI / 180.0)
+
+/* Ground distance of a small lat/lon difference, in meters */
+#define METERS_PER_DEGREE	111320.0
+
+#define GRID_SIZE	64
+#define POINT_COUNT	(GRID_SIZE * GRID_SIZE)
+
+struct coord_set {
+	const char *name;
+	double start_la, end_la;
+	double start_lo, end_lo;
+};
+
+/* Finland, where the KKJ maps are, and most of the Mercator world */
+static const struct coord_set finland = { "Finland", 59.5, 70.0, 19.5, 31.5 };
+static const struct coord_set world = { "world", -80.0, 80.0, -179.0, 179.0 };
+
+static void fill_coords(const struct coord_set *set, struct gps_coord *c)
+{
+	int i, j;
+
+	for (j = 0; j < GRID_SIZE; j++) {
+		for (i = 0; i < GRID_SIZE; i++) {
+			c[j * GRID_SIZE + i].la = set->start_la + (j + 0.5) *
+				(set->end_la - set->start_la) / GRID_SIZE;
+			c[j * GRID_SIZE + i].lo = set->start_lo + (i + 0.5) *
+				(set->end_lo - set->start_lo) / GRID_SIZE;
+		}
+	}
+}
+
+static uint64_t ulp_diff(double a, double b)
+{
+	int64_t ia, ib;
+
+	memcpy(&ia, &a, sizeof(ia));
+	memcpy(&ib, &b, sizeof(ib));
+	/* Map the sign-magnitude ordering to two's complement */
+	if (ia < 0)
+		ia = INT64_MIN - ia;
+	if (ib < 0)
+		ib = INT64_MIN - ib;
+	return ia > ib ? ia - ib : ib - ia;
+}
+
+static double coord_distance(const struct gps_coord *a,
+			     const struct gps_coord *b)
+{
+	double dn, de;
+
+	dn = (a->la - b->la) * METERS_PER_DEGREE;
+	de = (a->lo - b->lo) * METERS_PER_DEGREE * cos(deg2rad(a->la));
+	return sqrt(dn * dn + de * de);
+}
+
+static void print_time(const char *what, double elapsed, int rounds)
+{
+	printf("  %-28s %8.1f ns/point\n", what,
+	       elapsed * 1e9 / ((double) POINT_COUNT * rounds));
+}
+
+/* Time pj_fwd/pj_inv and the batch conversions of a map using pj */
+static void time_projection(PJ *pj, const struct gps_coord *c, int rounds)
+{
+	static LP lp[POINT_COUNT];
+	static XY xy[POINT_COUNT];
+	static double la[POINT_COUNT], lo[POINT_COUNT];
+	static double n[POINT_COUNT], e[POINT_COUNT];
+	struct gps_map *map;
+	double start;
+	int i, r;
+
+	for (i = 0; i < POINT_COUNT; i++) {
+		lp[i].phi = deg2rad(c[i].la);
+		lp[i].lam = deg2rad(c[i].lo);
+		la[i] = c[i].la;
+		lo[i] = c[i].lo;
+	}
+
+	start = now();
+	for (r = 0; r < rounds; r++)
+		for (i = 0; i < POINT_COUNT; i++)
+			xy[i] = pj_fwd(lp[i], pj);
+	print_time("pj_fwd", now() - start, rounds);
+	start = now();
+	for (r = 0; r < rounds; r++)
+		for (i = 0; i < POINT_COUNT; i++)
+			lp[i] = pj_inv(xy[i], pj);
+	print_time("pj_inv", now() - start, rounds);
+
+	map = gps_map_new();
+	if (map == NULL)
+		return;
+	map->proj = pj;
+	start = now();
+	for (r = 0; r < rounds; r++)
+		gpsnav_get_metric_for_coords(map, POINT_COUNT, la, lo,
+					     sizeof(double), n, e,
+					     sizeof(double));
+	print_time("gpsnav_get_metric_for_coords", now() - start, rounds);
+	start = now();
+	for (r = 0; r < rounds; r++)
+		gpsnav_get_coords_for_metric(map, POINT_COUNT, n, e,
+					     sizeof(double), la, lo,
+					     sizeof(double));
+	print_time("gpsnav_get_coords_for_metric", now() - start, rounds);
+	free(map);
+}
+
+static int bench_merc(struct gpsnav *nav, int rounds)
+{
+	static struct gps_coord c[POINT_COUNT];
+	char *params[] = { "ellps=WGS84", "proj=merc", "no_defs" };
+	uint64_t ulp, max_ulp_x = 0, max_ulp_y = 0, max_ulp_inv = 0;
+	PJ *pj;
+	int i, fail;
+
+	pj = gpsnav_get_proj(nav, 3, params);
+	if (pj == NULL)
+		return 1;
+	fill_coords(&world, c);
+	for (i = 0; i < POINT_COUNT; i++) {
+		double phi = deg2rad(c[i].la), lam = deg2rad(c[i].lo);
+		double es = pj->e * sin(phi), x, y;
+		LP lp;
+		XY xy;
+
+		/* Closed form ellipsoidal Mercator */
+		x = pj->a * lam;
+		y = pj->a * log(tan(M_PI / 4 + phi / 2) *
+				pow((1 - es) / (1 + es), pj->e / 2));
+		lp.phi = phi;
+		lp.lam = lam;
+		xy = pj_fwd(lp, pj);
+		ulp = ulp_diff(xy.x, x);
+		if (ulp > max_ulp_x)
+			max_ulp_x = ulp;
+		ulp = ulp_diff(xy.y, y);
+		if (ulp > max_ulp_y)
+			max_ulp_y = ulp;
+		lp = pj_inv(xy, pj);
+		ulp = ulp_diff(lp.phi, phi);
+		if (ulp > max_ulp_inv)
+			max_ulp_inv = ulp;
+	}
+	printf("merc, %s, %d points\n", world.name, POINT_COUNT);
+	printf("  fwd error vs closed form: x %llu ULP, y %llu ULP; "
+	       "round trip latitude %llu ULP\n",
+	       (unsigned long long) max_ulp_x, (unsigned long long) max_ulp_y,
+	       (unsigned long long) max_ulp_inv);
+	/* 2^20 ULP of latitude is about a millimeter */
+	fail = bench_limit("fwd x ULP", max_ulp_x, 1024);
+	fail |= bench_limit("fwd y ULP", max_ulp_y, 1024);
+	fail |= bench_limit("round trip ULP", max_ulp_inv, 1 << 20);
+	time_projection(pj, c, rounds);
+
+	return fail;
+}
+
+static int bench_tmerc(struct gpsnav *nav, int rounds)
+{
+	static struct gps_coord c[POINT_COUNT];
+	char *params[] = { "ellps=intl", "proj=tmerc", "x_0=3500000",
+			   "lon_0=27" };
+	struct gps_tmerc *tm;
+	double d, max_fwd = 0, max_rt = 0;
+	PJ *pj;
+	int i, fail;
+
+	pj = gpsnav_get_proj(nav, 4, params);
+	if (pj == NULL)
+		return 1;
+	tm = gps_tmerc_new(pj);
+	if (tm == NULL)
+		return 1;
+	/* Within 3.5 degrees of the central meridian */
+	fill_coords(&finland, c);
+	for (i = 0; i < POINT_COUNT; i++)
+		c[i].lo = 23.5 + (c[i].lo - finland.start_lo) * 7.0 /
+			(finland.end_lo - finland.start_lo);
+	for (i = 0; i < POINT_COUNT; i++) {
+		LP lp, lp2;
+		XY xy, ref;
+
+		lp.phi = deg2rad(c[i].la);
+		lp.lam = deg2rad(c[i].lo);
+		/* The Kruger series is good to nanometers */
+		gps_tmerc_fwd(tm, &lp, &ref, 1);
+		xy = pj_fwd(lp, pj);
+		d = hypot(xy.x - ref.x, xy.y - ref.y);
+		if (d > max_fwd)
+			max_fwd = d;
+		lp2 = pj_inv(xy, pj);
+		gps_tmerc_fwd(tm, &lp2, &ref, 1);
+		d = hypot(xy.x - ref.x, xy.y - ref.y);
+		if (d > max_rt)
+			max_rt = d;
+	}
+	printf("tmerc (KKJ zone 3), %s, %d points\n", finland.name,
+	       POINT_COUNT);
+	printf("  error vs Kruger series: fwd %.6f m, round trip %.6f m\n",
+	       max_fwd, max_rt);
+	fail = bench_limit("fwd error", max_fwd, 0.001);
+	fail |= bench_limit("round trip error", max_rt, 0.001);
+	time_projection(pj, c, rounds);
+	gps_tmerc_free(tm);
+
+	return fail;
+}
+
+static int bench_datum(const struct gps_datum *dtm, int rounds)
+{
+	static struct gps_coord c[POINT_COUNT], tmp[POINT_COUNT];
+	struct gps_datum_transform to, from;
+	double start, d, max_rt = 0;
+	int i, r, fail;
+
+	fill_coords(&finland, c);
+	for (i = 0; i < POINT_COUNT; i++) {
+		struct gps_coord p = c[i];
+
+		gpsnav_convert_datum(&p, NULL, dtm);
+		gpsnav_convert_datum(&p, dtm, NULL);
+		d = coord_distance(&p, &c[i]);
+		if (d > max_rt)
+			max_rt = d;
+	}
+	printf("WGS 84 <-> %s, %s, %d points\n", dtm->name, finland.name,
+	       POINT_COUNT);
+	printf("  round trip error %.6f m\n", max_rt);
+	/* The polynomial fit of Finland Hayford is good to centimeters */
+	fail = bench_limit("round trip error", max_rt, 0.05);
+
+	start = now();
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < POINT_COUNT; i++) {
+			tmp[i] = c[i];
+			gpsnav_convert_datum(&tmp[i], NULL, dtm);
+		}
+	}
+	print_time("gpsnav_convert_datum to", now() - start, rounds);
+	start = now();
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < POINT_COUNT; i++) {
+			tmp[i] = c[i];
+			gpsnav_convert_datum(&tmp[i], dtm, NULL);
+		}
+	}
+	print_time("gpsnav_convert_datum from", now() - start, rounds);
+
+	gpsnav_init_datum_transform(&to, NULL, dtm);
+	gpsnav_init_datum_transform(&from, dtm, NULL);
+	start = now();
+	for (r = 0; r < rounds; r++) {
+		memcpy(tmp, c, sizeof(tmp));
+		gpsnav_transform_datum(&to, POINT_COUNT, &tmp[0].la,
+				       &tmp[0].lo, sizeof(tmp[0]));
+	}
+	print_time("gpsnav_transform_datum to", now() - start, rounds);
+	start = now();
+	for (r = 0; r < rounds; r++) {
+		memcpy(tmp, c, sizeof(tmp));
+		gpsnav_transform_datum(&from, POINT_COUNT, &tmp[0].la,
+				       &tmp[0].lo, sizeof(tmp[0]));
+	}
+	print_time("gpsnav_transform_datum from", now() - start, rounds);
+
+	return fail;
+}
+
+int main(int argc, char *argv[])
+{
+	struct gpsnav *nav;
+	const struct gps_datum *dtm;
+	int rounds, fail;
+
+	rounds = argc > 1 ? atoi(argv[1]) : 50;
+
+	if (gpsnav_init(&nav) < 0)
+		return 1;
+	fail = bench_merc(nav, rounds);
+	fail |= bench_tmerc(nav, rounds);
+	/* Polynomial fit and geocentric shift */
+	dtm = gpsnav_find_datum(nav, "Finland Hayford");
+	fail |= dtm == NULL || bench_datum(dtm, rounds);
+	dtm = gpsnav_find_datum(nav, "European 1950");
+	fail |= dtm == NULL || bench_datum(dtm, rounds);
+	gpsnav_finish(nav);
+
+	return fail;
+}
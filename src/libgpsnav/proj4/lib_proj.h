@@ -69,7 +69,13 @@ typedef struct { double x, y; }     XY;
 typedef struct { double lam, phi; } LP;
 #endif
 
-	extern int		/* global error return code */
+/* The error state is per thread, so that shared PJ objects can be used
+** for projecting from several threads at once. Like errno, pj_errno
+** is only meaningful right after a failed call in the same thread. */
+#ifndef PJ_THREAD_LOCAL
+#define PJ_THREAD_LOCAL __thread
+#endif
+	extern PJ_THREAD_LOCAL int	/* per-thread error return code */
 pj_errno;
 
 typedef union { double  f; int  i; const char *s; } PVALUE;
@@ -28,8 +28,9 @@ LIBPROJ_ID[] = "$Id: pj_errno.c,v 2.1 2003/03/28 01:44:30 gie Distr. gie $";
 /* 
 ** For full ANSI compliance of global variable
 */
+#include <lib_proj.h>
 
-int pj_errno = 0;
+PJ_THREAD_LOCAL int pj_errno = 0;
 /*
 ** $Log: pj_errno.c,v $
 ** Revision 2.1  2003/03/28 01:44:30  gie
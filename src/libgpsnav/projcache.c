@@ -0,0 +1,162 @@
+/*
+ * Projection cache
+ *
+ * PJ objects are interned by their normalized parameter list and owned
+ * by the gpsnav instance, so maps, providers and tools using the same
+ * projection share one PJ instead of running pj_init() again. The
+ * cache can be used from several threads; projecting with a shared
+ * PJ is safe as proj4 keeps its error state per thread.
+ *
+ * Transverse Mercator entries also get a fast path engine, see tmerc.c.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+
+#include <gpsnav/gpsnav.h>
+#include <gpsnav/coord.h>
+#include <lib_proj.h>
+
+#include "tmerc.h"
+
+struct gps_proj_cache_entry {
+	char *params;
+	PJ *pj;
+	struct gps_tmerc *tmerc;
+
+	LIST_ENTRY(gps_proj_cache_entry) entries;
+};
+
+static pthread_mutex_t proj_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *skip_prefix(const char *arg)
+{
+	while (isspace((unsigned char) *arg) || *arg == '+')
+		arg++;
+	return arg;
+}
+
+/* Compares the "key" parts of "key=value" parameters */
+static int compare_keys(const char *a, const char *b)
+{
+	int ca, cb;
+
+	do {
+		ca = *a == '=' ? '\0' : (unsigned char) *a++;
+		cb = *b == '=' ? '\0' : (unsigned char) *b++;
+	} while (ca != '\0' && ca == cb);
+
+	return ca - cb;
+}
+
+/* Sorts the parameters by key, keeping the order of repeated keys, and
+ * joins them with spaces. Returns NULL if out of memory. */
+static char *normalize_params(int argc, char **argv)
+{
+	const char **args;
+	char *params, *p;
+	size_t len;
+	int i, j;
+
+	args = malloc((argc + 1) * sizeof(*args));
+	if (args == NULL)
+		return NULL;
+	len = 1;
+	for (i = 0; i < argc; i++) {
+		const char *arg = skip_prefix(argv[i]);
+
+		for (j = i; j > 0 && compare_keys(args[j - 1], arg) > 0; j--)
+			args[j] = args[j - 1];
+		args[j] = arg;
+		len += strlen(arg) + 1;
+	}
+	params = malloc(len);
+	if (params == NULL) {
+		free(args);
+		return NULL;
+	}
+	p = params;
+	for (i = 0; i < argc; i++) {
+		len = strlen(args[i]);
+		while (len > 0 && isspace((unsigned char) args[i][len - 1]))
+			len--;
+		if (i > 0)
+			*p++ = ' ';
+		memcpy(p, args[i], len);
+		p += len;
+	}
+	*p = '\0';
+	free(args);
+
+	return params;
+}
+
+void *gpsnav_get_proj(struct gpsnav *gpsnav, int argc, char **argv)
+{
+	struct gps_proj_cache_entry *e;
+	char *params;
+	PJ *pj;
+
+	params = normalize_params(argc, argv);
+	if (params == NULL)
+		return NULL;
+
+	pthread_mutex_lock(&proj_cache_lock);
+	for (e = gpsnav->proj_cache.lh_first; e != NULL; e = e->entries.le_next) {
+		if (strcmp(e->params, params) == 0) {
+			pj = e->pj;
+			goto out;
+		}
+	}
+
+	pj = NULL;
+	e = malloc(sizeof(*e));
+	if (e == NULL)
+		goto out;
+	pj = pj_init(argc, argv);
+	if (pj == NULL) {
+		free(e);
+		goto out;
+	}
+	e->params = params;
+	e->pj = pj;
+	e->tmerc = gps_tmerc_new(pj);
+	LIST_INSERT_HEAD(&gpsnav->proj_cache, e, entries);
+	params = NULL;
+out:
+	pthread_mutex_unlock(&proj_cache_lock);
+	free(params);
+
+	return pj;
+}
+
+struct gps_tmerc *gpsnav_get_tmerc(struct gpsnav *gpsnav, PJ *pj)
+{
+	struct gps_proj_cache_entry *e;
+	struct gps_tmerc *tm = NULL;
+
+	pthread_mutex_lock(&proj_cache_lock);
+	for (e = gpsnav->proj_cache.lh_first; e != NULL; e = e->entries.le_next) {
+		if (e->pj == pj) {
+			tm = e->tmerc;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&proj_cache_lock);
+
+	return tm;
+}
+
+void gpsnav_purge_proj_cache(struct gpsnav *gpsnav)
+{
+	struct gps_proj_cache_entry *e;
+
+	while ((e = gpsnav->proj_cache.lh_first) != NULL) {
+		LIST_REMOVE(e, entries);
+		gps_tmerc_free(e->tmerc);
+		pj_free(e->pj);
+		free(e->params);
+		free(e);
+	}
+}
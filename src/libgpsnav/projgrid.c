@@ -0,0 +1,280 @@
+/*
+ * Interpolated coordinate conversions
+ *
+ * For interactive use (pointer tracking, follow mode) a map can carry
+ * grids of exact forward and inverse projection samples. A conversion
+ * inside the map extent is then a bilinear lookup in the grid; outside
+ * of it, the exact projection is used.
+ *
+ * A grid is built on first use. It starts with PROJ_GRID_MIN_CELLS
+ * cells per side and is refined until the interpolation error, measured
+ * against the exact projection PROJ_GRID_ERR_STEPS times along each
+ * side of every cell, edges included, is below GPS_PROJ_GRID_MAX_ERROR
+ * meters. If even PROJ_GRID_MAX_CELLS does not get there, or the grid
+ * cannot be allocated, the map always uses the exact projection.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#include <gpsnav/gpsnav.h>
+#include <gpsnav/map.h>
+#include <gpsnav/coord.h>
+
+#include "projgrid.h"
+
+#define PROJ_GRID_MIN_CELLS	16
+#define PROJ_GRID_MAX_CELLS	128
+/* Error samples per cell side */
+#define PROJ_GRID_ERR_STEPS	2
+
+/* Meters per degree of latitude, close enough for error estimates */
+#define METERS_PER_DEGREE	111320.0
+
+struct interp_grid {
+	int cells;		/* per side, 0 means use exact conversion */
+	double x0, y0, dx, dy;	/* domain start and cell size */
+	double *u, *v;		/* (cells + 1)^2 samples, row-major in y */
+	double max_err;		/* meters */
+};
+
+struct gps_proj_grid {
+	struct interp_grid fwd, inv;
+	int fwd_built:1, inv_built:1;
+};
+
+static pthread_mutex_t grid_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void free_interp_grid(struct interp_grid *g)
+{
+	free(g->u);
+	free(g->v);
+	g->u = g->v = NULL;
+	g->cells = 0;
+}
+
+void gps_proj_grid_free(struct gps_proj_grid *grid)
+{
+	if (grid == NULL)
+		return;
+	free_interp_grid(&grid->fwd);
+	free_interp_grid(&grid->inv);
+	free(grid);
+}
+
+/* Interpolates at grid position (fx, fy), in cells from the start */
+static void interpolate_cell(const struct interp_grid *g, double fx, double fy,
+			     double *u, double *v)
+{
+	double tx, ty;
+	int i, j, k, stride;
+
+	i = fx;
+	j = fy;
+	if (i == g->cells)
+		i--;
+	if (j == g->cells)
+		j--;
+	tx = fx - i;
+	ty = fy - j;
+	stride = g->cells + 1;
+	k = j * stride + i;
+	*u = (1 - ty) * ((1 - tx) * g->u[k] + tx * g->u[k + 1]) +
+		ty * ((1 - tx) * g->u[k + stride] + tx * g->u[k + stride + 1]);
+	*v = (1 - ty) * ((1 - tx) * g->v[k] + tx * g->v[k + 1]) +
+		ty * ((1 - tx) * g->v[k + stride] + tx * g->v[k + stride + 1]);
+}
+
+static int interpolate(const struct interp_grid *g, double x, double y,
+		       double *u, double *v)
+{
+	double fx, fy;
+
+	fx = (x - g->x0) / g->dx;
+	fy = (y - g->y0) / g->dy;
+	if (!(fx >= 0 && fx <= g->cells && fy >= 0 && fy <= g->cells))
+		return -1;
+	interpolate_cell(g, fx, fy, u, v);
+
+	return 0;
+}
+
+/* Converts count points from (x, y) to (u, v) exactly */
+typedef void (* exact_fn)(struct gps_map *map, int count,
+			  const double *x, const double *y, size_t in_stride,
+			  double *u, double *v, size_t out_stride);
+
+static void fwd_exact(struct gps_map *map, int count,
+		      const double *lo, const double *la, size_t in_stride,
+		      double *e, double *n, size_t out_stride)
+{
+	gpsnav_get_metric_for_coords(map, count, la, lo, in_stride,
+				     n, e, out_stride);
+}
+
+static void inv_exact(struct gps_map *map, int count,
+		      const double *e, const double *n, size_t in_stride,
+		      double *lo, double *la, size_t out_stride)
+{
+	gpsnav_get_coords_for_metric(map, count, n, e, in_stride,
+				     la, lo, out_stride);
+}
+
+static void sample_grid(struct gps_map *map, struct interp_grid *g,
+			exact_fn exact, double *x, double *y)
+{
+	int i, j, k, n;
+
+	n = g->cells + 1;
+	k = 0;
+	for (j = 0; j < n; j++) {
+		for (i = 0; i < n; i++, k++) {
+			x[k] = g->x0 + i * g->dx;
+			y[k] = g->y0 + j * g->dy;
+		}
+	}
+	exact(map, k, x, y, sizeof(double), g->u, g->v, sizeof(double));
+}
+
+/* The largest interpolation error over a lattice of
+ * PROJ_GRID_ERR_STEPS samples per cell side, taken a row at a time.
+ * Stops early once the grid is known to be too coarse. */
+static double grid_error(struct gps_map *map, const struct interp_grid *g,
+			 exact_fn exact, int metric, double *x, double *y,
+			 double *u, double *v)
+{
+	double max_err = 0;
+	int i, j, n;
+
+	n = g->cells * PROJ_GRID_ERR_STEPS + 1;
+	for (j = 0; j < n && max_err <= GPS_PROJ_GRID_MAX_ERROR; j++) {
+		double fy = (double) j / PROJ_GRID_ERR_STEPS;
+
+		for (i = 0; i < n; i++) {
+			x[i] = g->x0 + (double) i / PROJ_GRID_ERR_STEPS * g->dx;
+			y[i] = g->y0 + fy * g->dy;
+		}
+		exact(map, n, x, y, sizeof(double), u, v, sizeof(double));
+		for (i = 0; i < n; i++) {
+			double iu, iv, du, dv, err;
+
+			interpolate_cell(g, (double) i / PROJ_GRID_ERR_STEPS,
+					 fy, &iu, &iv);
+			du = iu - u[i];
+			dv = iv - v[i];
+			if (!metric) {
+				/* u is longitude, v latitude */
+				du *= METERS_PER_DEGREE * cos(deg2rad(v[i]));
+				dv *= METERS_PER_DEGREE;
+			}
+			err = sqrt(du * du + dv * dv);
+			/* Also catches NaN and HUGE_VAL samples */
+			if (!(err <= max_err))
+				max_err = isnan(err) ? HUGE_VAL : err;
+		}
+	}
+	return max_err;
+}
+
+/* Leaves g->cells at 0 if no good enough grid could be built */
+static void build_interp_grid(struct gps_map *map, struct interp_grid *g,
+			      double x0, double y0, double x1, double y1,
+			      exact_fn exact, int metric)
+{
+	double *x, *y, *u, *v;
+	int cells, max_nodes, max_row;
+
+	memset(g, 0, sizeof(*g));
+	if (!(x1 > x0 && y1 > y0))
+		return;
+
+	max_nodes = (PROJ_GRID_MAX_CELLS + 1) * (PROJ_GRID_MAX_CELLS + 1);
+	max_row = PROJ_GRID_MAX_CELLS * PROJ_GRID_ERR_STEPS + 1;
+	x = malloc((2 * max_nodes + 2 * max_row) * sizeof(double));
+	if (x == NULL)
+		return;
+	y = x + max_nodes;
+	u = y + max_nodes;
+	v = u + max_row;
+
+	for (cells = PROJ_GRID_MIN_CELLS; cells <= PROJ_GRID_MAX_CELLS;
+	     cells *= 2) {
+		int nodes = (cells + 1) * (cells + 1);
+
+		free_interp_grid(g);
+		g->x0 = x0;
+		g->y0 = y0;
+		g->dx = (x1 - x0) / cells;
+		g->dy = (y1 - y0) / cells;
+		g->cells = cells;
+		g->u = malloc(nodes * sizeof(double));
+		g->v = malloc(nodes * sizeof(double));
+		if (g->u == NULL || g->v == NULL)
+			break;
+		sample_grid(map, g, exact, x, y);
+		g->max_err = grid_error(map, g, exact, metric, x, y, u, v);
+		if (g->max_err <= GPS_PROJ_GRID_MAX_ERROR) {
+			free(x);
+			return;
+		}
+	}
+	free(x);
+	free_interp_grid(g);
+}
+
+static struct gps_proj_grid *get_grid(struct gps_map *map, int inverse)
+{
+	struct gps_proj_grid *grid;
+
+	pthread_mutex_lock(&grid_lock);
+	grid = map->grid;
+	if (grid == NULL) {
+		grid = malloc(sizeof(*grid));
+		if (grid == NULL)
+			goto out;
+		memset(grid, 0, sizeof(*grid));
+		map->grid = grid;
+	}
+	/* A grid is only tried once, even if it could not be built */
+	if (inverse && !grid->inv_built) {
+		build_interp_grid(map, &grid->inv,
+				  map->marea.start.e, map->marea.start.n,
+				  map->marea.end.e, map->marea.end.n,
+				  inv_exact, 0);
+		grid->inv_built = 1;
+	} else if (!inverse && !grid->fwd_built) {
+		build_interp_grid(map, &grid->fwd,
+				  map->area.start.lo, map->area.start.la,
+				  map->area.end.lo, map->area.end.la,
+				  fwd_exact, 1);
+		grid->fwd_built = 1;
+	}
+out:
+	pthread_mutex_unlock(&grid_lock);
+	return grid;
+}
+
+void gpsnav_get_metric_for_coord_interp(struct gps_map *map,
+					const struct gps_coord *coord,
+					struct gps_mcoord *out)
+{
+	struct gps_proj_grid *grid;
+
+	grid = get_grid(map, 0);
+	if (grid == NULL || grid->fwd.cells == 0 ||
+	    interpolate(&grid->fwd, coord->lo, coord->la, &out->e, &out->n) < 0)
+		gpsnav_get_metric_for_coord(map, coord, out);
+}
+
+void gpsnav_get_coord_for_metric_interp(struct gps_map *map,
+					const struct gps_mcoord *mcoord,
+					struct gps_coord *coord)
+{
+	struct gps_proj_grid *grid;
+
+	grid = get_grid(map, 1);
+	if (grid == NULL || grid->inv.cells == 0 ||
+	    interpolate(&grid->inv, mcoord->e, mcoord->n, &coord->lo, &coord->la) < 0)
+		gpsnav_get_coord_for_metric(map, mcoord, coord);
+}
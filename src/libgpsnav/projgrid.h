@@ -0,0 +1,8 @@
+#ifndef GPSNAV_PROJGRID_H
+#define GPSNAV_PROJGRID_H
+
+struct gps_proj_grid;
+
+extern void gps_proj_grid_free(struct gps_proj_grid *grid);
+
+#endif
@@ -0,0 +1,350 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <gpsnav/gpsnav.h>
+#include <gpsnav/coord.h>
+
+#include "rtree.h"
+
+#define RTREE_MAX_ENTRIES	8
+#define RTREE_MIN_ENTRIES	3
+
+struct rtree_node {
+	int level;		/* 0 for leaves */
+	int count;
+	struct gps_area box[RTREE_MAX_ENTRIES];
+	void *ptr[RTREE_MAX_ENTRIES];	/* child nodes or leaf data */
+};
+
+struct gps_rtree {
+	struct rtree_node *root;
+	int count;
+
+	/* Nodes allocated in advance, so that an insert cannot fail
+	 * half-way through a split */
+	struct rtree_node *spare;
+	int spare_count;
+};
+
+static double box_area(const struct gps_area *a)
+{
+	return (a->end.la - a->start.la) * (a->end.lo - a->start.lo);
+}
+
+static void box_union(const struct gps_area *a, const struct gps_area *b,
+		      struct gps_area *out)
+{
+	out->start.la = a->start.la < b->start.la ? a->start.la : b->start.la;
+	out->start.lo = a->start.lo < b->start.lo ? a->start.lo : b->start.lo;
+	out->end.la = a->end.la > b->end.la ? a->end.la : b->end.la;
+	out->end.lo = a->end.lo > b->end.lo ? a->end.lo : b->end.lo;
+}
+
+static double box_enlargement(const struct gps_area *a, const struct gps_area *b)
+{
+	struct gps_area u;
+
+	box_union(a, b, &u);
+	return box_area(&u) - box_area(a);
+}
+
+static int box_overlaps(const struct gps_area *a, const struct gps_area *b)
+{
+	return a->start.la <= b->end.la && b->start.la <= a->end.la &&
+	       a->start.lo <= b->end.lo && b->start.lo <= a->end.lo;
+}
+
+static void node_cover(const struct rtree_node *n, struct gps_area *out)
+{
+	int i;
+
+	*out = n->box[0];
+	for (i = 1; i < n->count; i++)
+		box_union(out, &n->box[i], out);
+}
+
+static void node_add(struct rtree_node *n, const struct gps_area *box, void *ptr)
+{
+	n->box[n->count] = *box;
+	n->ptr[n->count] = ptr;
+	n->count++;
+}
+
+static struct rtree_node *get_spare(struct gps_rtree *tree)
+{
+	struct rtree_node *n;
+
+	n = tree->spare;
+	tree->spare = n->ptr[0];
+	tree->spare_count--;
+	memset(n, 0, sizeof(*n));
+	return n;
+}
+
+int gps_rtree_reserve(struct gps_rtree *tree)
+{
+	struct rtree_node *n;
+	int need;
+
+	/* Worst case: a split on every level plus a new root */
+	need = (tree->root != NULL ? tree->root->level : 0) + 2;
+	while (tree->spare_count < need) {
+		n = malloc(sizeof(*n));
+		if (n == NULL)
+			return -ENOMEM;
+		n->ptr[0] = tree->spare;
+		tree->spare = n;
+		tree->spare_count++;
+	}
+	return 0;
+}
+
+static int pick_next(const struct gps_area *boxes, const int *assigned,
+		     int total, const struct gps_area *cover)
+{
+	double d0, d1, diff, best_diff;
+	int i, best;
+
+	best = -1;
+	best_diff = -1;
+	for (i = 0; i < total; i++) {
+		if (assigned[i])
+			continue;
+		d0 = box_enlargement(&cover[0], &boxes[i]);
+		d1 = box_enlargement(&cover[1], &boxes[i]);
+		diff = fabs(d0 - d1);
+		if (diff > best_diff) {
+			best_diff = diff;
+			best = i;
+		}
+	}
+	return best;
+}
+
+/* Distributes the entries of the full node n plus the new entry
+ * between n and sib */
+static void quadratic_split(struct rtree_node *n, const struct gps_area *box,
+			    void *ptr, struct rtree_node *sib)
+{
+	struct gps_area boxes[RTREE_MAX_ENTRIES + 1], cover[2], u;
+	void *ptrs[RTREE_MAX_ENTRIES + 1];
+	int assigned[RTREE_MAX_ENTRIES + 1];
+	struct rtree_node *group[2];
+	int total, left, i, j, g, s1, s2;
+	double worst, d, d0, d1;
+
+	total = n->count + 1;
+	memcpy(boxes, n->box, sizeof(n->box));
+	memcpy(ptrs, n->ptr, sizeof(n->ptr));
+	boxes[n->count] = *box;
+	ptrs[n->count] = ptr;
+	memset(assigned, 0, sizeof(assigned));
+
+	/* Seed the groups with the pair that would waste the most area
+	 * if put together */
+	s1 = 0;
+	s2 = 1;
+	worst = -1;
+	for (i = 0; i < total; i++) {
+		for (j = i + 1; j < total; j++) {
+			box_union(&boxes[i], &boxes[j], &u);
+			d = box_area(&u) - box_area(&boxes[i]) - box_area(&boxes[j]);
+			if (d > worst) {
+				worst = d;
+				s1 = i;
+				s2 = j;
+			}
+		}
+	}
+
+	group[0] = n;
+	group[1] = sib;
+	n->count = 0;
+	sib->count = 0;
+	sib->level = n->level;
+	node_add(n, &boxes[s1], ptrs[s1]);
+	node_add(sib, &boxes[s2], ptrs[s2]);
+	cover[0] = boxes[s1];
+	cover[1] = boxes[s2];
+	assigned[s1] = assigned[s2] = 1;
+
+	for (left = total - 2; left > 0; left--) {
+		for (g = 0; g < 2; g++)
+			if (group[g]->count + left <= RTREE_MIN_ENTRIES)
+				break;
+		if (g < 2) {
+			/* This group needs all the rest to reach the minimum */
+			for (i = 0; i < total; i++) {
+				if (assigned[i])
+					continue;
+				node_add(group[g], &boxes[i], ptrs[i]);
+				assigned[i] = 1;
+			}
+			break;
+		}
+
+		i = pick_next(boxes, assigned, total, cover);
+		d0 = box_enlargement(&cover[0], &boxes[i]);
+		d1 = box_enlargement(&cover[1], &boxes[i]);
+		if (d0 != d1)
+			g = d0 < d1 ? 0 : 1;
+		else if (box_area(&cover[0]) != box_area(&cover[1]))
+			g = box_area(&cover[0]) < box_area(&cover[1]) ? 0 : 1;
+		else
+			g = n->count <= sib->count ? 0 : 1;
+		node_add(group[g], &boxes[i], ptrs[i]);
+		box_union(&cover[g], &boxes[i], &cover[g]);
+		assigned[i] = 1;
+	}
+}
+
+static int choose_subtree(const struct rtree_node *n, const struct gps_area *box)
+{
+	double d, best_d, area, best_area;
+	int i, best;
+
+	best = 0;
+	best_d = box_enlargement(&n->box[0], box);
+	best_area = box_area(&n->box[0]);
+	for (i = 1; i < n->count; i++) {
+		d = box_enlargement(&n->box[i], box);
+		area = box_area(&n->box[i]);
+		if (d < best_d || (d == best_d && area < best_area)) {
+			best = i;
+			best_d = d;
+			best_area = area;
+		}
+	}
+	return best;
+}
+
+/* Returns the new sibling node if n had to be split */
+static struct rtree_node *node_insert(struct gps_rtree *tree,
+				      struct rtree_node *n,
+				      const struct gps_area *box, void *data)
+{
+	struct rtree_node *child, *sib, *new_sib;
+	struct gps_area sib_box;
+	int i;
+
+	if (n->level == 0) {
+		if (n->count < RTREE_MAX_ENTRIES) {
+			node_add(n, box, data);
+			return NULL;
+		}
+		sib = get_spare(tree);
+		quadratic_split(n, box, data, sib);
+		return sib;
+	}
+
+	i = choose_subtree(n, box);
+	child = n->ptr[i];
+	sib = node_insert(tree, child, box, data);
+	node_cover(child, &n->box[i]);
+	if (sib == NULL)
+		return NULL;
+
+	node_cover(sib, &sib_box);
+	if (n->count < RTREE_MAX_ENTRIES) {
+		node_add(n, &sib_box, sib);
+		return NULL;
+	}
+	new_sib = get_spare(tree);
+	quadratic_split(n, &sib_box, sib, new_sib);
+	return new_sib;
+}
+
+int gps_rtree_insert(struct gps_rtree *tree, const struct gps_area *area,
+		     void *data)
+{
+	struct rtree_node *root, *sib;
+	int r;
+
+	r = gps_rtree_reserve(tree);
+	if (r < 0)
+		return r;
+
+	if (tree->root == NULL)
+		tree->root = get_spare(tree);
+	sib = node_insert(tree, tree->root, area, data);
+	if (sib != NULL) {
+		root = get_spare(tree);
+		root->level = tree->root->level + 1;
+		node_cover(tree->root, &root->box[0]);
+		root->ptr[0] = tree->root;
+		node_cover(sib, &root->box[1]);
+		root->ptr[1] = sib;
+		root->count = 2;
+		tree->root = root;
+	}
+	tree->count++;
+
+	return 0;
+}
+
+static int node_search(const struct rtree_node *n, const struct gps_area *area,
+		       int (* cb)(void *data, void *arg), void *arg)
+{
+	int i, r;
+
+	for (i = 0; i < n->count; i++) {
+		if (!box_overlaps(&n->box[i], area))
+			continue;
+		if (n->level == 0)
+			r = cb(n->ptr[i], arg);
+		else
+			r = node_search(n->ptr[i], area, cb, arg);
+		if (r)
+			return r;
+	}
+	return 0;
+}
+
+/* Calls cb for every entry whose rectangle touches area. A non-zero
+ * return value from cb stops the search and is passed on. */
+int gps_rtree_search(const struct gps_rtree *tree, const struct gps_area *area,
+		     int (* cb)(void *data, void *arg), void *arg)
+{
+	if (tree->root == NULL)
+		return 0;
+	return node_search(tree->root, area, cb, arg);
+}
+
+int gps_rtree_count(const struct gps_rtree *tree)
+{
+	return tree->count;
+}
+
+struct gps_rtree *gps_rtree_new(void)
+{
+	struct gps_rtree *tree;
+
+	tree = malloc(sizeof(*tree));
+	if (tree == NULL)
+		return NULL;
+	memset(tree, 0, sizeof(*tree));
+
+	return tree;
+}
+
+static void node_free(struct rtree_node *n)
+{
+	int i;
+
+	if (n->level > 0)
+		for (i = 0; i < n->count; i++)
+			node_free(n->ptr[i]);
+	free(n);
+}
+
+void gps_rtree_free(struct gps_rtree *tree)
+{
+	if (tree == NULL)
+		return;
+	if (tree->root != NULL)
+		node_free(tree->root);
+	while (tree->spare != NULL)
+		free(get_spare(tree));
+	free(tree);
+}
@@ -0,0 +1,22 @@
+#ifndef GPSNAV_RTREE_H
+#define GPSNAV_RTREE_H
+
+#include <gpsnav/coord.h>
+
+/* A simple insert-only R-tree (Guttman, quadratic split) over
+ * rectangles. Metric areas are stored by casting them to struct
+ * gps_area, just like gpsnav_calc_metric_isect() does. */
+
+struct gps_rtree;
+
+extern struct gps_rtree *gps_rtree_new(void);
+extern void gps_rtree_free(struct gps_rtree *tree);
+extern int gps_rtree_reserve(struct gps_rtree *tree);
+extern int gps_rtree_insert(struct gps_rtree *tree, const struct gps_area *area,
+			    void *data);
+extern int gps_rtree_search(const struct gps_rtree *tree,
+			    const struct gps_area *area,
+			    int (* cb)(void *data, void *arg), void *arg);
+extern int gps_rtree_count(const struct gps_rtree *tree);
+
+#endif
@@ -0,0 +1,112 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include "strset.h"
+
+#define STRSET_MIN_SIZE	64
+
+struct gps_strset {
+	const char **slots;
+	uint32_t *hashes;
+	unsigned int size, count;	/* size is a power of two */
+};
+
+/* FNV-1a */
+static uint32_t hash_str(const char *str)
+{
+	uint32_t h = 2166136261U;
+
+	while (*str != '\0') {
+		h ^= (unsigned char) *str++;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+struct gps_strset *gps_strset_new(void)
+{
+	struct gps_strset *set;
+
+	set = malloc(sizeof(*set));
+	if (set == NULL)
+		return NULL;
+	memset(set, 0, sizeof(*set));
+
+	return set;
+}
+
+void gps_strset_free(struct gps_strset *set)
+{
+	if (set == NULL)
+		return;
+	free(set->slots);
+	free(set->hashes);
+	free(set);
+}
+
+static void insert_slot(const char **slots, uint32_t *hashes,
+			unsigned int size, const char *str, uint32_t h)
+{
+	unsigned int i;
+
+	for (i = h & (size - 1); slots[i] != NULL; i = (i + 1) & (size - 1));
+	slots[i] = str;
+	hashes[i] = h;
+}
+
+/* Makes sure the next gps_strset_insert() has room. The table is kept
+ * at most half full, so that linear probing stays short. */
+int gps_strset_reserve(struct gps_strset *set)
+{
+	const char **slots;
+	uint32_t *hashes;
+	unsigned int size, i;
+
+	if (2 * (set->count + 1) <= set->size)
+		return 0;
+
+	size = set->size ? set->size * 2 : STRSET_MIN_SIZE;
+	slots = calloc(size, sizeof(*slots));
+	hashes = malloc(size * sizeof(*hashes));
+	if (slots == NULL || hashes == NULL) {
+		free(slots);
+		free(hashes);
+		return -ENOMEM;
+	}
+	for (i = 0; i < set->size; i++) {
+		if (set->slots[i] != NULL)
+			insert_slot(slots, hashes, size, set->slots[i],
+				    set->hashes[i]);
+	}
+	free(set->slots);
+	free(set->hashes);
+	set->slots = slots;
+	set->hashes = hashes;
+	set->size = size;
+
+	return 0;
+}
+
+void gps_strset_insert(struct gps_strset *set, const char *str)
+{
+	insert_slot(set->slots, set->hashes, set->size, str, hash_str(str));
+	set->count++;
+}
+
+int gps_strset_contains(const struct gps_strset *set, const char *str)
+{
+	unsigned int i;
+	uint32_t h;
+
+	if (set->count == 0)
+		return 0;
+	h = hash_str(str);
+	for (i = h & (set->size - 1); set->slots[i] != NULL;
+	     i = (i + 1) & (set->size - 1)) {
+		if (set->hashes[i] == h && strcmp(set->slots[i], str) == 0)
+			return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,15 @@
+#ifndef GPSNAV_STRSET_H
+#define GPSNAV_STRSET_H
+
+/* An insert-only hash set of strings. The strings are not copied, so
+ * they have to stay around for the lifetime of the set. */
+
+struct gps_strset;
+
+extern struct gps_strset *gps_strset_new(void);
+extern void gps_strset_free(struct gps_strset *set);
+extern int gps_strset_reserve(struct gps_strset *set);
+extern void gps_strset_insert(struct gps_strset *set, const char *str);
+extern int gps_strset_contains(const struct gps_strset *set, const char *str);
+
+#endif
@@ -0,0 +1,154 @@
+/*
+ * Transverse Mercator benchmark: the Kruger series fast path against
+ * PJ_tmerc, on KKJ and UTM style grids.
+ *
+ * Usage: gpsnav-tmerc-bench [points] [rounds]
+ *
+ * Run by make check, which fails if an error is over its limit.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include <lib_proj.h>
+
+#include "tmerc.h"
+#include "bench.h"
+
+#define deg2rad(x)	((x) * M_PI / 180.0)
+
+struct test_proj {
+	const char *name;
+	char *params[6];
+	int param_count;
+	double lo0;
+};
+
+static const struct test_proj test_projs[] = {
+	{ "KKJ zone 3", { "ellps=intl", "proj=tmerc", "x_0=3500000",
+			  "lon_0=27" }, 4, 27.0 },
+	{ "UTM 35N", { "ellps=WGS84", "proj=tmerc", "k=0.9996",
+		       "x_0=500000", "lon_0=27" }, 5, 27.0 },
+	{ "UTM 35S", { "ellps=WGS84", "proj=tmerc", "k=0.9996",
+		       "x_0=500000", "y_0=10000000", "lon_0=27" }, 6, 27.0 },
+};
+
+/* Returns nonzero if the fast path is missing or too far off */
+static int bench_proj(const struct test_proj *tp, int points, int rounds)
+{
+	struct gps_tmerc *tm;
+	LP *lp, *lp2;
+	XY *xy, *xy2;
+	PJ *pj;
+	double start, t_pj, t_fast, d, max_fwd, max_inv, max_rt;
+	double sign;
+	int i, r, fail;
+
+	pj = pj_init(tp->param_count, (char **) tp->params);
+	if (pj == NULL) {
+		fprintf(stderr, "%s: pj_init failed\n", tp->name);
+		return 1;
+	}
+	tm = gps_tmerc_new(pj);
+	if (tm == NULL) {
+		fprintf(stderr, "%s: no fast path\n", tp->name);
+		pj_free(pj);
+		return 1;
+	}
+	lp = malloc(points * sizeof(*lp));
+	lp2 = malloc(points * sizeof(*lp2));
+	xy = malloc(points * sizeof(*xy));
+	xy2 = malloc(points * sizeof(*xy2));
+	if (lp == NULL || lp2 == NULL || xy == NULL || xy2 == NULL)
+		exit(1);
+
+	/* Within 3.5 degrees of the central meridian, like the maps */
+	sign = strstr(tp->name, "S") != NULL ? -1 : 1;
+	srand(1);
+	for (i = 0; i < points; i++) {
+		lp[i].phi = deg2rad(sign * (55.0 + (rand() % 16000) / 1000.0));
+		lp[i].lam = deg2rad(tp->lo0 - 3.5 + (rand() % 7000) / 1000.0);
+	}
+
+	max_fwd = max_inv = max_rt = 0;
+	gps_tmerc_fwd(tm, lp, xy2, points);
+	for (i = 0; i < points; i++) {
+		xy[i] = pj_fwd(lp[i], pj);
+		d = hypot(xy[i].x - xy2[i].x, xy[i].y - xy2[i].y);
+		if (d > max_fwd)
+			max_fwd = d;
+	}
+	gps_tmerc_inv(tm, xy, lp2, points);
+	for (i = 0; i < points; i++) {
+		XY a, b;
+
+		/* Compare inverses by projecting the results back */
+		a = pj_fwd(pj_inv(xy[i], pj), pj);
+		b = pj_fwd(lp2[i], pj);
+		d = hypot(a.x - b.x, a.y - b.y);
+		if (d > max_inv)
+			max_inv = d;
+	}
+	gps_tmerc_fwd(tm, lp2, xy2, points);
+	for (i = 0; i < points; i++) {
+		d = hypot(xy[i].x - xy2[i].x, xy[i].y - xy2[i].y);
+		if (d > max_rt)
+			max_rt = d;
+	}
+	printf("%s: max difference to PJ_tmerc: fwd %.4f mm, inv %.4f mm; "
+	       "round trip %.6f mm\n", tp->name, max_fwd * 1e3,
+	       max_inv * 1e3, max_rt * 1e3);
+	/* In meters */
+	fail = bench_limit("fwd difference", max_fwd, 0.001);
+	fail |= bench_limit("inv difference", max_inv, 0.001);
+	fail |= bench_limit("round trip", max_rt, 0.001);
+
+	start = now();
+	for (r = 0; r < rounds; r++)
+		for (i = 0; i < points; i++)
+			xy[i] = pj_fwd(lp[i], pj);
+	t_pj = now() - start;
+	start = now();
+	for (r = 0; r < rounds; r++)
+		gps_tmerc_fwd(tm, lp, xy2, points);
+	t_fast = now() - start;
+	printf("  fwd: pj_fwd %.1f ns/point, fast %.1f ns/point (%.2fx)\n",
+	       t_pj * 1e9 / ((double) points * rounds),
+	       t_fast * 1e9 / ((double) points * rounds), t_pj / t_fast);
+
+	start = now();
+	for (r = 0; r < rounds; r++)
+		for (i = 0; i < points; i++)
+			lp2[i] = pj_inv(xy[i], pj);
+	t_pj = now() - start;
+	start = now();
+	for (r = 0; r < rounds; r++)
+		gps_tmerc_inv(tm, xy, lp2, points);
+	t_fast = now() - start;
+	printf("  inv: pj_inv %.1f ns/point, fast %.1f ns/point (%.2fx)\n",
+	       t_pj * 1e9 / ((double) points * rounds),
+	       t_fast * 1e9 / ((double) points * rounds), t_pj / t_fast);
+
+	free(lp);
+	free(lp2);
+	free(xy);
+	free(xy2);
+	gps_tmerc_free(tm);
+	pj_free(pj);
+
+	return fail;
+}
+
+int main(int argc, char *argv[])
+{
+	int i, points, rounds, fail = 0;
+
+	points = argc > 1 ? atoi(argv[1]) : 10000;
+	rounds = argc > 2 ? atoi(argv[2]) : 100;
+
+	for (i = 0; i < sizeof(test_projs) / sizeof(test_projs[0]); i++)
+		fail |= bench_proj(&test_projs[i], points, rounds);
+
+	return fail;
+}
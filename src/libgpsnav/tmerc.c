@@ -0,0 +1,300 @@
+/*
+ * Transverse Mercator fast path
+ *
+ * Ellipsoidal tmerc and utm projections are evaluated with the
+ * sixth-order Kruger series, whose coefficients depend only on the
+ * flattening and are computed once per PJ. The series is accurate to
+ * well below a millimeter within the usual zone widths. The forward and
+ * inverse sums are evaluated with Clenshaw's recurrence, so a point
+ * costs a fixed handful of transcendental calls.
+ *
+ * The map code uses it for the inverse only: the forward direction
+ * needs an atan2 and an asinh per point and loses to the truncated
+ * series of PJ_tmerc, which is within a few micrometers of it inside a
+ * zone. gpsnav-tmerc-bench measures both.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <lib_proj.h>
+
+#include "tmerc.h"
+
+#define ORDER	6
+
+struct gps_tmerc {
+	double es;
+	double lam0;
+	double k0a;		/* k0 times the rectifying radius */
+	double y_off;		/* northing of phi0, minus y0 */
+	double x0;
+	double fr_meter, to_meter;
+	int over;
+	double alp[ORDER + 1];	/* conformal to tmerc, 1-based */
+	double bet[ORDER + 1];	/* tmerc to conformal */
+	double del[ORDER + 1];	/* conformal to geodetic latitude */
+};
+
+static void compute_coeffs(struct gps_tmerc *tm, double n)
+{
+	double n2 = n * n, n3 = n2 * n, n4 = n3 * n, n5 = n4 * n, n6 = n5 * n;
+
+	tm->alp[1] = n / 2 - 2 * n2 / 3 + 5 * n3 / 16 + 41 * n4 / 180 -
+		127 * n5 / 288 + 7891 * n6 / 37800;
+	tm->alp[2] = 13 * n2 / 48 - 3 * n3 / 5 + 557 * n4 / 1440 +
+		281 * n5 / 630 - 1983433 * n6 / 1935360;
+	tm->alp[3] = 61 * n3 / 240 - 103 * n4 / 140 + 15061 * n5 / 26880 +
+		167603 * n6 / 181440;
+	tm->alp[4] = 49561 * n4 / 161280 - 179 * n5 / 168 +
+		6601661 * n6 / 7257600;
+	tm->alp[5] = 34729 * n5 / 80640 - 3418889 * n6 / 1995840;
+	tm->alp[6] = 212378941 * n6 / 319334400;
+
+	tm->bet[1] = n / 2 - 2 * n2 / 3 + 37 * n3 / 96 - n4 / 360 -
+		81 * n5 / 512 + 96199 * n6 / 604800;
+	tm->bet[2] = n2 / 48 + n3 / 15 - 437 * n4 / 1440 + 46 * n5 / 105 -
+		1118711 * n6 / 3870720;
+	tm->bet[3] = 17 * n3 / 480 - 37 * n4 / 840 - 209 * n5 / 4480 +
+		5569 * n6 / 90720;
+	tm->bet[4] = 4397 * n4 / 161280 - 11 * n5 / 504 -
+		830251 * n6 / 7257600;
+	tm->bet[5] = 4583 * n5 / 161280 - 108847 * n6 / 3991680;
+	tm->bet[6] = 20648693 * n6 / 638668800;
+
+	tm->del[1] = 2 * n - 2 * n2 / 3 - 2 * n3 + 116 * n4 / 45 +
+		26 * n5 / 45 - 2854 * n6 / 675;
+	tm->del[2] = 7 * n2 / 3 - 8 * n3 / 5 - 227 * n4 / 45 +
+		2704 * n5 / 315 + 2323 * n6 / 945;
+	tm->del[3] = 56 * n3 / 15 - 136 * n4 / 35 - 1262 * n5 / 105 +
+		73814 * n6 / 2835;
+	tm->del[4] = 4279 * n4 / 630 - 332 * n5 / 35 - 399572 * n6 / 14175;
+	tm->del[5] = 4174 * n5 / 315 - 144838 * n6 / 6237;
+	tm->del[6] = 601676 * n6 / 22275;
+}
+
+/* Returns sum of c[k] sin(2k(xi + i eta)) for k = 1..ORDER in *re, *im,
+ * given the sine and cosine of 2 xi and the hyperbolic ones of 2 eta */
+static void clenshaw_complex(const double *c, double s2, double c2,
+			     double sh2, double ch2, double *re, double *im)
+{
+	double yr, yi, b1r = 0, b1i = 0, b2r = 0, b2i = 0;
+	int k;
+
+	/* 2 cos(2 zeta) */
+	yr = 2 * c2 * ch2;
+	yi = -2 * s2 * sh2;
+	for (k = ORDER; k >= 1; k--) {
+		double br, bi;
+
+		br = c[k] + yr * b1r - yi * b1i - b2r;
+		bi = yr * b1i + yi * b1r - b2i;
+		b2r = b1r;
+		b2i = b1i;
+		b1r = br;
+		b1i = bi;
+	}
+	/* times sin(2 zeta) */
+	*re = s2 * ch2 * b1r - c2 * sh2 * b1i;
+	*im = s2 * ch2 * b1i + c2 * sh2 * b1r;
+}
+
+/* Returns sum of c[k] sin(2k x) for k = 1..ORDER, given sin and cos
+ * of 2 x */
+static double clenshaw_real(const double *c, double s2, double c2)
+{
+	double y, b1 = 0, b2 = 0;
+	int k;
+
+	y = 2 * c2;
+	for (k = ORDER; k >= 1; k--) {
+		double b = c[k] + y * b1 - b2;
+
+		b2 = b1;
+		b1 = b;
+	}
+	return s2 * b1;
+}
+
+/* The series corrections, and longitudes within a zone, are small
+ * angles whose sines and cosines are cheaper as Taylor polynomials.
+ * These are exact to double precision below SMALL_ANGLE. */
+#define SMALL_ANGLE	0.1
+
+static void small_sincos(double d, double *s, double *c)
+{
+	double d2 = d * d;
+
+	if (fabs(d) >= SMALL_ANGLE) {
+		*s = sin(d);
+		*c = cos(d);
+		return;
+	}
+	*s = d * (1 - d2 / 6 * (1 - d2 / 20 * (1 - d2 / 42 *
+		(1 - d2 / 72))));
+	*c = 1 - d2 / 2 * (1 - d2 / 12 * (1 - d2 / 30 * (1 - d2 / 56 *
+		(1 - d2 / 90))));
+}
+
+static void small_sinhcosh(double d, double *sh, double *ch)
+{
+	double d2 = d * d;
+
+	if (fabs(d) >= SMALL_ANGLE) {
+		*sh = sinh(d);
+		*ch = cosh(d);
+		return;
+	}
+	*sh = d * (1 + d2 / 6 * (1 + d2 / 20 * (1 + d2 / 42 *
+		(1 + d2 / 72))));
+	*ch = 1 + d2 / 2 * (1 + d2 / 12 * (1 + d2 / 30 * (1 + d2 / 56 *
+		(1 + d2 / 90))));
+}
+
+static double small_asinh(double x)
+{
+	double x2 = x * x;
+
+	if (fabs(x) >= SMALL_ANGLE / 2)
+		return asinh(x);
+	return x * (1 - x2 * (1. / 6 - x2 * (3. / 40 - x2 * (5. / 112 -
+		x2 * (35. / 1152 - x2 * 63. / 2816)))));
+}
+
+/* Geodetic latitude and longitude, relative to lam0, to tmerc xi, eta */
+static void geodetic_to_tmerc(const struct gps_tmerc *tm, double phi,
+			      double lam, double *xi, double *eta)
+{
+	double s, c, q, psi, sig, taup, sl, cl, r2, sh, ch, re, im;
+
+	s = sin(phi);
+	c = cos(phi);
+	/* sig = sinh(e atanh(e sin(phi))), both as power series, as e^2
+	 * and the sinh argument are small */
+	q = tm->es * s * s;
+	psi = tm->es * s * (1 + q * (1. / 3 + q * (1. / 5 + q * (1. / 7 +
+		q * (1. / 9 + q / 11)))));
+	sig = psi * (1 + psi * psi / 6 * (1 + psi * psi / 20));
+	/* Tangent of the conformal latitude */
+	taup = (s * sqrt(1 + sig * sig) - sig) / c;
+
+	small_sincos(lam, &sl, &cl);
+	r2 = taup * taup + cl * cl;
+	sh = sl / sqrt(r2);
+	ch = sqrt(1 + sh * sh);
+	*xi = atan2(taup, cl);
+	*eta = small_asinh(sh);
+	clenshaw_complex(tm->alp, 2 * taup * cl / r2,
+			 (cl * cl - taup * taup) / r2, 2 * sh * ch,
+			 1 + 2 * sh * sh, &re, &im);
+	*xi += re;
+	*eta += im;
+}
+
+struct gps_tmerc *gps_tmerc_new(PJ *pj)
+{
+	struct gps_tmerc *tm;
+	const char *name;
+	double f, n, xi, eta;
+
+	name = pj_param(pj->params, "sproj").s;
+	if (name == NULL ||
+	    (strcmp(name, "tmerc") != 0 && strcmp(name, "utm") != 0))
+		return NULL;
+	/* The spherical form and geocentric latitudes stay with proj4 */
+	if (pj->es == 0 || pj->geoc)
+		return NULL;
+
+	tm = malloc(sizeof(*tm));
+	if (tm == NULL)
+		return NULL;
+	memset(tm, 0, sizeof(*tm));
+	tm->es = pj->es;
+	f = 1 - sqrt(pj->one_es);
+	n = f / (2 - f);
+	compute_coeffs(tm, n);
+	tm->k0a = pj->k0 * pj->a / (1 + n) *
+		(1 + n * n / 4 + n * n * n * n / 64 +
+		 n * n * n * n * n * n / 256);
+	tm->lam0 = pj->lam0;
+	tm->over = pj->over;
+	tm->x0 = pj->x0;
+	tm->fr_meter = pj->fr_meter;
+	tm->to_meter = pj->to_meter;
+	geodetic_to_tmerc(tm, pj->phi0, 0, &xi, &eta);
+	tm->y_off = tm->k0a * xi - pj->y0;
+
+	return tm;
+}
+
+void gps_tmerc_free(struct gps_tmerc *tm)
+{
+	free(tm);
+}
+
+/* Same interface and range checks as pj_fwd() */
+void gps_tmerc_fwd(const struct gps_tmerc *tm, const LP *lp, XY *xy,
+		   int count)
+{
+	int i;
+
+	pj_errno = 0;
+	for (i = 0; i < count; i++) {
+		LP p = lp[i];
+		double t, xi, eta;
+
+		if ((t = fabs(p.phi) - HALFPI) > 1.0e-12 || fabs(p.lam) > 10.) {
+			xy[i].x = xy[i].y = HUGE_VAL;
+			pj_errno = -14;
+			continue;
+		}
+		if (fabs(t) <= 1.0e-12)
+			p.phi = p.phi < 0. ? -HALFPI : HALFPI;
+		p.lam -= tm->lam0;
+		if (!tm->over)
+			p.lam = pj_adjlon(p.lam);
+		geodetic_to_tmerc(tm, p.phi, p.lam, &xi, &eta);
+		xy[i].x = tm->fr_meter * (tm->k0a * eta + tm->x0);
+		xy[i].y = tm->fr_meter * (tm->k0a * xi - tm->y_off);
+	}
+}
+
+/* Same interface as pj_inv() */
+void gps_tmerc_inv(const struct gps_tmerc *tm, const XY *xy, LP *lp,
+		   int count)
+{
+	int i;
+
+	pj_errno = 0;
+	for (i = 0; i < count; i++) {
+		double xi, eta, sx, cx, ex, she, che, re, im, sd, cd;
+		double sxp, cxp, shp, q, r2;
+
+		xi = (xy[i].y * tm->to_meter + tm->y_off) / tm->k0a;
+		eta = (xy[i].x * tm->to_meter - tm->x0) / tm->k0a;
+		sx = sin(xi);
+		cx = cos(xi);
+		ex = exp(eta);
+		she = (ex - 1 / ex) / 2;
+		che = (ex + 1 / ex) / 2;
+		clenshaw_complex(tm->bet, 2 * sx * cx, 1 - 2 * sx * sx,
+				 2 * she * che, 1 + 2 * she * she, &re, &im);
+
+		/* Subtract the corrections with the angle sum formulas */
+		small_sincos(re, &sd, &cd);
+		sxp = sx * cd - cx * sd;
+		cxp = cx * cd + sx * sd;
+		small_sinhcosh(im, &sd, &cd);
+		shp = she * cd - che * sd;
+
+		/* Conformal latitude, then geodetic */
+		q = sqrt(shp * shp + cxp * cxp);
+		r2 = sxp * sxp + q * q;
+		lp[i].phi = atan2(sxp, q) +
+			clenshaw_real(tm->del, 2 * sxp * q / r2,
+				      (q * q - sxp * sxp) / r2);
+		lp[i].lam = atan2(shp, cxp) + tm->lam0;
+		if (!tm->over)
+			lp[i].lam = pj_adjlon(lp[i].lam);
+	}
+}
@@ -0,0 +1,18 @@
+#ifndef GPSNAV_TMERC_H
+#define GPSNAV_TMERC_H
+
+/* Needs lib_proj.h */
+
+struct gpsnav;
+struct gps_tmerc;
+
+extern struct gps_tmerc *gps_tmerc_new(PJ *pj);
+extern void gps_tmerc_free(struct gps_tmerc *tm);
+extern void gps_tmerc_fwd(const struct gps_tmerc *tm, const LP *lp, XY *xy,
+			  int count);
+extern void gps_tmerc_inv(const struct gps_tmerc *tm, const XY *xy, LP *lp,
+			  int count);
+
+extern struct gps_tmerc *gpsnav_get_tmerc(struct gpsnav *gpsnav, PJ *pj);
+
+#endif